@@ -0,0 +1,70 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_BENCH_UTIL_H_
+#define _IPVAR_BENCH_UTIL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Small helpers shared by the benchmarks.
+// Results are printed as one JSON object per line, so they can be collected and compared between releases.
+
+namespace ipvbench {
+
+    class Timer {
+    public:
+        Timer() : start(std::chrono::steady_clock::now()) {}
+
+        double ElapsedNs() const
+        {
+            return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+
+    private:
+        std::chrono::steady_clock::time_point start;
+    };
+
+    inline void Report(const char* benchmark, const char* variant, std::size_t variables, unsigned threads, std::size_t operations, double elapsedNs)
+    {
+        double nsPerOp = operations ? elapsedNs / operations : 0.0;
+        double opsPerSec = elapsedNs > 0 ? operations * 1e9 / elapsedNs : 0.0;
+        std::printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"variables\":%zu,\"threads\":%u,\"operations\":%zu,\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f}\n",
+            benchmark, variant, variables, threads, operations, nsPerOp, opsPerSec);
+        std::fflush(stdout);
+    }
+
+    // Median of the durations of repetitions runs of f, in nanoseconds. The first run is a warm up and is not counted.
+    template<typename F>
+    double MedianNs(unsigned repetitions, F f)
+    {
+        f();
+        std::vector<double> durations;
+        for (unsigned r = 0; r < repetitions; ++r)
+        {
+            Timer timer;
+            f();
+            durations.push_back(timer.ElapsedNs());
+        }
+        std::sort(durations.begin(), durations.end());
+        return durations[durations.size() / 2];
+    }
+
+    // Names shaped like the ones of real services: svc<n>.worker<n>.<metric><n>
+    inline std::vector<std::string> MakeNames(std::size_t count, const char* prefix = "svc")
+    {
+        std::vector<std::string> names;
+        names.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+            names.push_back(std::string(prefix) + std::to_string(i % 17) + ".worker" + std::to_string(i % 251) + ".counter" + std::to_string(i));
+        return names;
+    }
+
+} // namespace ipvbench
+
+#endif // _IPVAR_BENCH_UTIL_H_
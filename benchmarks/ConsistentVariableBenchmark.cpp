@@ -0,0 +1,103 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_CONSISTENT"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_consistent.h"
+#include "BenchUtil.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Writer and reader processes hammer a consistent_variable holding a 256 bytes struct.
+// Every write stores the same value in all the fields: a reader seeing two different fields got a torn value.
+// The benchmark reports the read and write throughput, and fails if any torn read is detected.
+//   ConsistentVariableBenchmark [writers [readers [duration in ms]]]
+
+struct WideRecord {
+    long long fields[32];
+};
+
+namespace {
+
+    int durationMs = 2000;
+
+    int RunWriter(long long id)
+    {
+        decl_ipv_consistent_variable(WideRecord, wideRecord);
+        WideRecord v;
+        std::size_t writes = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < durationMs * 1e6)
+        {
+            for (int i = 0; i < 256; ++i, ++writes)
+            {
+                long long value = (id << 40) + static_cast<long long>(writes);
+                for (long long& f : v.fields) f = value;
+                wideRecord.store(v);
+            }
+        }
+        ipvbench::Report("consistent_variable_store", "seqlock", 1, 1, writes, timer.ElapsedNs());
+        return 0;
+    }
+
+    int RunReader()
+    {
+        decl_ipv_consistent_variable(WideRecord, wideRecord);
+        std::size_t reads = 0, torn = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < durationMs * 1e6)
+        {
+            for (int i = 0; i < 256; ++i, ++reads)
+            {
+                WideRecord v = wideRecord.load();
+                for (long long f : v.fields)
+                {
+                    if (f != v.fields[0]) { torn++; break; }
+                }
+            }
+        }
+        ipvbench::Report("consistent_variable_load", "seqlock", 1, 1, reads, timer.ElapsedNs());
+        if (torn != 0)
+            std::printf("{\"error\":\"torn reads\",\"count\":%zu}\n", torn);
+        std::fflush(stdout);
+        return torn == 0 ? 0 : 1;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    int writers = argc > 1 ? std::atoi(argv[1]) : 2;
+    int readers = argc > 2 ? std::atoi(argv[2]) : 4;
+    if (argc > 3)
+        durationMs = std::atoi(argv[3]);
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    decl_ipv_consistent_variable(WideRecord, wideRecord);
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < writers + readers; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(i < writers ? RunWriter(i + 1) : RunReader());
+        children.push_back(pid);
+    }
+
+    int failures = 0;
+    for (pid_t pid : children)
+    {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
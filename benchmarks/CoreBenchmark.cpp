@@ -0,0 +1,116 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_CORE"
+#define IPV_SHARED_MEMORY_SIZE 256*1024*1024
+#define IPV_DIRECTORY_CAPACITY 262144
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <cstring>
+#include <memory>
+
+// Hot paths of the library, with 10 to 100000 variables in the directory:
+//  - construct: creation of an ipv::variable, up to the directory size
+//  - exists: lookup of a variable by name
+//  - dereference: read of the value through the ipv::variable
+//  - list_all: one ListAllVariables call over the whole directory
+//  - allocate: allocate_shared_memory + deallocate_shared_memory of 64 bytes
+// The names and the order of the operations are fixed. Each measure is the median of 5 runs.
+// --quick stops at 1000 variables, with fewer operations: it is the smoke test run by ctest.
+
+namespace {
+
+    typedef ipv::variable<long long> Variable;
+
+    const unsigned repetitions = 5;
+
+    // Number of times a pass over n variables is repeated to reach about target operations
+    std::size_t Passes(std::size_t target, std::size_t n)
+    {
+        return (std::max)(static_cast<std::size_t>(1), target / n);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    const std::size_t maxVariables = quick ? 1000 : 100000;
+    const std::size_t target = quick ? 20000 : 1000000;
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int status = 0;
+    {
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        std::vector<std::string> names = ipvbench::MakeNames(maxVariables);
+        std::vector<std::unique_ptr<Variable>> variables;
+        variables.reserve(maxVariables);
+
+        for (std::size_t n = 10; n <= maxVariables; n *= 10)
+        {
+            // Constructs the variables up to n. Each new variable is created, not attached to.
+            ipvbench::Timer timer;
+            std::size_t first = variables.size();
+            for (std::size_t i = first; i < n; ++i)
+                variables.emplace_back(new Variable(names[i].c_str(), ipv::TypeToInt<long long>(), false, "", static_cast<long long>(i)));
+            ipvbench::Report("construct", "variable", n, 1, n - first, timer.ElapsedNs());
+
+            std::size_t passes = Passes(target, n);
+            std::size_t found = 0;
+            double ns = ipvbench::MedianNs(repetitions, [&]() {
+                size_t offset;
+                for (std::size_t p = 0; p < passes; ++p)
+                    for (std::size_t i = 0; i < n; ++i)
+                        found += manager.exists(names[i].c_str(), offset) ? 1 : 0;
+                });
+            ipvbench::Report("exists", "hit", n, 1, passes * n, ns);
+
+            ns = ipvbench::MedianNs(repetitions, [&]() {
+                size_t offset;
+                for (std::size_t p = 0; p < passes; ++p)
+                    for (std::size_t i = 0; i < n; ++i)
+                        found += manager.exists(names[i].c_str() + 1, offset) ? 1 : 0;
+                });
+            ipvbench::Report("exists", "miss", n, 1, passes * n, ns);
+
+            long long sum = 0;
+            ns = ipvbench::MedianNs(repetitions, [&]() {
+                for (std::size_t p = 0; p < passes; ++p)
+                    for (std::size_t i = 0; i < n; ++i)
+                        sum += *static_cast<long long*>(*variables[i]);
+                });
+            ipvbench::Report("dereference", "read", n, 1, passes * n, ns);
+
+            std::vector<boost::tuple<std::string, std::string, int, void*>> list;
+            // ListAllVariables scans all the slots of the directory: its cost depends on IPV_DIRECTORY_CAPACITY as well
+            std::size_t calls = quick ? 2 : 10;
+            ns = ipvbench::MedianNs(repetitions, [&]() {
+                for (std::size_t c = 0; c < calls; ++c)
+                    manager.ListAllVariables(list);
+                });
+            ipvbench::Report("list_all", "ListAllVariables", n, 1, calls, ns);
+
+            std::size_t allocations = quick ? 10000 : 100000;
+            ns = ipvbench::MedianNs(repetitions, [&]() {
+                for (std::size_t i = 0; i < allocations; ++i)
+                    ipv::deallocate_shared_memory(ipv::allocate_shared_memory(64));
+                });
+            ipvbench::Report("allocate", "allocate_shared_memory", n, 1, allocations, ns);
+
+            // The results are checked, so that the loops are not optimized away
+            long long expected = static_cast<long long>(n) * static_cast<long long>(n - 1) / 2 * static_cast<long long>(passes) * (repetitions + 1);
+            if (sum != expected || list.size() != n + ipv::IPVarInstrumentation::nbVariables || found != passes * n * (repetitions + 1))
+            {
+                std::printf("{\"error\":\"unexpected results with %zu variables\"}\n", n);
+                status = 1;
+            }
+        }
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return status;
+}
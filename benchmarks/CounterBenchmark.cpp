@@ -0,0 +1,62 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_COUNTER"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_counter.h"
+#include "BenchUtil.h"
+
+// Increment throughput of a std::atomic<long long> variable and of a sharded_counter<long long> variable,
+// with an increasing number of threads, up to the number of cores.
+
+namespace {
+
+    template<typename Counter>
+    void Run(const char* variant, Counter& counter, unsigned threads, std::size_t increments)
+    {
+        std::vector<std::thread> workers;
+        ipvbench::Timer timer;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&]() {
+                for (std::size_t i = 0; i < increments; ++i)
+                    counter++;
+                });
+        }
+        for (std::thread& w : workers) w.join();
+        ipvbench::Report("counter_increment", variant, 1, threads, increments * threads, timer.ElapsedNs());
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    {
+        decl_ipv_variable_3(std::atomic<long long>, atomicRequests, "std::atomic counter", 0);
+        decl_ipv_variable(ipv::sharded_counter<long long>, shardedRequests);
+
+        const std::size_t increments = 5000000;
+        std::vector<unsigned> threadCounts;
+        unsigned hw = std::thread::hardware_concurrency();
+        for (unsigned threads = 1; threads < hw; threads *= 2)
+            threadCounts.push_back(threads);
+        threadCounts.push_back(hw ? hw : 1);
+
+        for (unsigned threads : threadCounts)
+        {
+            *atomicRequests = 0;
+            (*shardedRequests).reset();
+            Run("atomic", *atomicRequests, threads, increments);
+            Run("sharded", *shardedRequests, threads, increments);
+            if (*atomicRequests != (*shardedRequests).load())
+                std::printf("{\"error\":\"counters differ\"}\n");
+        }
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return 0;
+}
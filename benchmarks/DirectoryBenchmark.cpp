@@ -0,0 +1,151 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#include "../ipvar/ipvar.h"
+#include "BenchUtil.h"
+
+#include <thread>
+
+// Compares the lock-free hashed directory with the interprocess map + upgradable mutex it replaces.
+// Both live in a private segment, so that running the benchmark does not disturb the processes using IPV_SHARED_MEMORY_NAME.
+
+namespace {
+
+    const char* BENCH_SEGMENT_NAME = "IPV_BENCH_DIRECTORY";
+
+    typedef ipv::SharedMemoryMap<ipv::variable_name_type, ipv::IPVarRecord> LegacyMap;
+
+    void BenchLegacyMap(_shared_memory_& segment, const std::vector<std::string>& names, const std::vector<unsigned>& threadCounts, std::size_t lookups)
+    {
+        LegacyMap* pMap = segment.construct<LegacyMap>("LegacyMap")(segment.get_segment_manager());
+        bip::interprocess_upgradable_mutex* pMutex = segment.construct<bip::interprocess_upgradable_mutex>("LegacyMutex")();
+
+        ipvbench::Timer insertTimer;
+        for (const std::string& name : names)
+        {
+            bip::scoped_lock<bip::interprocess_upgradable_mutex> lock(*pMutex);
+            if (pMap->find(ipv::variable_name_type(name.c_str())) != pMap->end())
+                continue;
+            ipv::IPVarRecord record;
+            record.name = name.c_str();
+            record.varOffset = segment.get_free_memory();
+            pMap->insert(std::make_pair(record.name, record));
+        }
+        ipvbench::Report("directory_insert", "map", names.size(), 1, names.size(), insertTimer.ElapsedNs());
+
+        for (unsigned threads : threadCounts)
+        {
+            std::vector<std::thread> workers;
+            ipvbench::Timer lookupTimer;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]() {
+                    std::size_t found = 0;
+                    for (std::size_t i = 0; i < lookups; ++i)
+                    {
+                        const std::string& name = names[(i * 7919 + t) % names.size()];
+                        bip::sharable_lock<bip::interprocess_upgradable_mutex> lock(*pMutex);
+                        found += (pMap->find(ipv::variable_name_type(name.c_str())) != pMap->end());
+                    }
+                    if (found != lookups) std::printf("lookup error\n");
+                    });
+            }
+            for (std::thread& w : workers) w.join();
+            ipvbench::Report("directory_lookup", "map", names.size(), threads, lookups * threads, lookupTimer.ElapsedNs());
+        }
+    }
+
+    void BenchDirectory(_shared_memory_& segment, const std::vector<std::string>& names, const std::vector<unsigned>& threadCounts, std::size_t lookups)
+    {
+        ipv::IPVarDirectory* pDirectory = segment.construct<ipv::IPVarDirectory>("Directory")(&segment, names.size() * 2);
+
+        ipvbench::Timer insertTimer;
+        for (const std::string& name : names)
+        {
+            bool justCreated;
+            pDirectory->Insert(name.c_str(), [&](ipv::IPVarRecord& record) {
+                record.varOffset = segment.get_free_memory();
+                return true;
+                }, justCreated);
+        }
+        ipvbench::Report("directory_insert", "hashed", names.size(), 1, names.size(), insertTimer.ElapsedNs());
+
+        for (unsigned threads : threadCounts)
+        {
+            std::vector<std::thread> workers;
+            ipvbench::Timer lookupTimer;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]() {
+                    std::size_t found = 0;
+                    for (std::size_t i = 0; i < lookups; ++i)
+                    {
+                        const std::string& name = names[(i * 7919 + t) % names.size()];
+                        found += (pDirectory->Find(name.c_str()) != ipv::IPVarDirectory::npos);
+                    }
+                    if (found != lookups) std::printf("lookup error\n");
+                    });
+            }
+            for (std::thread& w : workers) w.join();
+            ipvbench::Report("directory_lookup", "hashed", names.size(), threads, lookups * threads, lookupTimer.ElapsedNs());
+        }
+    }
+
+    // Insertion and removal of distinct names, ten times the capacity of the directory: the removed slots must be reused
+    bool BenchChurn(_shared_memory_& segment, const std::vector<std::string>& names)
+    {
+        const std::size_t capacity = names.size() / 10;
+        ipv::IPVarDirectory* pDirectory = segment.construct<ipv::IPVarDirectory>("ChurnDirectory")(&segment, capacity);
+
+        ipvbench::Timer churnTimer;
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            bool justCreated;
+            std::size_t index = pDirectory->Insert(names[i].c_str(), [&](ipv::IPVarRecord& record) {
+                record.varOffset = i;
+                return true;
+                }, justCreated);
+            if (index == ipv::IPVarDirectory::npos)
+            {
+                std::printf("churn error: directory full after %zu insertions\n", i);
+                return false;
+            }
+            // Keeps half of the capacity in use
+            if (i >= capacity / 2)
+                pDirectory->Remove(pDirectory->Find(names[i - capacity / 2].c_str()));
+        }
+        ipvbench::Report("directory_churn", "hashed", capacity, 1, names.size(), churnTimer.ElapsedNs());
+        return true;
+    }
+}
+
+
+int main()
+{
+    const std::size_t sizes[] = { 100, 1000, 10000, 50000 };
+    const std::size_t lookups = 200000;
+
+    std::vector<unsigned> threadCounts = { 1, 2, 4 };
+    unsigned hw = std::thread::hardware_concurrency();
+    if (hw > 4) threadCounts.push_back(hw);
+
+    bool failed = false;
+    for (std::size_t count : sizes)
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(count);
+        std::size_t segmentSize = 16 * 1024 * 1024 + count * 2 * (sizeof(ipv::IPVarDirectorySlot) + 2 * sizeof(ipv::IPVarRecord));
+
+        bip::shared_memory_object::remove(BENCH_SEGMENT_NAME);
+        {
+            _shared_memory_ segment(bip::create_only, BENCH_SEGMENT_NAME, segmentSize);
+            BenchLegacyMap(segment, names, threadCounts, lookups);
+            BenchDirectory(segment, names, threadCounts, lookups);
+            if (!BenchChurn(segment, names))
+                failed = true;
+        }
+        bip::shared_memory_object::remove(BENCH_SEGMENT_NAME);
+    }
+    return failed ? 1 : 0;
+}
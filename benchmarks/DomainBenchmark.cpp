@@ -0,0 +1,130 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_DOMAIN"
+#define IPV_SHARED_MEMORY_SIZE 16*1024*1024
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Two processes with different workloads, sharing one segment or each in its own domain:
+//  - telemetry: creates and removes short lived variables, as fast as it can (directory inserts and removals, allocations)
+//  - config: creates and removes its own variables, and looks up the others
+// Each process reports its time per operation. In separate domains, the processes share no directory, lock nor allocator.
+
+namespace {
+
+    const char* TELEMETRY_DOMAIN = "IPV_BENCH_DOMAIN_TELEMETRY";
+    const char* CONFIG_DOMAIN = "IPV_BENCH_DOMAIN_CONFIG";
+
+    int RunTelemetry(ipv::SharedMemoryManager& domain, const char* variant, int durationMs)
+    {
+        std::size_t operations = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < durationMs * 1e6)
+        {
+            for (int i = 0; i < 64; ++i, ++operations)
+            {
+                std::string name = "telemetry.request" + std::to_string(operations % 1024);
+                ipv::variable<long long> v(domain, name.c_str(), ipv::TypeToInt<long long>(), false, "Short lived");
+                (*v) = static_cast<long long>(operations);
+            }
+        }
+        ipvbench::Report("domain_churn", variant, 1024, 1, operations, timer.ElapsedNs());
+        return 0;
+    }
+
+    int RunConfig(ipv::SharedMemoryManager& domain, const char* variant, int durationMs)
+    {
+        std::vector<std::unique_ptr<ipv::variable<long long>>> settings;
+        for (int i = 0; i < 256; ++i)
+            settings.emplace_back(new ipv::variable<long long>(domain, ("config.setting" + std::to_string(i)).c_str(), ipv::TypeToInt<long long>(), true, "Setting"));
+
+        std::size_t operations = 0;
+        long long sum = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < durationMs * 1e6)
+        {
+            for (int i = 0; i < 64; ++i, ++operations)
+            {
+                if (i == 0)
+                {
+                    ipv::variable<long long> reloaded(domain, "config.reloaded", ipv::TypeToInt<long long>(), false, "Reload marker");
+                    sum += *reloaded;
+                    continue;
+                }
+                size_t offset;
+                if (domain.exists(("config.setting" + std::to_string(operations % 256)).c_str(), offset))
+                    sum += *static_cast<long long*>(domain.OffsetToAddress(offset));
+            }
+        }
+        ipvbench::Report("domain_config", variant, 256, 1, operations, timer.ElapsedNs());
+        return sum >= 0 ? 0 : 1;
+    }
+
+    int Run(bool separate, int durationMs)
+    {
+        const char* variant = separate ? "separate_domains" : "shared_segment";
+        std::vector<pid_t> children;
+        for (int i = 0; i < 2; ++i)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                ipv::SharedMemoryManager& domain = separate ? ipv::SharedMemoryManager::GetDomain(i == 0 ? TELEMETRY_DOMAIN : CONFIG_DOMAIN, 4 * 1024 * 1024)
+                    : ipv::SharedMemoryManager::GetInstance();
+                _exit(i == 0 ? RunTelemetry(domain, variant, durationMs) : RunConfig(domain, variant, durationMs));
+            }
+            children.push_back(pid);
+        }
+
+        int failures = 0;
+        for (pid_t pid : children)
+        {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                failures++;
+        }
+        return failures;
+    }
+
+    void RemoveSegments()
+    {
+        bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+        bip::shared_memory_object::remove(TELEMETRY_DOMAIN);
+        bip::shared_memory_object::remove(CONFIG_DOMAIN);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+    int durationMs = quick ? 200 : 1000;
+
+    RemoveSegments();
+    int failures = 0;
+    failures += Run(false, durationMs);
+    failures += Run(true, durationMs);
+
+    // The variables of a domain are listed from its own manager
+    std::size_t listed = 0;
+    ipv::SharedMemoryManager::GetDomain(CONFIG_DOMAIN).ForEachVariable([&](const ipv::IPVarView& v) {
+        if (v.name.starts_with("config."))
+            listed++;
+        });
+    std::printf("{\"benchmark\":\"domain_listing\",\"variant\":\"config_domain\",\"variables\":%zu}\n", listed);
+    if (listed != 256)
+        failures++;
+
+    RemoveSegments();
+    return failures == 0 ? 0 : 1;
+}
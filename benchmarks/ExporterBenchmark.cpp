@@ -0,0 +1,225 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_EXPORTER"
+#define IPV_SHARED_MEMORY_SIZE 128*1024*1024
+#define IPV_DIRECTORY_CAPACITY 131072
+#define IPV_EXPORTER_REMOVALS 256
+#define IPV_EXPORTER_SEND_TIMEOUT_MS 300
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_exporter.h"
+#include "BenchUtil.h"
+
+#include <memory>
+#include <sstream>
+
+// Export of 100k variables over a Unix domain socket, against a VariablesMonitor like text dump:
+//  - refresh: the pass of the exporter over the directory, with no change and with 1% of the variables changed
+//  - binary and text scrapes, full and incremental (1% changed): time per scrape and bytes sent
+//  - removals, and a check that the values held by the client are the ones of the segment
+//  - a client whose cursor is older than the removals kept gets all the variables
+//  - a client which does not read its answers does not delay the others, and is disconnected
+// The server runs in a thread of the benchmark process. ns_per_op is per exported variable.
+
+namespace {
+
+    void ReportBytes(const char* variant, std::size_t variables, std::size_t bytes)
+    {
+        std::printf("{\"benchmark\":\"exporter_bytes\",\"variant\":\"%s\",\"variables\":%zu,\"bytes\":%zu}\n", variant, variables, bytes);
+        std::fflush(stdout);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+    const std::size_t count = quick ? 10000 : 100000;
+    const std::size_t changed = count / 100;
+    const unsigned rounds = quick ? 3 : 10;
+    const std::string path = "/tmp/ipv_bench_exporter_" + std::to_string(getpid()) + ".sock";
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(count, "exp");
+        std::vector<std::unique_ptr<ipv::variable<long long>>> variables;
+        for (const std::string& name : names)
+            variables.emplace_back(new ipv::variable<long long>(name.c_str(), ipv::TypeToInt<long long>(), false, "Exported counter"));
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        std::size_t total = manager.GetDirectory()->Count();
+        std::size_t next = 0;
+        auto change = [&]() {
+            for (std::size_t i = 0; i < changed; ++i, ++next)
+                (**variables[(next * 7919) % count])++;
+            };
+
+        // The pass over the directory, alone
+        {
+            ipv::variables_exporter exporter;
+            exporter.Refresh();
+            ipvbench::Report("exporter_refresh", "unchanged", total, 1, total, ipvbench::MedianNs(rounds, [&]() { exporter.Refresh(); }));
+            double ns = 0;
+            for (unsigned r = 0; r < rounds; ++r)
+            {
+                change();
+                ipvbench::Timer timer;
+                exporter.Refresh();
+                ns += timer.ElapsedNs();
+            }
+            ipvbench::Report("exporter_refresh", "changed_1_percent", total, 1, total * rounds, ns);
+
+            std::string out;
+            exporter.WriteBinary(0, 0, out);
+            ReportBytes("binary_full", total, out.size());
+            std::uint64_t since = exporter.Sequence();
+            change();
+            exporter.Refresh();
+            out.clear();
+            exporter.WriteBinary(exporter.Epoch(), since, out);
+            ReportBytes("binary_incremental", changed, out.size());
+            out.clear();
+            exporter.WriteText(0, 0, out);
+            ReportBytes("text_full", total, out.size());
+            out.clear();
+            exporter.WriteText(exporter.Epoch(), since, out);
+            ReportBytes("text_incremental", changed, out.size());
+
+            // More removals than kept, in several refreshes: the old cursor gets all the variables, a recent one the changes
+            auto isFull = [&](std::uint64_t from) {
+                out.clear();
+                exporter.WriteBinary(exporter.Epoch(), from, out);
+                std::uint32_t flags;
+                std::memcpy(&flags, out.data() + 4, sizeof(flags));
+                return (flags & 1) != 0;
+                };
+            std::uint64_t old = exporter.Sequence();
+            for (int r = 0; r < 4; ++r)
+            {
+                std::vector<std::unique_ptr<ipv::variable<long long>>> temporary;
+                for (int i = 0; i < 100; ++i)
+                    temporary.emplace_back(new ipv::variable<long long>(("exp.temporary" + std::to_string(r) + "." + std::to_string(i)).c_str(), ipv::TypeToInt<long long>(), false, "Removed"));
+                exporter.Refresh();
+                temporary.clear();
+                exporter.Refresh();
+            }
+            std::uint64_t recent = exporter.Sequence() - 1;
+            bool oldIsFull = isFull(old), recentIsFull = isFull(recent);
+            std::printf("{\"benchmark\":\"exporter_pruned_removals\",\"removed\":400,\"old_full\":%d,\"recent_full\":%d}\n", oldIsFull ? 1 : 0, recentIsFull ? 1 : 0);
+            if (!oldIsFull || recentIsFull)
+                failures++;
+        }
+
+        // What a VariablesMonitor does: one line of text per variable, to be parsed by the scraper
+        {
+            std::string dump;
+            double ns = ipvbench::MedianNs(rounds, [&]() {
+                std::ostringstream text;
+                manager.ForEachVariable([&](const ipv::IPVarView& var) {
+                    char value[64];
+                    if (var.descriptor != nullptr)
+                        ipv::FormatValue(*var.descriptor, var.ptr, value, sizeof(value));
+                    text << "Variable name: " << var.name << "  Description: " << var.description << "  Type: " << var.type << "  Value: " << value << "\n";
+                    });
+                dump = text.str();
+                });
+            ipvbench::Report("exporter_scrape", "monitor_text_dump", total, 1, total, ns);
+            ReportBytes("monitor_text_dump", total, dump.size());
+        }
+
+        ipv::variables_exporter exporter;
+        ipv::exporter_server server(exporter, path);
+        std::atomic<bool> stop(false);
+        std::thread serving([&]() { server.Run(stop, std::chrono::milliseconds(10)); });
+        {
+            ipv::exporter_client client(path);
+            ipvbench::Timer fullTimer;
+            std::size_t received = client.Fetch();
+            ipvbench::Report("exporter_scrape", "binary_full", total, 1, received, fullTimer.ElapsedNs());
+            if (received != total)
+                failures++;
+
+            double ns = 0;
+            std::size_t sent = 0;
+            for (unsigned r = 0; r < rounds; ++r)
+            {
+                change();
+                ipvbench::Timer timer;
+                std::size_t n = client.Fetch();
+                ns += timer.ElapsedNs();
+                sent += n;
+                if (n != changed)
+                    failures++;
+            }
+            ipvbench::Report("exporter_scrape", "binary_incremental_1_percent", total, 1, sent, ns);
+
+            ipvbench::Timer textTimer;
+            std::string text = client.FetchText();
+            ipvbench::Report("exporter_scrape", "text_full", total, 1, total, textTimer.ElapsedNs());
+            ns = 0;
+            for (unsigned r = 0; r < rounds; ++r)
+            {
+                change();
+                ipvbench::Timer timer;
+                text = client.FetchText();
+                ns += timer.ElapsedNs();
+            }
+            ipvbench::Report("exporter_scrape", "text_incremental_1_percent", total, 1, changed * rounds, ns);
+
+            // Removals reach the client, and its values are the ones of the segment
+            const std::size_t removed = 100;
+            variables.resize(count - removed);
+            std::size_t nbRemoved = 0;
+            client.Fetch([&](const ipv::exporter_client::value&, bool isRemoved) { nbRemoved += isRemoved; });
+            std::size_t mismatches = 0;
+            for (const auto& entry : client.Values())
+            {
+                if (entry.second.name.compare(0, 6, "__ipv.") == 0)
+                    continue;  // The instrumentation counters move with the lookups of this check
+                size_t offset;
+                if (!manager.exists(entry.second.name.c_str(), offset) || std::memcmp(manager.OffsetToAddress(offset), entry.second.bytes.data(), entry.second.bytes.size()) != 0)
+                    mismatches++;
+            }
+            std::printf("{\"benchmark\":\"exporter_check\",\"variables\":%zu,\"removed\":%zu,\"mismatches\":%zu}\n", client.Values().size(), nbRemoved, mismatches);
+            if (nbRemoved != removed || mismatches != 0 || client.Values().size() != total - removed)
+                failures++;
+
+            // A client which asks for full scrapes and reads nothing
+            int slow = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address = ipv::exporter_detail::Address(path);
+            timeval receiveTimeout = { 2, 0 };
+            if (slow < 0 || connect(slow, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+                || setsockopt(slow, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout)) != 0)
+                failures++;
+            std::string requests;
+            for (int i = 0; i < 50; ++i)
+                requests += "BINARY 0 0\n";
+            ipv::exporter_detail::WriteAll(slow, requests.data(), requests.size());
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            change();
+            ipvbench::Timer timer;
+            std::size_t n = client.Fetch();
+            double fetchMs = timer.ElapsedNs() / 1e6;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2 * IPV_EXPORTER_SEND_TIMEOUT_MS));
+            std::size_t slowBytes = 0;
+            char buffer[65536];
+            ssize_t r;
+            while ((r = recv(slow, buffer, sizeof(buffer), 0)) > 0)
+                slowBytes += static_cast<std::size_t>(r);
+            bool disconnected = r == 0 || (r < 0 && errno == ECONNRESET); // Reset: the server closed without reading all the requests
+            close(slow);
+            std::printf("{\"benchmark\":\"exporter_slow_client\",\"fetch_ms\":%.2f,\"received\":%zu,\"slow_client_bytes\":%zu,\"disconnected\":%d}\n",
+                fetchMs, n, slowBytes, disconnected ? 1 : 0);
+            if (n == 0 || !disconnected || fetchMs > IPV_EXPORTER_SEND_TIMEOUT_MS / 2)
+                failures++;
+        }
+        stop = true;
+        serving.join();
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
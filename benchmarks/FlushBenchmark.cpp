@@ -0,0 +1,109 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_USE_MAPPED_FILE
+#define IPV_MAPPED_FILE_DIRECTORY "./"
+#define IPV_SHARED_MEMORY_NAME "ipv_bench_flush.segment"
+#define IPV_SHARED_MEMORY_SIZE 64*1024*1024
+#define IPV_DIRECTORY_CAPACITY 16384
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Segment kept in a memory mapped file (IPV_USE_MAPPED_FILE):
+//  - cost of SharedMemoryManager::Flush, waiting or not, after writing to 1 .. 10000 persistent variables
+//  - warm restart: a new process attaching to the file and reading all the variables back
+
+namespace {
+
+    const std::size_t nbVariables = 10000;
+
+    void Flush(std::vector<std::unique_ptr<ipv::variable<long long>>>& vars, std::size_t dirty, bool wait)
+    {
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        manager.Flush(true);
+
+        const std::size_t rounds = 20;
+        double elapsed = 0;
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            // Spread the writes over the segment
+            for (std::size_t i = 0; i < dirty; ++i)
+                (**vars[i * (nbVariables / dirty)])++;
+
+            ipvbench::Timer timer;
+            manager.Flush(wait);
+            elapsed += timer.ElapsedNs();
+        }
+        std::string variant = std::string(wait ? "sync_" : "async_") + std::to_string(dirty) + "_dirty";
+        ipvbench::Report("segment_flush", variant.c_str(), nbVariables, 1, rounds, elapsed);
+    }
+
+    // Runs in a process started after the segment was written, as after a restart
+    int WarmAttach()
+    {
+        ipvbench::Timer timer;
+        ipv::SharedMemoryManager::GetInstance();
+        double attach = timer.ElapsedNs();
+        ipvbench::Report("warm_restart", "attach", nbVariables, 1, 1, attach);
+
+        std::vector<std::string> names = ipvbench::MakeNames(nbVariables, "persist");
+        long long sum = 0;
+        ipvbench::Timer readTimer;
+        for (const std::string& name : names)
+        {
+            ipv::variable<long long> v(name.c_str(), ipv::TypeToInt<long long>(), true, "persistent counter");
+            sum += *v;
+        }
+        ipvbench::Report("warm_restart", "attach_and_read_all", nbVariables, 1, nbVariables, readTimer.ElapsedNs());
+        return sum != 0 ? 0 : 1;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "attach")
+        return WarmAttach();
+
+    std::string path = std::string(IPV_MAPPED_FILE_DIRECTORY) + IPV_SHARED_MEMORY_NAME;
+    bip::file_mapping::remove(path.c_str());
+
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(nbVariables, "persist");
+        std::vector<std::unique_ptr<ipv::variable<long long>>> vars;
+        for (const std::string& name : names)
+            vars.emplace_back(new ipv::variable<long long>(name.c_str(), ipv::TypeToInt<long long>(), true, "persistent counter", 1LL));
+
+        for (std::size_t dirty : { 1, 10, 100, 1000, 10000 })
+        {
+            Flush(vars, dirty, true);
+            Flush(vars, dirty, false);
+        }
+        ipv::SharedMemoryManager::GetInstance().Flush(true);
+    }
+
+    // A fresh process maps the file, the pages are read on first access
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl("/proc/self/exe", argv[0], "attach", static_cast<char*>(nullptr));
+        _exit(2);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        std::printf("warm restart: the persistent values were not read back\n");
+
+    for (std::size_t i = 0; i < IPV_SHARED_MEMORY_MAX_EXTENSIONS; ++i)
+        bip::file_mapping::remove((path + "_ext" + std::to_string(i)).c_str());
+    bip::file_mapping::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,143 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_FORMAT"
+#define IPV_SHARED_MEMORY_SIZE 64*1024*1024
+#define IPV_DIRECTORY_CAPACITY 16384
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+// Full directory dump, printing the value of every variable of a mix of types:
+//  - from the type descriptors stored in the segment, with FormatValue into a buffer
+//  - the VariablesMonitor way, with a switch on the type code and std::to_string / AsString
+// The number of heap allocations per dump is reported as well.
+
+static std::atomic<std::size_t> allocations(0);
+
+// The replacement operators are kept out of line: once one of them is inlined next to a new expression or a delete,
+// GCC pairs malloc/free with the builtin operators and reports a -Wmismatched-new-delete that does not apply here.
+#if defined(__GNUC__)
+#define IPV_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define IPV_BENCH_NOINLINE
+#endif
+
+IPV_BENCH_NOINLINE void* operator new(std::size_t size)
+{
+    allocations++;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+IPV_BENCH_NOINLINE void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+IPV_BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+struct Position {
+    int x;
+    int y;
+    double speed;
+    char label[16];
+    std::string AsString() const {
+        return "x=" + std::to_string(x) + " y=" + std::to_string(y) + " speed=" + std::to_string(speed) + " label=" + label;
+    }
+};
+
+IPV_DESCRIBE_STRUCT(Position, IPV_FIELD(Position, x), IPV_FIELD(Position, y), IPV_FIELD(Position, speed), IPV_FIELD(Position, label))
+
+template <> constexpr int ipv::TypeToInt<Position>() { return 200; }
+
+namespace {
+
+    std::string ToString(int type, void* p)
+    {
+        switch (type)
+        {
+        case ipv::TypeToInt<int>(): return std::to_string(*static_cast<int*>(p));
+        case ipv::TypeToInt<double>(): return std::to_string(*static_cast<double*>(p));
+        case ipv::TypeToInt< std::atomic<long long> >(): return std::to_string(static_cast<std::atomic<long long>*>(p)->load());
+        case ipv::TypeToInt< boost::static_string<80> >(): return static_cast<boost::static_string<80>*>(p)->c_str();
+        case ipv::TypeToInt<Position>(): return static_cast<Position*>(p)->AsString();
+        default: return "Unknown";
+        }
+    }
+
+    void ReportAllocations(const char* variant, std::size_t count, std::size_t dumps, std::size_t allocated)
+    {
+        std::printf("{\"benchmark\":\"format_allocations\",\"variant\":\"%s\",\"variables\":%zu,\"allocations_per_dump\":%.1f}\n", variant, count, double(allocated) / dumps);
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    {
+        const std::size_t count = 10000;
+        std::vector<std::string> names = ipvbench::MakeNames(count, "fmt");
+        ipv::variable_group group;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const char* name = names[i].c_str();
+            switch (i % 5)
+            {
+            case 0: group.declare<int>(name, ipv::TypeToInt<int>(), false, "int"); break;
+            case 1: group.declare<double>(name, ipv::TypeToInt<double>(), false, "double"); break;
+            case 2: group.declare<std::atomic<long long>>(name, ipv::TypeToInt<std::atomic<long long>>(), false, "counter"); break;
+            case 3: group.declare<boost::static_string<80>>(name, ipv::TypeToInt<boost::static_string<80>>(), false, "text", "some text value"); break;
+            case 4: group.declare<Position>(name, ipv::TypeToInt<Position>(), false, "position", Position{ 1, 2, 3.5, "north" }); break;
+            }
+        }
+        group.commit();
+
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        const std::size_t dumps = 100;
+
+        {
+            std::size_t length = 0;
+            std::size_t allocated = allocations;
+            ipvbench::Timer timer;
+            for (std::size_t d = 0; d < dumps; ++d)
+            {
+                manager.ForEachVariable([&](const ipv::IPVarView& v) {
+                    char text[256];
+                    length += ipv::FormatValue(*v.descriptor, v.ptr, text, sizeof(text));
+                    });
+            }
+            ipvbench::Report("format_dump", "descriptor", count, 1, dumps * count, timer.ElapsedNs());
+            ReportAllocations("descriptor", count, dumps, allocations - allocated);
+            if (length == 0) std::printf("nothing formatted\n");
+        }
+        {
+            std::size_t length = 0;
+            std::size_t allocated = allocations;
+            ipvbench::Timer timer;
+            for (std::size_t d = 0; d < dumps; ++d)
+            {
+                manager.ForEachVariable([&](const ipv::IPVarView& v) {
+                    length += ToString(v.type, v.ptr).size();
+                    });
+            }
+            ipvbench::Report("format_dump", "type_switch", count, 1, dumps * count, timer.ElapsedNs());
+            ReportAllocations("type_switch", count, dumps, allocations - allocated);
+            if (length == 0) std::printf("nothing formatted\n");
+        }
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return 0;
+}
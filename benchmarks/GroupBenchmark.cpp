@@ -0,0 +1,87 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_GROUP"
+#define IPV_SHARED_MEMORY_SIZE 64*1024*1024
+#define IPV_DIRECTORY_CAPACITY 65536
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <memory>
+
+// Registration cost of n variables, declared one by one or through a variable_group.
+// Then checks that a group whose commit fails on a type mismatch releases its variables.
+
+namespace {
+
+    bool CheckFailedCommit()
+    {
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        ipv::variable<int> existing("groupMismatch", ipv::TypeToInt<int>(), false, "bench", 7);
+        bool ok = true;
+        {
+            ipv::variable_group group;
+            ipv::group_variable<long long> created = group.declare<long long>("groupCreated", ipv::TypeToInt<long long>(), false, "bench");
+            ipv::group_variable<double> mismatch = group.declare<double>("groupMismatch", ipv::TypeToInt<double>(), false, "bench");
+            for (int attempt = 0; attempt < 2; ++attempt)
+            {
+                try {
+                    group.commit();
+                    ok = false;
+                }
+                catch (std::runtime_error&) {
+                }
+            }
+            size_t offset;
+            ok = ok && !manager.exists("groupCreated", offset);
+            (void)created;
+            (void)mismatch;
+        }
+        ipv::IPVarRecord* pRec = nullptr;
+        size_t offset;
+        ok = ok && manager.exists("groupMismatch", offset, pRec) && pRec->nbReferences == 1 && *existing == 7;
+        std::printf("{\"benchmark\":\"group_failed_commit\",\"ok\":%s}\n", ok ? "true" : "false");
+        return ok;
+    }
+}
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    ipv::SharedMemoryManager::GetInstance();
+
+    const std::size_t sizes[] = { 10, 100, 1000, 10000 };
+    for (std::size_t count : sizes)
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(count, "single");
+        {
+            std::vector<std::unique_ptr<ipv::variable<std::atomic<long long>>>> variables;
+            variables.reserve(count);
+            ipvbench::Timer timer;
+            for (const std::string& name : names)
+                variables.emplace_back(new ipv::variable<std::atomic<long long>>(name.c_str(), ipv::TypeToInt<std::atomic<long long>>(), false, "bench"));
+            ipvbench::Report("registration", "single", count, 1, count, timer.ElapsedNs());
+        }
+
+        names = ipvbench::MakeNames(count, "group");
+        {
+            ipv::variable_group group;
+            std::vector<ipv::group_variable<std::atomic<long long>>> variables;
+            variables.reserve(count);
+            ipvbench::Timer timer;
+            for (const std::string& name : names)
+                variables.push_back(group.declare<std::atomic<long long>>(name.c_str(), ipv::TypeToInt<std::atomic<long long>>(), false, "bench"));
+            group.commit();
+            ipvbench::Report("registration", "group", count, 1, count, timer.ElapsedNs());
+        }
+    }
+
+    bool ok = CheckFailedCommit();
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_GROWTH"
+#define IPV_SHARED_MEMORY_SIZE 2*1024*1024
+#define IPV_DIRECTORY_CAPACITY 8192
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <array>
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Several processes create variables well past the initial 2MB segment, so that extension segments are chained.
+// Each process then checks the values written by all the others, through its own mapping of the extensions.
+// The main process finally checks that allocate_shared_memory never uses the extensions.
+
+namespace {
+
+    typedef boost::static_string<80> Payload;
+
+    const int NB_PROCESSES = 4;
+    const int VARIABLES_PER_PROCESS = 512;
+
+    std::string VariableName(int process, int i)
+    {
+        return "growth.p" + std::to_string(process) + ".v" + std::to_string(i);
+    }
+
+    int RunProcess(int process)
+    {
+        std::vector<std::unique_ptr<ipv::variable<Payload>>> variables;
+        ipvbench::Timer timer;
+        for (int i = 0; i < VARIABLES_PER_PROCESS; ++i)
+        {
+            std::string name = VariableName(process, i);
+            // 1KB of storage per variable
+            variables.emplace_back(new ipv::variable<Payload>(name.c_str(), 0, true, "growth"));
+            std::unique_ptr<ipv::variable<std::array<char, 1024>>> ballast(new ipv::variable<std::array<char, 1024>>((name + ".b").c_str(), 0, true, "ballast"));
+            *static_cast<Payload*>(*variables.back()) = name.c_str();
+        }
+        ipvbench::Report("growth_create", "chained_segments", NB_PROCESSES * VARIABLES_PER_PROCESS, NB_PROCESSES, 2 * VARIABLES_PER_PROCESS, timer.ElapsedNs());
+
+        // Wait for the other processes, then check their values
+        decl_ipv_variable(std::atomic<int>, growthDone);
+        (*growthDone)++;
+        for (int wait = 0; *growthDone < NB_PROCESSES; ++wait)
+        {
+            if (wait > 30000)
+                return 1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        int errors = 0;
+        for (int p = 0; p < NB_PROCESSES; ++p)
+        {
+            for (int i = 0; i < VARIABLES_PER_PROCESS; ++i)
+            {
+                std::string name = VariableName(p, i);
+                ipv::variable<Payload> v(name.c_str(), 0, true, "growth");
+                if (std::string(static_cast<Payload*>(v)->c_str()) != name)
+                    errors++;
+            }
+        }
+        std::printf("{\"benchmark\":\"growth_check\",\"process\":%d,\"extensions\":%u,\"errors\":%d}\n", process,
+            ipv::SharedMemoryManager::GetInstance().NbExtensions(), errors);
+        std::fflush(stdout);
+        return errors == 0 ? 0 : 1;
+    }
+
+    // allocate_shared_memory stays in the initial segment, full after the processes: allocate_extensible_shared_memory goes to the extensions
+    int CheckAllocations()
+    {
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        std::vector<void*> blocks;
+        int errors = 0;
+        try {
+            for (;;)
+            {
+                blocks.push_back(ipv::allocate_shared_memory(64));
+                if (!manager.GetSegment()->belongs_to_segment(blocks.back()))
+                    errors++;
+            }
+        }
+        catch (bip::bad_alloc&) {
+        }
+        void* extensible = ipv::allocate_extensible_shared_memory(64);
+        if (manager.GetSegment()->belongs_to_segment(extensible))
+            errors++;
+        ipv::deallocate_shared_memory(extensible);
+        for (void* p : blocks)
+            ipv::deallocate_shared_memory(p);
+
+        std::printf("{\"benchmark\":\"growth_allocate\",\"initial_blocks\":%zu,\"errors\":%d}\n", blocks.size(), errors);
+        std::fflush(stdout);
+        return errors;
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    decl_ipv_variable_3(std::atomic<int>, growthDone, "Number of processes done", 0);
+
+    std::vector<pid_t> children;
+    for (int p = 0; p < NB_PROCESSES; ++p)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(RunProcess(p));
+        children.push_back(pid);
+    }
+
+    int failures = 0;
+    for (pid_t pid : children)
+    {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+    failures += CheckAllocations();
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    for (int i = 0; i < IPV_SHARED_MEMORY_MAX_EXTENSIONS; ++i)
+        bip::shared_memory_object::remove((std::string(IPV_SHARED_MEMORY_NAME) + "_ext" + std::to_string(i)).c_str());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_HISTOGRAM"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_histogram.h"
+#include "BenchUtil.h"
+
+#include <memory>
+#include <random>
+
+// Cost of recording a value in a histogram variable, with an increasing number of threads,
+// and cost of reading it (percentiles and AsString).
+// The percentiles of a known distribution are checked against the exact ones, with the default and the highest precision.
+
+namespace {
+
+    void Record(ipv::histogram& h, unsigned threads, std::size_t values)
+    {
+        h.Reset();
+        std::vector<std::thread> workers;
+        ipvbench::Timer timer;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&h, values, t]() {
+                std::uint64_t v = 1000 + t;
+                for (std::size_t i = 0; i < values; ++i)
+                {
+                    h.Record(v);
+                    v = (v * 2862933555777941757ULL + 3037000493ULL) % 10000000; // Spread the values over the buckets
+                }
+                });
+        }
+        for (std::thread& w : workers) w.join();
+        ipvbench::Report("histogram_record", "relaxed_increment", 1, threads, values * threads, timer.ElapsedNs());
+    }
+
+    void CheckAccuracy(ipv::histogram& h)
+    {
+        h.Reset();
+        std::vector<std::uint64_t> values;
+        std::mt19937_64 generator(42);
+        std::lognormal_distribution<double> latency(10.0, 1.0); // Median around 22 us, long tail, in ns
+        for (int i = 0; i < 1000000; ++i)
+        {
+            values.push_back(static_cast<std::uint64_t>(latency(generator)));
+            h.Record(values.back());
+        }
+        std::sort(values.begin(), values.end());
+        for (double p : { 50.0, 99.0, 99.9 })
+        {
+            std::uint64_t exact = values[static_cast<std::size_t>(std::ceil(p / 100.0 * values.size())) - 1];
+            std::uint64_t estimated = h.Percentile(p);
+            std::printf("{\"benchmark\":\"histogram_accuracy\",\"percentile\":%.1f,\"exact\":%llu,\"estimated\":%llu,\"relative_error\":%.4f}\n",
+                p, static_cast<unsigned long long>(exact), static_cast<unsigned long long>(estimated), (static_cast<double>(estimated) - exact) / exact);
+        }
+        std::fflush(stdout);
+    }
+
+    // The histogram of the highest precision has 3 million buckets: its percentiles must not copy them on the stack
+    bool CheckHighPrecision()
+    {
+        typedef ipv::basic_histogram<16> precise_histogram;
+        std::unique_ptr<precise_histogram> h(new precise_histogram());
+        for (std::uint64_t v = 1; v <= 1000000; ++v)
+            h->Record(v * 1000);
+        std::uint64_t median = h->Percentile(50.0);
+        double error = (static_cast<double>(median) - 500000000.0) / 500000000.0;
+        std::printf("{\"benchmark\":\"histogram_accuracy\",\"variant\":\"16_bits\",\"percentile\":50.0,\"exact\":500000000,\"estimated\":%llu,\"relative_error\":%.6f}\n",
+            static_cast<unsigned long long>(median), error);
+        return std::fabs(error) < 1.0 / 65536;
+    }
+
+    void Read(ipv::histogram& h, std::size_t reads)
+    {
+        std::size_t length = 0;
+        ipvbench::Timer timer;
+        for (std::size_t i = 0; i < reads; ++i)
+            length += h.AsString().size();
+        ipvbench::Report("histogram_read", "AsString", 1, 1, reads, timer.ElapsedNs());
+        if (length == 0)
+            std::printf("empty histogram\n");
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        decl_ipv_variable_2(ipv::histogram, latency, "request latency (ns)");
+
+        unsigned maxThreads = (std::max)(1u, std::thread::hardware_concurrency());
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+            Record(*latency, threads, 10000000);
+
+        CheckAccuracy(*latency);
+        Read(*latency, 100000);
+        if (!CheckHighPrecision())
+            failures++;
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
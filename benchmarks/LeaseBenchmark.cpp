@@ -0,0 +1,133 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_LEASE"
+#define IPV_SHARED_MEMORY_SIZE 16*1024*1024
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <memory>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Workers killed while they hold variables:
+//  - each round forks the workers, as a supervisor restarting them would; each one creates its own non persistent variables, attaches to a variable
+//    of the parent, and is killed with SIGKILL while it runs
+//  - the parent then reclaims the references of the dead workers: their variables must be removed, their storage
+//    freed, and the variable of the parent must be left with the parent reference only
+// The free bytes are compared from one round to the other: they must not decrease.
+// A process only attached to the segment must not have allocated the counts of its lease: they come with its first reference.
+// Also measures a variable construction and destruction, which now records the reference in the lease table.
+
+namespace {
+
+    const int WORKERS = 8;
+    const int VARIABLES_PER_WORKER = 50;
+    const int ROUNDS = 5;
+
+    struct Payload {
+        char bytes[256];
+    };
+
+    void RunWorker(int worker, std::atomic<int>* pReady)
+    {
+        std::vector<std::unique_ptr<ipv::variable<Payload>>> own;
+        for (int i = 0; i < VARIABLES_PER_WORKER; ++i)
+        {
+            std::string name = "worker" + std::to_string(worker) + ".v" + std::to_string(i);
+            own.emplace_back(new ipv::variable<Payload>(name.c_str(), 0, false, "Worker variable"));
+        }
+        ipv::variable<std::atomic<long long>> status("lease.status", 0, false, "Shared status");
+        pReady->fetch_add(1);
+        for (;;)
+        {
+            (*status)++;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    int References(const char* name)
+    {
+        size_t offset;
+        ipv::IPVarRecord* pRec;
+        return ipv::SharedMemoryManager::GetInstance().exists(name, offset, pRec) ? pRec->nbReferences.load() : -1;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+    int rounds = quick ? 1 : ROUNDS;
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        std::size_t attachedFreeBytes = manager.FreeBytes();
+        ipv::variable<std::atomic<int>> ready("lease.ready", 0, false, "Started workers");
+        std::size_t countsBytes = sizeof(std::atomic<std::int32_t>) * manager.GetDirectory()->Capacity();
+        std::size_t firstReferenceBytes = attachedFreeBytes - manager.FreeBytes();
+        std::printf("{\"benchmark\":\"lazy_lease_counts\",\"counts_bytes\":%zu,\"first_reference_bytes\":%zu}\n", countsBytes, firstReferenceBytes);
+        if (firstReferenceBytes < countsBytes)
+            failures++;
+        std::atomic<int>* pReady = ready;
+        ipv::variable<std::atomic<long long>> status("lease.status", 0, false, "Shared status");
+        std::size_t baseline = manager.GetDirectory()->Count();
+        std::size_t firstFreeBytes = 0;
+
+        for (int round = 0; round < rounds; ++round)
+        {
+            pReady->store(0);
+            std::vector<pid_t> workers;
+            for (int i = 0; i < WORKERS; ++i)
+            {
+                pid_t pid = fork();
+                if (pid == 0)
+                {
+                    RunWorker(i, pReady);
+                    _exit(0);
+                }
+                workers.push_back(pid);
+            }
+            while (pReady->load() != WORKERS)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            for (pid_t pid : workers)
+                kill(pid, SIGKILL);
+            for (pid_t pid : workers)
+                waitpid(pid, nullptr, 0);
+
+            std::size_t leaked = manager.GetDirectory()->Count() - baseline;
+            ipvbench::Timer timer;
+            std::size_t released = manager.ReclaimDeadProcesses();
+            double reclaimNs = timer.ElapsedNs();
+            std::size_t left = manager.GetDirectory()->Count() - baseline;
+            std::size_t freeBytes = manager.FreeBytes();
+            if (round == 0)
+                firstFreeBytes = freeBytes;
+
+            ipvbench::Report("reclaim_dead_workers", "lease_table", leaked, WORKERS, WORKERS, reclaimNs);
+            std::printf("{\"benchmark\":\"reclaim_dead_workers\",\"round\":%d,\"variables_before\":%zu,\"variables_after\":%zu,\"references_released\":%zu,\"status_references\":%d,\"bytes_lost\":%lld}\n",
+                round, leaked, left, released, References("lease.status"), static_cast<long long>(firstFreeBytes) - static_cast<long long>(freeBytes));
+            std::fflush(stdout);
+
+            if (left != 0 || released != static_cast<std::size_t>(WORKERS * (VARIABLES_PER_WORKER + 1)) || References("lease.status") != 1 || freeBytes < firstFreeBytes)
+                failures++;
+        }
+
+        const std::size_t n = quick ? 10000 : 100000;
+        double ns = ipvbench::MedianNs(quick ? 1 : 5, [&]() {
+            for (std::size_t i = 0; i < n; ++i)
+                ipv::variable<long long> v("lease.transient", 0, false, "Created and removed");
+            });
+        ipvbench::Report("construct_destroy", "lease_table", 1, 1, n, ns);
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_NAMES"
+#define IPV_SHARED_MEMORY_SIZE 32*1024*1024
+#define IPV_DIRECTORY_CAPACITY 32768
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <memory>
+
+// Attaching to existing variables and looking them up, with long names sharing a long prefix, as generated by services:
+//  - runtime_name: the name is a const char*, hashed and measured on each call
+//  - compile_time_name: the name is an IPV_NAME, as in the decl_ipv macros: its hash and length are constants
+// The directory holds 10000 other variables with the same prefix.
+
+#define BENCH_PREFIX "dc.eu-west-1.cluster07.frontend.http."
+
+namespace {
+
+    const char* const HOT_NAMES[] = {
+        BENCH_PREFIX "requests0", BENCH_PREFIX "requests1", BENCH_PREFIX "requests2", BENCH_PREFIX "requests3",
+        BENCH_PREFIX "requests4", BENCH_PREFIX "requests5", BENCH_PREFIX "requests6", BENCH_PREFIX "requests7",
+    };
+
+    const ipv::hashed_name HOT_HASHED_NAMES[] = {
+        IPV_NAME(BENCH_PREFIX "requests0"), IPV_NAME(BENCH_PREFIX "requests1"), IPV_NAME(BENCH_PREFIX "requests2"), IPV_NAME(BENCH_PREFIX "requests3"),
+        IPV_NAME(BENCH_PREFIX "requests4"), IPV_NAME(BENCH_PREFIX "requests5"), IPV_NAME(BENCH_PREFIX "requests6"), IPV_NAME(BENCH_PREFIX "requests7"),
+    };
+
+    template<typename Name>
+    double Attach(const Name* names, std::size_t n)
+    {
+        return ipvbench::MedianNs(5, [&]() {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                ipv::variable<long long> v(names[i % 8], ipv::TypeToInt<long long>(), false, "Attached");
+                (*v)++;
+            }
+            });
+    }
+
+    template<typename Name>
+    double Lookup(const Name* names, std::size_t n, std::size_t& found)
+    {
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        return ipvbench::MedianNs(5, [&]() {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                size_t offset;
+                found += manager.exists(names[i % 8], offset);
+            }
+            });
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+    const std::size_t n = quick ? 100000 : 1000000;
+    const std::size_t others = 10000;
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        std::vector<std::unique_ptr<ipv::variable<long long>>> variables;
+        for (std::size_t i = 0; i < others; ++i)
+            variables.emplace_back(new ipv::variable<long long>((BENCH_PREFIX "worker" + std::to_string(i)).c_str(), ipv::TypeToInt<long long>(), false, "Other"));
+        for (const char* name : HOT_NAMES)
+            variables.emplace_back(new ipv::variable<long long>(name, ipv::TypeToInt<long long>(), false, "Attached"));
+
+        ipvbench::Report("attach_long_name", "runtime_name", others + 8, 1, n, Attach(HOT_NAMES, n));
+        ipvbench::Report("attach_long_name", "compile_time_name", others + 8, 1, n, Attach(HOT_HASHED_NAMES, n));
+
+        std::size_t found = 0;
+        ipvbench::Report("lookup_long_name", "runtime_name", others + 8, 1, n, Lookup(HOT_NAMES, n, found));
+        ipvbench::Report("lookup_long_name", "compile_time_name", others + 8, 1, n, Lookup(HOT_HASHED_NAMES, n, found));
+        if (found != 12 * n)
+            failures++;
+
+        // The macros give the same variable as a runtime name
+        decl_ipv_variable(long long, hashedNameCheck);
+        *hashedNameCheck = 42;
+        size_t offset;
+        if (!ipv::SharedMemoryManager::GetInstance().exists("hashedNameCheck", offset) || *static_cast<long long*>(ipv::SharedMemoryManager::GetInstance().OffsetToAddress(offset)) != 42)
+            failures++;
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
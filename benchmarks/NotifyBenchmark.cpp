@@ -0,0 +1,76 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_NOTIFY"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Propagation latency of a change between two processes: ping-pong on two variables,
+// with wait_for_change/store_and_notify, and with the sleep polling loop it replaces.
+
+namespace {
+
+    // Waits until *var == expected, either blocked on the notification or polling each millisecond
+    void WaitForValue(ipv::variable<std::atomic<int>, int>& var, int expected, bool useNotification)
+    {
+        for (;;)
+        {
+            std::uint32_t v = var.version();
+            if (*var == expected)
+                return;
+            if (useNotification)
+                var.wait_for_change(v, std::chrono::seconds(1));
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void PingPong(bool useNotification, int iterations)
+    {
+        decl_ipv_variable_3(std::atomic<int>, ping, "ping", 0);
+        decl_ipv_variable_3(std::atomic<int>, pong, "pong", 0);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            for (int i = 1; i <= iterations; ++i)
+            {
+                WaitForValue(ping, i, useNotification);
+                pong.store_and_notify(i);
+            }
+            _exit(0);
+        }
+
+        ipvbench::Timer timer;
+        for (int i = 1; i <= iterations; ++i)
+        {
+            ping.store_and_notify(i);
+            WaitForValue(pong, i, useNotification);
+        }
+        double elapsed = timer.ElapsedNs();
+        waitpid(pid, nullptr, 0);
+
+        // One operation is one change propagated to the other process
+        ipvbench::Report("change_propagation", useNotification ? "wait_for_change" : "poll_1ms", 2, 2, 2 * iterations, elapsed);
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    ipv::SharedMemoryManager::GetInstance();
+
+    PingPong(true, 20000);
+    PingPong(false, 200);
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return 0;
+}
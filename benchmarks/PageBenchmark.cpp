@@ -0,0 +1,155 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_PAGES"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <fstream>
+#include <memory>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Reader latency with each segment_options mode:
+//  - a writer process creates the domain and its variables, then exits: the pages exist, but no other process maps them yet
+//  - a reader process attaches the domain, then reads one byte per page of every variable twice: the first pass pays
+//    the page faults (and the TLB misses), the second one is the steady state
+// Reports the attach time, and the time and minor faults per page of each pass. huge_kb is the part of the segment
+// mapped with huge pages in the reader: 0 when the tmpfs of /dev/shm does not allow them (mount option huge=advise).
+
+namespace {
+
+    const char* DOMAIN = "IPV_BENCH_PAGES_DATA";
+    const std::size_t DOMAIN_SIZE = 64 * 1024 * 1024;
+    const std::size_t PAGE = 4096;
+
+    struct Block {
+        char bytes[16 * 1024];
+    };
+
+    struct Mode {
+        const char* name;
+        ipv::segment_options options;
+    };
+
+    long MinorFaults()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_minflt;
+    }
+
+    long HugeKb()
+    {
+        std::ifstream smaps("/proc/self/smaps_rollup");
+        std::string key;
+        long value;
+        while (smaps >> key >> value)
+        {
+            if (key == "ShmemPmdMapped:")
+                return value;
+            smaps.ignore(256, '\n');
+        }
+        return 0;
+    }
+
+    std::string Name(int i)
+    {
+        return "pages.block" + std::to_string(i);
+    }
+
+    int RunWriter(const Mode& mode, int blocks)
+    {
+        ipv::SharedMemoryManager& domain = ipv::SharedMemoryManager::GetDomain(DOMAIN, DOMAIN_SIZE, mode.options);
+        for (int i = 0; i < blocks; ++i)
+        {
+            ipv::variable<Block> block(domain, Name(i).c_str(), 0, true, "Payload");
+            std::memset(static_cast<Block*>(block)->bytes, i & 0xff, sizeof(Block));
+        }
+        return 0;
+    }
+
+    int RunReader(const Mode& mode, int blocks)
+    {
+        ipvbench::Timer attachTimer;
+        ipv::SharedMemoryManager* pDomain;
+        try {
+            pDomain = &ipv::SharedMemoryManager::GetDomain(DOMAIN, DOMAIN_SIZE, mode.options);
+        }
+        catch (std::runtime_error& e) {
+            std::printf("{\"benchmark\":\"segment_pages\",\"variant\":\"%s\",\"skipped\":\"%s\"}\n", mode.name, e.what());
+            return 0;
+        }
+        double attachNs = attachTimer.ElapsedNs();
+
+        std::vector<const char*> addresses;
+        for (int i = 0; i < blocks; ++i)
+        {
+            size_t offset;
+            if (!pDomain->exists(Name(i).c_str(), offset))
+                return 1;
+            addresses.push_back(static_cast<const char*>(pDomain->OffsetToAddress(offset)));
+        }
+
+        const std::size_t pages = blocks * (sizeof(Block) / PAGE);
+        long sum = 0;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            long faults = MinorFaults();
+            ipvbench::Timer timer;
+            for (const char* p : addresses)
+                for (std::size_t b = 0; b < sizeof(Block); b += PAGE)
+                    sum += *static_cast<const volatile char*>(p + b);
+            double ns = timer.ElapsedNs();
+            faults = MinorFaults() - faults;
+            std::printf("{\"benchmark\":\"segment_pages\",\"variant\":\"%s\",\"pass\":\"%s\",\"pages\":%zu,\"ns_per_page\":%.2f,\"faults_per_page\":%.3f,\"attach_us\":%.0f,\"huge_kb\":%ld}\n",
+                mode.name, pass == 0 ? "first_touch" : "steady", pages, ns / pages, static_cast<double>(faults) / pages, attachNs / 1000, HugeKb());
+        }
+        std::fflush(stdout);
+        return sum == 0 ? 1 : 0;  // The blocks are not all 0
+    }
+
+    // Runs f in a new process, which does not inherit any mapping of the domain
+    template<typename F>
+    int InChild(F f)
+    {
+        std::fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(f());
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+    int blocks = quick ? 256 : 1500;
+
+    const Mode modes[] = {
+        { "default", { false, false, false } },
+        { "huge_pages", { true, false, false } },
+        { "prefault", { false, true, false } },
+        { "lock", { false, false, true } },
+        { "huge_pages_prefault_lock", { true, true, true } },
+    };
+
+    int failures = 0;
+    for (const Mode& mode : modes)
+    {
+        bip::shared_memory_object::remove(DOMAIN);
+        failures += InChild([&]() { return RunWriter(mode, blocks); });
+        failures += InChild([&]() { return RunReader(mode, blocks); });
+    }
+    bip::shared_memory_object::remove(DOMAIN);
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_PREFIX"
+#define IPV_SHARED_MEMORY_SIZE 128*1024*1024
+#define IPV_DIRECTORY_CAPACITY 131072
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <memory>
+
+// A monitor watching one subsystem out of 100k variables named svc<n>.worker<n>.<metric><n>:
+//  - list_all_filter: ListAllVariables, then keeps the names with the prefix (the way it was done before)
+//  - for_each_filter: ForEachVariable over the whole directory, keeping the names with the prefix
+//  - prefix_index: ForEachVariableWithPrefix, with an index kept from one poll to the other
+//  - glob_index: ForEachVariableMatching with a wildcard in the middle of the name
+//  - index_update: a poll right after a variable was added, which updates the index
+// The variables per poll are the variables visited by the callback.
+
+namespace {
+
+    template<typename F>
+    void Poll(const char* variant, std::size_t count, std::size_t polls, std::size_t& matched, F poll)
+    {
+        matched = 0;
+        poll(); // Warm up, and builds the index
+        matched = 0;
+        ipvbench::Timer timer;
+        for (std::size_t p = 0; p < polls; ++p)
+            poll();
+        ipvbench::Report("prefix_poll", variant, count, 1, polls, timer.ElapsedNs());
+        std::printf("{\"benchmark\":\"prefix_matches\",\"variant\":\"%s\",\"variables\":%zu,\"per_poll\":%zu}\n", variant, count, matched / polls);
+        std::fflush(stdout);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+    const std::size_t count = quick ? 10000 : 100000;
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(count);
+        std::vector<std::unique_ptr<ipv::variable<long long>>> variables;
+        for (const std::string& name : names)
+            variables.emplace_back(new ipv::variable<long long>(name.c_str(), ipv::TypeToInt<long long>(), false, "watched variable"));
+
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        const boost::string_view prefix("svc3.worker12.");
+        const std::size_t polls = quick ? 20 : 200;
+        std::size_t expected = 0, matched = 0;
+
+        Poll("list_all_filter", count, polls / 10, matched, [&]() {
+            std::vector<boost::tuple<std::string, std::string, int, void*>> variablesInfo;
+            manager.ListAllVariables(variablesInfo);
+            for (const auto& v : variablesInfo)
+                if (boost::string_view(boost::get<0>(v)).starts_with(prefix))
+                    matched++;
+            });
+        expected = matched / (polls / 10);
+
+        Poll("for_each_filter", count, polls, matched, [&]() {
+            manager.ForEachVariable([&](const ipv::IPVarView& v) {
+                if (v.name.starts_with(prefix))
+                    matched++;
+                });
+            });
+
+        ipv::VariablesIndex index;
+        Poll("prefix_index", count, polls * 100, matched, [&]() {
+            manager.ForEachVariableWithPrefix(index, prefix, [&](const ipv::IPVarView&) { matched++; });
+            });
+        if (matched / (polls * 100) != expected)
+            failures++;
+
+        std::size_t globbed = 0;
+        manager.ForEachVariable([&](const ipv::IPVarView& v) {
+            if (ipv::MatchName("svc3.*.counter1*", v.name))
+                globbed++;
+            });
+        Poll("glob_index", count, polls * 10, matched, [&]() {
+            manager.ForEachVariableMatching(index, "svc3.*.counter1*", [&](const ipv::IPVarView&) { matched++; });
+            });
+        if (matched / (polls * 10) != globbed)
+            failures++;
+
+        std::size_t n = 0;
+        const std::size_t updates = quick ? 5 : 20;
+        Poll("index_update", count, updates, matched, [&]() {
+            ipv::variable<long long> added(("svc3.worker12.added" + std::to_string(n++)).c_str(), ipv::TypeToInt<long long>(), false, "added variable");
+            manager.ForEachVariableWithPrefix(index, prefix, [&](const ipv::IPVarView&) { matched++; });
+            });
+        if (matched / updates != expected + 1)
+            failures++;
+
+        // The slots of the removed variables are given to other names: the index must not keep their old names
+        std::size_t removed = 0;
+        for (std::unique_ptr<ipv::variable<long long>>& v : variables)
+        {
+            if (boost::string_view(names[&v - &variables[0]]).starts_with("svc3."))
+            {
+                v.reset();
+                removed++;
+            }
+        }
+        std::vector<std::unique_ptr<ipv::variable<long long>>> renamed;
+        for (std::size_t i = 0; i < 4 * removed; ++i)
+            renamed.emplace_back(new ipv::variable<long long>(("renamed.v" + std::to_string(i)).c_str(), ipv::TypeToInt<long long>(), false, "renamed slot"));
+        std::size_t stale = 0, found = 0;
+        manager.ForEachVariableWithPrefix(index, "svc3.", [&](const ipv::IPVarView& v) {
+            if (!v.name.starts_with("svc3.worker12.added"))
+                stale++;
+            });
+        manager.ForEachVariableWithPrefix(index, "renamed.", [&](const ipv::IPVarView& v) {
+            if (v.name.starts_with("renamed."))
+                found++;
+            });
+        std::printf("{\"benchmark\":\"prefix_reused_slots\",\"removed\":%zu,\"stale\":%zu,\"found\":%zu}\n", removed, stale, found);
+        if (stale != 0 || found != renamed.size())
+            failures++;
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
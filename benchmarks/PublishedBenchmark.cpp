@@ -0,0 +1,143 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_PUBLISHED"
+#define IPV_SHARED_MEMORY_SIZE 64*1024*1024
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_consistent.h"
+#include "../ipvar/ipvar_published.h"
+#include "BenchUtil.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A 32 KB routing table, updated by a writer process every 100 us, looked up by reader processes:
+//  - published: the reader looks up one entry in place, in the current version of a published<RoutingTable>
+//  - consistent: the reader copies the table out of a consistent_variable<RoutingTable>, then looks up the entry
+// Every version holds the same value in all its entries: a reader seeing two different values got a torn table.
+// The writer reports the number of replaced versions waiting for their readers.
+
+struct RoutingTable {
+    long long entries[4096];
+};
+
+namespace {
+
+    const int DURATION_MS = 1000;
+
+    struct Tables {
+        Tables() : routes("routes", 0, false, "Routing table"), routesCopy("routesCopy", 0, false, "Routing table") {}
+        ipv::published<RoutingTable> routes;
+        ipv::consistent_variable<RoutingTable> routesCopy;
+    };
+
+    int RunWriter(bool published)
+    {
+        Tables t;
+        std::size_t writes = 0;
+        std::uint32_t maxRetired = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < DURATION_MS * 1e6)
+        {
+            long long value = static_cast<long long>(++writes);
+            if (published)
+            {
+                t.routes.update([&](RoutingTable& table) {
+                    for (long long& e : table.entries) e = value;
+                    });
+                maxRetired = (std::max)(maxRetired, t.routes.retired());
+            }
+            else
+            {
+                t.routesCopy.update_with([&](RoutingTable& table) {
+                    for (long long& e : table.entries) e = value;
+                    });
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        ipvbench::Report("table_update", published ? "published" : "consistent", 1, 1, writes, timer.ElapsedNs());
+        if (published)
+            std::printf("{\"benchmark\":\"table_retired\",\"variant\":\"published\",\"max_retired\":%u}\n", maxRetired);
+        std::fflush(stdout);
+        return 0;
+    }
+
+    int RunReader(bool published)
+    {
+        Tables t;
+        std::size_t reads = 0, torn = 0;
+        long long sum = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < DURATION_MS * 1e6)
+        {
+            for (int i = 0; i < 256; ++i, ++reads)
+            {
+                std::size_t index = (reads * 2654435761u) % 4096;
+                if (published)
+                {
+                    auto table = t.routes.read();
+                    long long v = table->entries[index];
+                    if (v != table->entries[0] || v != table->entries[4095])
+                        torn++;
+                    sum += v;
+                }
+                else
+                {
+                    RoutingTable table = t.routesCopy.load();
+                    long long v = table.entries[index];
+                    if (v != table.entries[0] || v != table.entries[4095])
+                        torn++;
+                    sum += v;
+                }
+            }
+        }
+        ipvbench::Report("table_lookup", published ? "published" : "consistent", 1, 1, reads, timer.ElapsedNs());
+        if (torn != 0)
+            std::printf("{\"error\":\"torn reads\",\"count\":%zu}\n", torn);
+        std::fflush(stdout);
+        return torn == 0 && sum >= 0 ? 0 : 1;
+    }
+
+    int Run(bool published, int readers)
+    {
+        std::vector<pid_t> children;
+        for (int i = 0; i < 1 + readers; ++i)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+                _exit(i == 0 ? RunWriter(published) : RunReader(published));
+            children.push_back(pid);
+        }
+
+        int failures = 0;
+        for (pid_t pid : children)
+        {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                failures++;
+        }
+        return failures;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    int readers = argc > 1 ? std::atoi(argv[1]) : 2;
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        Tables t; // Keeps the variables while the processes come and go
+        t.routes.update([](RoutingTable& table) { for (long long& e : table.entries) e = 0; });
+        failures += Run(true, readers);
+        failures += Run(false, readers);
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
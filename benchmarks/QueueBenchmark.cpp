@@ -0,0 +1,121 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_QUEUE"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_queue.h"
+#include "BenchUtil.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Queues shared by two processes:
+//  - throughput: a child process pushes messages, the parent pops them, one by one or by batches of 64
+//  - latency: round trip of a message through two queues, the other process being blocked in pop_wait
+
+namespace {
+
+    struct Message {
+        std::uint64_t sequence;
+        std::uint64_t payload[3];
+    };
+
+    typedef ipv::spsc_queue<Message, 4096> SpscQueue;
+    typedef ipv::mpmc_queue<Message, 4096> MpmcQueue;
+
+    const std::size_t batchSize = 64;
+
+    template<typename Queue>
+    void Throughput(const char* variant, Queue& queue, std::size_t batch, std::uint64_t messages)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            Message buffer[batchSize];
+            std::uint64_t sent = 0;
+            while (sent < messages)
+            {
+                std::size_t n = static_cast<std::size_t>((std::min)(static_cast<std::uint64_t>(batch), messages - sent));
+                for (std::size_t i = 0; i < n; ++i)
+                    buffer[i].sequence = sent + i;
+                sent += queue.push_n(buffer, n);
+            }
+            _exit(0);
+        }
+
+        ipvbench::Timer timer;
+        Message buffer[batchSize];
+        std::uint64_t received = 0;
+        bool ordered = true;
+        while (received < messages)
+        {
+            std::size_t n = queue.pop_n(buffer, batch);
+            for (std::size_t i = 0; i < n; ++i)
+                ordered &= buffer[i].sequence == received + i;
+            received += n;
+        }
+        double elapsed = timer.ElapsedNs();
+        waitpid(pid, nullptr, 0);
+        if (!ordered)
+            std::printf("%s: messages received out of order\n", variant);
+
+        ipvbench::Report("queue_throughput", variant, 1, 2, static_cast<std::size_t>(messages), elapsed);
+    }
+
+    template<typename Queue>
+    void RoundTrip(const char* variant, Queue& request, Queue& reply, int iterations)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            Message m;
+            for (int i = 0; i < iterations; ++i)
+            {
+                request.pop_wait(m, std::chrono::seconds(10));
+                reply.push_wait(m, std::chrono::seconds(10));
+            }
+            _exit(0);
+        }
+
+        ipvbench::Timer timer;
+        Message m = {};
+        for (int i = 0; i < iterations; ++i)
+        {
+            m.sequence = i;
+            request.push_wait(m, std::chrono::seconds(10));
+            reply.pop_wait(m, std::chrono::seconds(10));
+        }
+        double elapsed = timer.ElapsedNs();
+        waitpid(pid, nullptr, 0);
+
+        // One operation is one round trip
+        ipvbench::Report("queue_round_trip", variant, 2, 2, iterations, elapsed);
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    {
+        decl_ipv_variable(SpscQueue, spsc);
+        decl_ipv_variable(MpmcQueue, mpmc);
+
+        Throughput("spsc", *spsc, 1, 5000000);
+        Throughput("spsc_batch64", *spsc, batchSize, 5000000);
+        Throughput("mpmc", *mpmc, 1, 5000000);
+        Throughput("mpmc_batch64", *mpmc, batchSize, 5000000);
+
+        decl_ipv_variable(SpscQueue, spscReply);
+        decl_ipv_variable(MpmcQueue, mpmcReply);
+
+        RoundTrip("spsc_pop_wait", *spsc, *spscReply, 20000);
+        RoundTrip("mpmc_pop_wait", *mpmc, *mpmcReply, 20000);
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return 0;
+}
@@ -0,0 +1,91 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_RECORDER"
+#define IPV_SHARED_MEMORY_SIZE 32*1024*1024
+#define IPV_DIRECTORY_CAPACITY 16384
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_recorder.h"
+#include "BenchUtil.h"
+
+#include <cstdio>
+
+// Cost of a history sample with 1000 to 10000 variables, 1 in 10 of them changing between two samples,
+// with the ring in the shared memory only and with a file spill.
+// At 100 Hz, the share of a core used by the recorder is ns_per_op * 100 / 1e9.
+// The last frame read back from the ring is checked against the values of the variables.
+
+namespace {
+
+    typedef ipv::history_buffer<4 * 1024 * 1024, 4096, 512 * 1024> History;
+
+    void Run(std::size_t nbVariables, const char* spillPath)
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(nbVariables, "rec");
+        ipv::variable_group group;
+        std::vector<ipv::group_variable<std::atomic<long long>>> counters;
+        for (const std::string& name : names)
+            counters.push_back(group.declare<std::atomic<long long>>(name.c_str(), ipv::TypeToInt<std::atomic<long long>>(), false, "recorded counter"));
+        group.commit();
+
+        decl_ipv_variable(History, history);
+        ipv::history_recorder recorder((*history).ring(), names);
+        if (spillPath != nullptr)
+            recorder.SpillTo(spillPath, 4 * 1024 * 1024);
+
+        const std::size_t samples = 2000;
+        double sampling = 0;
+        for (std::size_t s = 0; s < samples; ++s)
+        {
+            for (std::size_t i = s % 10; i < nbVariables; i += 10)
+                (*counters[i]) += static_cast<long long>(i % 7) - 3;
+
+            ipvbench::Timer timer;
+            recorder.SampleOnce();
+            sampling += timer.ElapsedNs();
+        }
+        ipvbench::Report("history_sample", spillPath != nullptr ? "shm_and_file" : "shm", nbVariables, 1, samples, sampling);
+
+        // Read back the whole ring
+        std::vector<std::uint64_t> last(nbVariables);
+        ipvbench::Timer timer;
+        std::size_t frames = (*history).ring().Read(0, INT64_MAX, [&](std::int64_t, const std::uint64_t* values) {
+            std::copy(values, values + nbVariables, last.begin());
+            });
+        ipvbench::Report("history_read", "whole_ring", nbVariables, 1, frames, timer.ElapsedNs());
+
+        std::size_t errors = 0;
+        for (std::size_t i = 0; i < nbVariables; ++i)
+            errors += static_cast<long long>(last[i]) != (*counters[i]).load();
+        if (frames == 0 || errors != 0)
+            std::printf("history: %zu frames read, %zu values differ\n", frames, errors);
+
+        if (spillPath != nullptr)
+        {
+            ipv::history_file file(spillPath);
+            std::size_t fileFrames = file.Ring().Read(0, INT64_MAX, [](std::int64_t, const std::uint64_t*) {});
+            if (fileFrames == 0)
+                std::printf("history file: no frame read\n");
+        }
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+
+    for (std::size_t n : { 1000, 5000, 10000 })
+        Run(n, nullptr);
+
+    const char* path = "ipv_bench_history.bin";
+    Run(5000, path);
+    std::remove(path);
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return 0;
+}
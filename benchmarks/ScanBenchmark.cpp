@@ -0,0 +1,138 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_SCAN"
+#define IPV_SHARED_MEMORY_SIZE 128*1024*1024
+#define IPV_DIRECTORY_CAPACITY 131072
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "BenchUtil.h"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+// Cost of a monitor poll over the whole directory: ListAllVariables, ForEachVariable and Snapshot.
+// The number of heap allocations per poll is reported as well.
+// directory_visit reads the small fields of every record (references, size, offset), as a reclamation or usage scan does:
+// it measures the bytes of the directory slots dragged through the cache, reported by directory_layout.
+
+static std::atomic<std::size_t> allocations(0);
+
+// The replacement operators are kept out of line: once one of them is inlined next to a new expression or a delete,
+// GCC pairs malloc/free with the builtin operators and reports a -Wmismatched-new-delete that does not apply here.
+#if defined(__GNUC__)
+#define IPV_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define IPV_BENCH_NOINLINE
+#endif
+
+IPV_BENCH_NOINLINE void* operator new(std::size_t size)
+{
+    allocations++;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+IPV_BENCH_NOINLINE void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+IPV_BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+    void ReportAllocations(const char* variant, std::size_t count, std::size_t polls, std::size_t allocated)
+    {
+        std::printf("{\"benchmark\":\"scan_allocations\",\"variant\":\"%s\",\"variables\":%zu,\"allocations_per_poll\":%.1f}\n", variant, count, double(allocated) / polls);
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    std::printf("{\"benchmark\":\"directory_layout\",\"record_bytes\":%zu,\"slot_bytes\":%zu}\n", sizeof(ipv::IPVarRecord), sizeof(ipv::IPVarDirectorySlot));
+
+    const std::size_t sizes[] = { 10, 1000, 10000, 50000 };
+    for (std::size_t count : sizes)
+    {
+        std::vector<std::string> names = ipvbench::MakeNames(count);
+        std::vector<std::unique_ptr<ipv::variable<long long>>> variables;
+        for (const std::string& name : names)
+            variables.emplace_back(new ipv::variable<long long>(name.c_str(), ipv::TypeToInt<long long>(), false, "scanned variable"));
+
+        ipv::SharedMemoryManager& manager = ipv::SharedMemoryManager::GetInstance();
+        const std::size_t polls = count > 10000 ? 20 : 200;
+
+        {
+            std::vector<boost::tuple<std::string, std::string, int, void*>> variablesInfo;
+            long long sum = 0;
+            std::size_t allocated = allocations;
+            ipvbench::Timer timer;
+            for (std::size_t p = 0; p < polls; ++p)
+            {
+                manager.ListAllVariables(variablesInfo);
+                for (const auto& v : variablesInfo)
+                    sum += *static_cast<long long*>(boost::get<3>(v));
+            }
+            ipvbench::Report("scan", "list_all_variables", count, 1, polls * count, timer.ElapsedNs());
+            ReportAllocations("list_all_variables", count, polls, allocations - allocated);
+            if (sum < 0) std::printf("unexpected sum\n");
+        }
+        {
+            long long sum = 0;
+            std::size_t allocated = allocations;
+            ipvbench::Timer timer;
+            for (std::size_t p = 0; p < polls; ++p)
+            {
+                manager.ForEachVariable([&](const ipv::IPVarView& v) {
+                    sum += *static_cast<long long*>(v.ptr);
+                    });
+            }
+            ipvbench::Report("scan", "for_each_variable", count, 1, polls * count, timer.ElapsedNs());
+            ReportAllocations("for_each_variable", count, polls, allocations - allocated);
+            if (sum < 0) std::printf("unexpected sum\n");
+        }
+        {
+            const ipv::IPVarDirectory* pDirectory = manager.GetDirectory();
+            long long sum = 0;
+            ipvbench::Timer timer;
+            for (std::size_t p = 0; p < polls; ++p)
+            {
+                pDirectory->Visit([&](std::size_t, const ipv::IPVarRecord& record) {
+                    sum += record.nbReferences.load(std::memory_order_relaxed) + record.varSize + static_cast<long long>(record.varOffset & 1);
+                    });
+            }
+            ipvbench::Report("scan", "directory_visit", count, 1, polls * count, timer.ElapsedNs());
+            if (sum == 0) std::printf("unexpected sum\n");
+        }
+        {
+            ipv::VariablesSnapshot snapshot;
+            manager.Snapshot(snapshot);
+            long long sum = 0;
+            std::size_t allocated = allocations;
+            ipvbench::Timer timer;
+            for (std::size_t p = 0; p < polls; ++p)
+            {
+                manager.Snapshot(snapshot);
+                for (const ipv::VariablesSnapshot::Entry& e : snapshot)
+                    sum += *static_cast<const long long*>(snapshot.Value(e));
+            }
+            ipvbench::Report("scan", "snapshot", count, 1, polls * count, timer.ElapsedNs());
+            ReportAllocations("snapshot", count, polls, allocations - allocated);
+            if (sum < 0) std::printf("unexpected sum\n");
+        }
+    }
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return 0;
+}
@@ -0,0 +1,153 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_SLAB"
+#define IPV_SHARED_MEMORY_SIZE (256 * 1024 * 1024)
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_slab.h"
+#include "BenchUtil.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Allocations from several processes at the same time, with allocate_shared_memory and with the slab pools:
+//  - blocks: each process allocates batches of 32 blocks of 48 bytes, then frees them
+//  - map_insert: each process fills and clears its own map of 1000 integers
+// The number of processes grows up to twice the number of cores.
+// Then short lived processes allocate one block each in turn: they must share one chunk, taken over from the process gone.
+
+namespace {
+
+    const std::size_t batchSize = 32;
+    const std::size_t blockSize = 48;
+    const std::size_t mapSize = 1000;
+
+    struct SegmentAllocator {
+        void* allocate(std::size_t size) { return ipv::allocate_shared_memory(size); }
+        void deallocate(void* p, std::size_t) { ipv::deallocate_shared_memory(p); }
+    };
+
+    struct SlabAllocator {
+        void* allocate(std::size_t size) { return ipv::slab_pools::GetInstance().allocate(size); }
+        void deallocate(void* p, std::size_t size) { ipv::slab_pools::GetInstance().deallocate(p, size); }
+    };
+
+    template<typename Allocator>
+    void Blocks(std::size_t rounds)
+    {
+        Allocator allocator;
+        void* blocks[batchSize];
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            for (std::size_t i = 0; i < batchSize; ++i)
+                blocks[i] = allocator.allocate(blockSize);
+            for (std::size_t i = 0; i < batchSize; ++i)
+                allocator.deallocate(blocks[i], blockSize);
+        }
+    }
+
+    void SegmentMapInsert(std::size_t rounds)
+    {
+        typedef ipv::SharedMemoryMap<int, int> Map;
+        _shared_memory_* segment = ipv::get_shared_memory_segment();
+        Map* pMap = segment->construct<Map>(bip::anonymous_instance)(std::less<int>(), segment->get_segment_manager());
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            for (std::size_t i = 0; i < mapSize; ++i)
+                pMap->emplace(static_cast<int>(i), static_cast<int>(r));
+            pMap->clear();
+        }
+        segment->destroy_ptr(pMap);
+    }
+
+    void SlabMapInsert(std::size_t rounds)
+    {
+        typedef ipv::shm_map<int, int> Map;
+        _shared_memory_* segment = ipv::get_shared_memory_segment();
+        Map* pMap = segment->construct<Map>(bip::anonymous_instance)();
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            for (std::size_t i = 0; i < mapSize; ++i)
+                pMap->emplace(static_cast<int>(i), static_cast<int>(r));
+            pMap->clear();
+        }
+        segment->destroy_ptr(pMap);
+    }
+
+    void Run(const char* benchmark, const char* variant, void (*work)(std::size_t), unsigned processes, std::size_t rounds, std::size_t operationsPerRound)
+    {
+        ipvbench::Timer timer;
+        std::vector<pid_t> children;
+        for (unsigned p = 0; p < processes; ++p)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                work(rounds);
+                _exit(0);
+            }
+            children.push_back(pid);
+        }
+        for (pid_t pid : children)
+            waitpid(pid, nullptr, 0);
+        ipvbench::Report(benchmark, variant, 0, processes, rounds * operationsPerRound * processes, timer.ElapsedNs());
+    }
+
+    // Returns the number of chunks reserved for the blocks of 2 KB, by processes which allocate one block and exit
+    std::uint32_t ShortLivedProcesses(unsigned processes)
+    {
+        const std::size_t size = 2000;
+        for (unsigned p = 0; p < processes; ++p)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                ipv::slab_pools::GetInstance().allocate(size); // Kept, as in a container of the segment
+                _exit(0);
+            }
+            waitpid(pid, nullptr, 0);
+        }
+        return ipv::slab_pools::GetInstance().NbChunks(size);
+    }
+}
+
+
+int main()
+{
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        // Maps the segment and the pools before the fork, as a long running service would
+        ipv::slab_pools::GetInstance();
+
+        unsigned hw = std::thread::hardware_concurrency();
+        if (hw == 0)
+            hw = 1;
+        std::vector<unsigned> processCounts;
+        for (unsigned processes = 1; processes < 2 * hw; processes *= 2)
+            processCounts.push_back(processes);
+        processCounts.push_back(2 * hw);
+
+        const std::size_t blockRounds = 20000;
+        const std::size_t mapRounds = 200;
+        for (unsigned processes : processCounts)
+        {
+            Run("alloc_free", "allocate_shared_memory", &Blocks<SegmentAllocator>, processes, blockRounds, 2 * batchSize);
+            Run("alloc_free", "slab", &Blocks<SlabAllocator>, processes, blockRounds, 2 * batchSize);
+            Run("map_insert", "segment_allocator", &SegmentMapInsert, processes, mapRounds, mapSize);
+            Run("map_insert", "shm_map", &SlabMapInsert, processes, mapRounds, mapSize);
+        }
+
+        const unsigned shortLived = 20;
+        std::uint32_t chunks = ShortLivedProcesses(shortLived);
+        std::printf("{\"benchmark\":\"slab_chunks\",\"variant\":\"short_lived_processes\",\"processes\":%u,\"chunks\":%u}\n", shortLived, chunks);
+        if (chunks != 1)
+            failures++;
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#define IPV_SHARED_MEMORY_NAME "IPV_BENCH_TRANSACTION"
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_consistent.h"
+#include "../ipvar/ipvar_transaction.h"
+#include "BenchUtil.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A writer process updates a rate limit and its burst size together (burst = 2 * rate), reader processes check the pair.
+//  - transaction: both variables in a txn_set, written by one commit, read with txn_set::read
+//  - independent: two consistent_variables written and read one after the other
+// The benchmark reports the throughput of the writer and of the readers, and the number of inconsistent pairs seen.
+// It fails if a reader of the transaction set sees an inconsistent pair.
+// dead_writer kills a writer while it commits, then commits another variable of the set: the commit must take the set over,
+// and must not publish the pair left half written.
+
+namespace {
+
+    const int DURATION_MS = 1000;
+
+    struct Limits {
+        Limits() : limits(IPV_NAME("limits")),
+            rateLimit(limits, IPV_NAME("rateLimit"), ipv::TxnTypeToInt<long long>(), false, "Requests per second", 0),
+            burstSize(limits, IPV_NAME("burstSize"), ipv::TxnTypeToInt<long long>(), false, "Burst size", 0),
+            rate("rate", 0, false, "Requests per second", 0), burst("burst", 0, false, "Burst size", 0)
+        {
+        }
+
+        ipv::txn_set limits;
+        ipv::txn_variable<long long> rateLimit;
+        ipv::txn_variable<long long> burstSize;
+
+        ipv::consistent_variable<long long> rate;
+        ipv::consistent_variable<long long> burst;
+    };
+
+    int RunWriter(bool transaction)
+    {
+        Limits l;
+        std::size_t writes = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < DURATION_MS * 1e6)
+        {
+            for (int i = 0; i < 256; ++i, ++writes)
+            {
+                long long value = static_cast<long long>(writes);
+                if (transaction)
+                {
+                    ipv::transaction t(l.limits);
+                    t.set(l.rateLimit, value);
+                    t.set(l.burstSize, 2 * value);
+                    t.commit();
+                }
+                else
+                {
+                    l.rate.store(value);
+                    l.burst.store(2 * value);
+                }
+            }
+        }
+        ipvbench::Report("limits_write", transaction ? "transaction" : "independent", 2, 1, writes, timer.ElapsedNs());
+        return 0;
+    }
+
+    int RunReader(bool transaction)
+    {
+        Limits l;
+        std::size_t reads = 0, inconsistent = 0;
+        ipvbench::Timer timer;
+        while (timer.ElapsedNs() < DURATION_MS * 1e6)
+        {
+            for (int i = 0; i < 256; ++i, ++reads)
+            {
+                long long rate, burst;
+                if (transaction)
+                {
+                    l.limits.read([&](const ipv::txn_reader& r) {
+                        rate = r.get(l.rateLimit);
+                        burst = r.get(l.burstSize);
+                        return 0;
+                        });
+                }
+                else
+                {
+                    rate = l.rate.load();
+                    burst = l.burst.load();
+                }
+                if (burst != 2 * rate)
+                    inconsistent++;
+            }
+        }
+        ipvbench::Report("limits_read", transaction ? "transaction" : "independent", 2, 1, reads, timer.ElapsedNs());
+        std::printf("{\"benchmark\":\"limits_inconsistent\",\"variant\":\"%s\",\"reads\":%zu,\"inconsistent\":%zu}\n", transaction ? "transaction" : "independent", reads, inconsistent);
+        std::fflush(stdout);
+        return transaction && inconsistent != 0 ? 1 : 0;
+    }
+
+    int RunDeadWriter(int rounds)
+    {
+        Limits l;
+        ipv::txn_variable<long long> generation(l.limits, IPV_NAME("generation"), ipv::TxnTypeToInt<long long>(), false, "Commits after a dead writer", 0);
+        std::size_t inconsistent = 0;
+        ipvbench::Timer timer;
+        for (int round = 0; round < rounds; ++round)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                for (long long value = 1;; ++value)
+                {
+                    ipv::transaction t(l.limits);
+                    t.set(l.rateLimit, value);
+                    for (int i = 0; i < 256; ++i)
+                        t.set(generation, value); // Widens the window between the two halves of the pair
+                    t.set(l.burstSize, 2 * value);
+                    t.commit();
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1 + round % 3));
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+
+            ipv::transaction t(l.limits);
+            t.set(generation, round);
+            t.commit();
+            long long rate, burst;
+            l.limits.read([&](const ipv::txn_reader& r) {
+                rate = r.get(l.rateLimit);
+                burst = r.get(l.burstSize);
+                return 0;
+                });
+            if (burst != 2 * rate)
+                inconsistent++;
+        }
+        ipvbench::Report("dead_writer", "transaction", 3, 1, rounds, timer.ElapsedNs());
+        std::printf("{\"benchmark\":\"limits_inconsistent\",\"variant\":\"dead_writer\",\"reads\":%d,\"inconsistent\":%zu}\n", rounds, inconsistent);
+        std::fflush(stdout);
+        return inconsistent == 0 ? 0 : 1;
+    }
+
+    int Run(bool transaction, int readers)
+    {
+        std::vector<pid_t> children;
+        for (int i = 0; i < 1 + readers; ++i)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+                _exit(i == 0 ? RunWriter(transaction) : RunReader(transaction));
+            children.push_back(pid);
+        }
+
+        int failures = 0;
+        for (pid_t pid : children)
+        {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                failures++;
+        }
+        return failures;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    int readers = argc > 1 ? std::atoi(argv[1]) : 2;
+
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    int failures = 0;
+    {
+        Limits l; // Keeps the variables while the processes come and go
+        failures += Run(true, readers);
+        failures += Run(false, readers);
+        failures += RunDeadWriter(100);
+    }
+    bip::shared_memory_object::remove(IPV_SHARED_MEMORY_NAME);
+    return failures == 0 ? 0 : 1;
+}
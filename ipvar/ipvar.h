@@ -21,8 +21,26 @@
 #include <boost/static_string/static_string.hpp>
 #include <boost/interprocess/sync/sharable_lock.hpp>
 #include <boost/interprocess/sync/upgradable_lock.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
 
 #include <boost/tuple/tuple.hpp>
+#include <boost/utility/string_view.hpp>
+#include <boost/interprocess/offset_ptr.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 // By default use windows shared memory on windows platform.
 // If you want to use boost shared memory on windows, add WIN_USE_LINUX_LIKE_SHM to the compiler options
@@ -33,8 +51,15 @@
 
 
 // If windows, and USE_WIN32_SHARED_MEMORY is defined, set _shared_memory_ to bip::managed_windows_shared_memory, otherwise set it to managed_shared_memory
+// If IPV_USE_MAPPED_FILE is defined, the segment is a memory mapped file, on all platforms: the persistent variables survive a reboot.
 
-#ifdef _WIN32
+#ifdef IPV_USE_MAPPED_FILE
+#include <boost/interprocess/managed_mapped_file.hpp>
+#define _shared_memory_ bip::managed_mapped_file
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#elif defined(_WIN32)
 #ifdef USE_WIN32_SHARED_MEMORY
 #include <boost/interprocess/managed_windows_shared_memory.hpp>
 #define _shared_memory_ bip::managed_windows_shared_memory
@@ -51,18 +76,75 @@
 
 #include "stdlib.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <initializer_list>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <ctime>
+#endif
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
 #pragma pack(push, 4)
 
 namespace bip = boost::interprocess;
 
 #ifndef IPV_SHARED_MEMORY_NAME
-#define IPV_SHARED_MEMORY_NAME "KML_IPV_SHARED_MEMORY_V0"
+#define IPV_SHARED_MEMORY_NAME "KML_IPV_SHARED_MEMORY_V1"
 #endif
 
 #ifndef IPV_SHARED_MEMORY_SIZE
 #define IPV_SHARED_MEMORY_SIZE 2*1024*1024  // 2MB By default
 #endif
 
+#ifndef IPV_SHARED_MEMORY_MAX_EXTENSIONS
+#define IPV_SHARED_MEMORY_MAX_EXTENSIONS 15  // Number of extension segments created when the segment is full
+#endif
+
+#ifndef IPV_CACHE_LINE_SIZE
+#define IPV_CACHE_LINE_SIZE 64
+#endif
+
+#ifndef IPV_DIRECTORY_CAPACITY
+#define IPV_DIRECTORY_CAPACITY 2048  // Maximum number of variables in the segment
+#endif
+
+#ifndef IPV_TYPE_TABLE_CAPACITY
+#define IPV_TYPE_TABLE_CAPACITY 256  // Maximum number of type descriptors in the segment
+#endif
+
+#ifndef IPV_LEASE_PROCESSES
+#define IPV_LEASE_PROCESSES 256  // Processes whose references are tracked at the same time, see IPVarLeaseTable
+#endif
+
+// Pages of the segments on Linux, see ipv::segment_options: define IPV_SEGMENT_HUGE_PAGES to ask for transparent huge pages,
+// IPV_SEGMENT_PREFAULT to map all the pages when a process creates or attaches a segment, IPV_SEGMENT_LOCK to lock them in memory.
+
+// Define IPV_DISABLE_INSTRUMENTATION to remove the counters of the library and the __ipv.* variables
+
+#ifndef IPV_MAPPED_FILE_DIRECTORY
+#ifdef _WIN32
+#define IPV_MAPPED_FILE_DIRECTORY ""           // With IPV_USE_MAPPED_FILE, directory of the segment files (current directory)
+#else
+#define IPV_MAPPED_FILE_DIRECTORY "/var/tmp/"  // With IPV_USE_MAPPED_FILE, directory of the segment files (kept across reboots)
+#endif
+#endif
+
 
 
 namespace ipv {
@@ -134,349 +216,2491 @@ namespace ipv {
 
 
 
+    // Blocks while *word == expected, for at most timeout. Returns true if the word changed.
+    // On Linux, this is a futex wait on the shared word, woken by WakeWord from any process.
+    // Other platforms have no interprocess futex: the word is polled.
+    inline bool WaitOnWord(std::atomic<std::uint32_t>* word, std::uint32_t expected, std::chrono::nanoseconds timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (word->load(std::memory_order_acquire) == expected)
+        {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining <= std::chrono::nanoseconds::zero())
+                return false;
+#ifdef __linux__
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(remaining).count());
+            ts.tv_nsec = static_cast<long>((remaining - std::chrono::seconds(ts.tv_sec)).count());
+            syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+            std::this_thread::sleep_for((std::min)(std::chrono::duration_cast<std::chrono::nanoseconds>(remaining), std::chrono::nanoseconds(1000000)));
+#endif
+        }
+        return true;
+    }
+
+    inline void WakeWord(std::atomic<std::uint32_t>* word)
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+        (void)word;
+#endif
+    }
+
+
+
     template<typename KeyType, typename MappedType>
     using SharedMemoryAllocator = bip::allocator<std::pair<const KeyType, MappedType>, _shared_memory_::segment_manager>;
 
     template<typename KeyType, typename MappedType>
     using SharedMemoryMap = bip::map<KeyType, MappedType, std::less<KeyType>, SharedMemoryAllocator<KeyType, MappedType>>;
 
-    typedef boost::static_string<48> variable_name_type;
+    // Type descriptors: the layout of the type of a variable, written in the segment when the variable is created,
+    // so that any process can print the variable without being compiled with its type (see FormatValue).
 
-    struct IPVarRecord {
+    enum class value_kind : std::uint8_t { opaque = 0, signed_integer, unsigned_integer, floating, boolean, text };
 
-        variable_name_type name;
-        boost::static_string<64> description;
-        int type;
+    // A scalar, an array of scalars or a text, at some offset of a variable
+    struct IPVarFieldDescriptor {
+        char name[24];
+        std::uint32_t offset;
+        std::uint16_t count;   // Number of elements, or capacity of a text
+        value_kind kind;
+        std::uint8_t size;     // Size of one element
+    };
 
-        size_t varOffset;
-        int varSize;
+    // Followed in the segment by its nbFields fields. A type without field is opaque.
+    struct IPVarTypeDescriptor {
+        char name[48];
+        std::uint32_t size;
+        std::uint32_t align;
+        std::uint32_t nbFields;
 
-        bool isPersistant;
-        std::atomic<int> nbReferences;
+        const IPVarFieldDescriptor* Fields() const { return reinterpret_cast<const IPVarFieldDescriptor*>(this + 1); }
+    };
 
-        IPVarRecord() : type(0), varOffset(0), varSize(0) {
-            name.clear();
-            description.clear();
-            isPersistant = false;
-            nbReferences = 0;
+
+    struct type_field;
+
+    // Descriptor of a type in the process, built from the describe<T> specializations
+    class type_description {
+    public:
+        type_description(const std::string& typeName, std::size_t size, std::size_t align)
+        {
+            std::memset(&header, 0, sizeof(header));
+            CopyName(header.name, sizeof(header.name), typeName);
+            header.size = static_cast<std::uint32_t>(size);
+            header.align = static_cast<std::uint32_t>(align);
         }
 
-        IPVarRecord(const IPVarRecord& other)
+        // Aggregate, see IPV_DESCRIBE_STRUCT
+        type_description(const std::string& typeName, std::size_t size, std::size_t align, std::initializer_list<type_field> members);
+
+        type_description& Add(const std::string& fieldName, std::size_t offset, value_kind kind, std::size_t elementSize, std::size_t count)
         {
-            *this = other;
+            IPVarFieldDescriptor f;
+            std::memset(&f, 0, sizeof(f));
+            CopyName(f.name, sizeof(f.name), fieldName);
+            f.offset = static_cast<std::uint32_t>(offset);
+            f.count = static_cast<std::uint16_t>(count);
+            f.kind = kind;
+            f.size = static_cast<std::uint8_t>(elementSize);
+            fields.push_back(f);
+            header.nbFields = static_cast<std::uint32_t>(fields.size());
+            return *this;
         }
 
-        IPVarRecord& operator=(const IPVarRecord& other)
+        // Adds the fields of a member: a scalar member is one field, a described struct is flattened as "member.field".
+        type_description& Add(const std::string& fieldName, std::size_t offset, const type_description& memberType)
         {
-            if (this != &other)
+            if (memberType.fields.empty())
+                return Add(fieldName, offset, value_kind::opaque, 1, memberType.header.size);
+            for (const IPVarFieldDescriptor& f : memberType.fields)
             {
-                name = other.name;
-                description = other.description;
-                type = other.type;
-                varOffset = other.varOffset;
-                varSize = other.varSize;
-                isPersistant = other.isPersistant;
-                nbReferences = other.nbReferences.load();
+                std::string name = f.name[0] == 0 ? fieldName : (fieldName.empty() ? std::string(f.name) : fieldName + "." + f.name);
+                Add(name, offset + f.offset, f.kind, f.size, f.count);
             }
             return *this;
         }
 
-    };
-
-
+        const IPVarTypeDescriptor& Header() const { return header; }
+        const std::vector<IPVarFieldDescriptor>& Fields() const { return fields; }
 
-    class SharedMemoryManager {
-    public:
-        typedef variable_name_type IPVarsMapKey;
-        typedef IPVarRecord IPVarsMapValue;
+        // Size of the descriptor in the segment
+        std::size_t Bytes() const { return sizeof(IPVarTypeDescriptor) + fields.size() * sizeof(IPVarFieldDescriptor); }
 
-        static SharedMemoryManager& GetInstance()
+        void CopyTo(void* p) const
         {
-            const char* shared_memory_name = IPV_SHARED_MEMORY_NAME;
-            const std::size_t shared_memory_size = IPV_SHARED_MEMORY_SIZE;
-
-            static SharedMemoryManager instance(shared_memory_name, shared_memory_size);
-            return instance;
+            std::memcpy(p, &header, sizeof(header));
+            if (!fields.empty())
+                std::memcpy(static_cast<char*>(p) + sizeof(header), fields.data(), fields.size() * sizeof(IPVarFieldDescriptor));
         }
-        size_t  AddVariable(const char* name, int type, int varSize, const char* v_description, bool& justCreated, bool isPersistant)
-        {
-            boost::interprocess::scoped_lock<bip::interprocess_upgradable_mutex>  alock(*p_var_creation_mutex);
-            if (!isValid)
-                return 0;
-
-            IPVarRecord record;
-
-            if (exists(name, record.varOffset))
-            {
-                justCreated = false;
-                return record.varOffset;
-            }
 
-            record.name = name;
-            record.type = type;
-            record.varSize = varSize;
-            record.description = v_description;
-            record.isPersistant = isPersistant;
-            record.nbReferences = 1;
+    private:
+        static void CopyName(char* dest, std::size_t size, const std::string& name)
+        {
+            std::size_t n = (std::min)(name.size(), size - 1);
+            std::memcpy(dest, name.data(), n);
+            dest[n] = 0;
+        }
 
+        IPVarTypeDescriptor header;
+        std::vector<IPVarFieldDescriptor> fields;
+    };
 
-            LockForWrite(p_ipv_mutex);
-            if (pIPVarsMap->find(name) != pIPVarsMap->end()) {
-                justCreated = false;
-                return record.varOffset;
-            }
 
-            void* pMemory = segment->allocate(varSize);
+    // A member of an aggregate, see IPV_FIELD
+    struct type_field {
+        std::string name;
+        std::size_t offset;
+        type_description type;
+    };
 
-            record.varOffset = static_cast<char*>(pMemory) - static_cast<char*>(GetSegmentAddress());
+    inline type_description::type_description(const std::string& typeName, std::size_t size, std::size_t align, std::initializer_list<type_field> members)
+        : type_description(typeName, size, align)
+    {
+        for (const type_field& f : members)
+            Add(f.name, f.offset, f.type);
+    }
 
-            pIPVarsMap->insert(std::make_pair(record.name, record));
 
-            // Ensure that all memory operations related to IPVarsMap are completed
-            std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Specialize describe<T> to give the layout of a type T. IPV_DESCRIBE_STRUCT (ipvar_util.h) does it for simple structs.
+    // The types not described are opaque.
+    template<typename T, typename Enable = void>
+    struct describe {
+        static type_description Get() { return type_description("", sizeof(T), alignof(T)); }
+    };
 
+    template<typename T>
+    struct describe<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+        static type_description Get()
+        {
+            value_kind kind = std::is_same<T, bool>::value ? value_kind::boolean
+                : std::is_floating_point<T>::value ? value_kind::floating
+                : std::is_signed<T>::value ? value_kind::signed_integer : value_kind::unsigned_integer;
+            std::string name = kind == value_kind::boolean ? "bool"
+                : std::string(kind == value_kind::floating ? "float" : kind == value_kind::signed_integer ? "int" : "uint") + std::to_string(8 * sizeof(T));
+            return type_description(name, sizeof(T), alignof(T)).Add("", 0, kind, sizeof(T), 1);
+        }
+    };
 
-            justCreated = true;
-            return record.varOffset;
+    // An atomic is described as its value, when it has the same representation
+    template<typename T>
+    struct describe<std::atomic<T>, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+        static type_description Get()
+        {
+            if (sizeof(std::atomic<T>) != sizeof(T))
+                return type_description("", sizeof(std::atomic<T>), alignof(std::atomic<T>));
+            type_description value = describe<T>::Get();
+            return type_description("atomic<" + std::string(value.Header().name) + ">", sizeof(std::atomic<T>), alignof(std::atomic<T>)).Add("", 0, value);
         }
+    };
 
-        void* GetSegmentAddress()
+    template<std::size_t N>
+    struct describe<boost::static_string<N>> {
+        static type_description Get()
         {
-            if (!isValid)
-                return nullptr;
-            return segment->get_address();
+            boost::static_string<N> s;
+            std::size_t offset = static_cast<std::size_t>(reinterpret_cast<const char*>(s.data()) - reinterpret_cast<const char*>(&s));
+            return type_description("string" + std::to_string(N), sizeof(s), alignof(boost::static_string<N>)).Add("", offset, value_kind::text, 1, N);
         }
-        bool exists(const char* name, size_t& result, IPVarRecord*& pRec)
+    };
+
+    template<typename T, std::size_t N>
+    struct describe<T[N], void> {
+        static type_description Get()
         {
-            result = 0;
-            if (!isValid)
-                return false;
+            type_description array("", sizeof(T[N]), alignof(T));
+            if (std::is_same<T, char>::value)
+                return array.Add("", 0, value_kind::text, 1, N);
+            type_description element = describe<T>::Get();
+            if (element.Fields().size() != 1 || element.Fields()[0].count != 1)
+                return array;
+            return array.Add("", 0, element.Fields()[0].kind, sizeof(T), N);
+        }
+    };
 
-            LockForRead(p_ipv_mutex);
+    // Description of a member, for IPV_FIELD
+    template<typename T>
+    type_field describe_field(const char* name, std::size_t offset)
+    {
+        return type_field{ name, offset, describe<T>::Get() };
+    }
 
-            IPVarsMapIterator it = pIPVarsMap->find(name);
-            if (it == pIPVarsMap->end()) return false;
-            result = it->second.varOffset;
-            pRec = &it->second;
-            return true;
-        }
+    // Built once per process
+    template<typename T>
+    const type_description& DescriptionOf()
+    {
+        static const type_description description = describe<T>::Get();
+        return description;
+    }
 
-        bool exists(const char* name, size_t& result)
+
+    namespace format_detail {
+        inline void Append(char* out, std::size_t size, std::size_t& n, const char* format, ...)
         {
-            IPVarRecord* pRec;
-            return exists(name, result, pRec);
+            if (n + 1 >= size)
+                return;
+            va_list args;
+            va_start(args, format);
+            int written = std::vsnprintf(out + n, size - n, format, args);
+            va_end(args);
+            if (written > 0)
+                n = (std::min)(n + static_cast<std::size_t>(written), size - 1);
         }
 
+        inline void AppendText(char* out, std::size_t size, std::size_t& n, const char* text, std::size_t length)
+        {
+            std::size_t copied = (std::min)(length, size - 1 - n);
+            std::memcpy(out + n, text, copied);
+            n += copied;
+            out[n] = 0;
+        }
 
+        inline void AppendUnsigned(char* out, std::size_t size, std::size_t& n, std::uint64_t u, bool negative)
+        {
+            char digits[21];
+            char* p = digits + sizeof(digits);
+            do {
+                *--p = static_cast<char>('0' + u % 10);
+                u /= 10;
+            } while (u != 0);
+            if (negative)
+                *--p = '-';
+            AppendText(out, size, n, p, static_cast<std::size_t>(digits + sizeof(digits) - p));
+        }
 
-
-        _shared_memory_* GetSegment()
+        inline void AppendHex(char* out, std::size_t size, std::size_t& n, const unsigned char* p, std::size_t bytes)
         {
-            return segment;
+            std::size_t shown = (std::min)(bytes, static_cast<std::size_t>(16));
+            for (std::size_t i = 0; i < shown; ++i)
+                Append(out, size, n, i == 0 ? "%02X" : " %02X", p[i]);
+            if (shown < bytes)
+                Append(out, size, n, "...");
         }
 
-        void RemoveVariable(const char* name)
+        inline void AppendElement(char* out, std::size_t size, std::size_t& n, value_kind kind, std::size_t elementSize, const unsigned char* p)
         {
+            switch (kind)
+            {
+            case value_kind::signed_integer:
+            case value_kind::unsigned_integer:
+            case value_kind::boolean:
+            {
+                std::uint64_t u = 0;
+                std::memcpy(&u, p, (std::min)(elementSize, sizeof(u))); // Little endian
+                if (kind == value_kind::signed_integer && elementSize < sizeof(u) && (u >> (8 * elementSize - 1)) != 0)
+                    u |= ~static_cast<std::uint64_t>(0) << (8 * elementSize);
+                bool negative = kind == value_kind::signed_integer && static_cast<std::int64_t>(u) < 0;
+                AppendUnsigned(out, size, n, negative ? 0 - u : u, negative);
+                break;
+            }
+            case value_kind::floating:
+                if (elementSize == sizeof(float))
+                {
+                    float f;
+                    std::memcpy(&f, p, sizeof(f));
+                    Append(out, size, n, "%f", f);
+                }
+                else
+                {
+                    double d;
+                    std::memcpy(&d, p, sizeof(d));
+                    Append(out, size, n, "%f", d);
+                }
+                break;
+            default:
+                AppendHex(out, size, n, p, elementSize);
+                break;
+            }
+        }
+    }
 
-            bool found = false;
-            if (!isValid)
+    // Prints the value of a variable described by d into out, without allocating. Returns the length of the text.
+    // A single unnamed field prints as its value, an aggregate as "field=value field=value", an array as "[v, v]".
+    inline std::size_t FormatValue(const IPVarTypeDescriptor& d, const void* ptr, char* out, std::size_t size)
+    {
+        using namespace format_detail;
+        std::size_t n = 0;
+        if (size == 0)
+            return 0;
+        out[0] = 0;
+        const unsigned char* base = static_cast<const unsigned char*>(ptr);
+        if (d.nbFields == 0)
+        {
+            AppendHex(out, size, n, base, d.size);
+            return n;
+        }
+        for (std::uint32_t i = 0; i < d.nbFields; ++i)
+        {
+            const IPVarFieldDescriptor& f = d.Fields()[i];
+            if (f.name[0] != 0)
             {
-                return;
+                if (i != 0)
+                    AppendText(out, size, n, " ", 1);
+                AppendText(out, size, n, f.name, strnlen(f.name, sizeof(f.name)));
+                AppendText(out, size, n, "=", 1);
             }
+            const unsigned char* p = base + f.offset;
+            if (f.kind == value_kind::text)
             {
-                LockForRead(p_ipv_mutex);
-                auto it = pIPVarsMap->find(name);
-                found = (it != pIPVarsMap->end());
+                const void* end = std::memchr(p, 0, f.count);
+                std::size_t length = end != nullptr ? static_cast<std::size_t>(static_cast<const unsigned char*>(end) - p) : f.count;
+                AppendText(out, size, n, reinterpret_cast<const char*>(p), length);
             }
-            if (!found) return;
-
-            void* pMemory = static_cast<char*>(GetSegmentAddress()) + pIPVarsMap->at(name).varOffset;
+            else if (f.count == 1)
+                AppendElement(out, size, n, f.kind, f.size, p);
+            else
             {
-                LockForWrite(p_ipv_mutex);
-                auto it = pIPVarsMap->find(name);
-                if (it == pIPVarsMap->end()) return;
-                if (it->second.nbReferences > 0) return;
-
-                void* pMemory = static_cast<char*>(GetSegmentAddress()) + it->second.varOffset;
+                AppendText(out, size, n, "[", 1);
+                for (std::uint16_t e = 0; e < f.count; ++e)
+                {
+                    if (e != 0)
+                        AppendText(out, size, n, ", ", 2);
+                    AppendElement(out, size, n, f.kind, f.size, p + e * f.size);
+                }
+                AppendText(out, size, n, "]", 1);
+            }
+        }
+        return n;
+    }
 
 
-                pIPVarsMap->erase(name);
-                segment->deallocate(pMemory);
-            }
+    // Descriptors of the types of the variables, shared by all the variables of the same type.
+    // A descriptor is published in offsets once complete: 0 means not published yet.
+    // The offsets come first, on 8 bytes boundaries despite the packing: an atomic across two cache lines is a bus lock.
+    struct IPVarTypeTable {
+        std::atomic<std::uint64_t> offsets[IPV_TYPE_TABLE_CAPACITY];
+        std::atomic<std::uint32_t> count;
 
+        IPVarTypeTable() : count(0) {
+            for (std::atomic<std::uint64_t>& o : offsets) o = 0;
         }
+    };
 
 
-        void ListAllVariables(std::vector<boost::tuple<std::string, std::string, int, void*>>& variablesInfo) {
-
-            variablesInfo.clear();
+    typedef boost::static_string<48> variable_name_type;
 
-            if (!isValid)
-                return;
+    typedef boost::static_string<64> variable_description_type;
 
-            LockForRead(p_ipv_mutex);
+    // The fields of a variable read by the lookups and the directory scans. The description, only read by the monitors,
+    // is kept apart in the directory (see IPVarDirectory::Description), so that a scan does not drag it through the cache.
+    struct IPVarRecord {
 
-            for (const auto& pair : *pIPVarsMap) {
-                const IPVarRecord& record = pair.second;
-                void* ptr = static_cast<char*>(GetSegmentAddress()) + record.varOffset;
-                variablesInfo.push_back(boost::make_tuple(record.name.c_str(), record.description.c_str(), record.type, ptr));
-            }
-        }
+        variable_name_type name;
+        int type;
 
+        size_t varOffset;
+        int varSize;
 
-    private:
-        SharedMemoryManager(const char* name, std::size_t size)
-            : pIPVarsMap(nullptr), p_ipv_mutex(nullptr), segment(nullptr), isOwner(false), isValid(false),
-            p_var_creation_mutex(nullptr)
-        {
-            isOwner = false;
-            isValid = false;
+        // Offset of the IPVarBlockHeader when the variable storage belongs to a group block, 0 otherwise
+        size_t blockOffset;
 
-            try {
-                segment = new _shared_memory_(bip::create_only, name, size);
-                isOwner = true;
-                isValid = true;
-            }
-            catch (bip::interprocess_exception&) {
-                isOwner = false;
-            }
-            if (!isOwner) {
-                try {
-                    segment = new _shared_memory_(bip::open_only, name);
-                    isValid = true;
-                }
-                catch (bip::interprocess_exception&) {
+        bool isPersistant;
+        std::atomic<int> nbReferences;
 
-                    isValid = false;
-                }
-            }
-            if (!isValid)
-            {
-                throw std::exception("SharedMemoryManager insance construction failed.");
-                return;
-            }
-            if (isValid)
-            {
-                if (isOwner)
-                {
+        // Incremented by variable::notify(), waited on by variable::wait_for_change()
+        std::atomic<std::uint32_t> version;
+        std::atomic<std::uint32_t> nbWaiters;
 
-                    pIPVarsMap = segment->construct<SharedMemoryMap<IPVarsMapKey, IPVarsMapValue>>("SizeMap")(segment->get_segment_manager()); // Changed segment to a pointer
-                    p_ipv_mutex = segment->construct<bip::interprocess_upgradable_mutex>("Mutex")();
-                    p_var_creation_mutex = segment->construct<bip::interprocess_upgradable_mutex>("VCMutex")();
-                }
-                else
-                {
+        // Index of the type descriptor in the type table of the segment, -1 if the type is not described
+        std::int32_t descriptor;
 
-                    pIPVarsMap = segment->find<SharedMemoryMap<IPVarsMapKey, IPVarsMapValue>>("SizeMap").first;
-                    p_ipv_mutex = segment->find<bip::interprocess_upgradable_mutex>("Mutex").first;
-                    p_var_creation_mutex = segment->find<bip::interprocess_upgradable_mutex>("VCMutex").first;
-                }
-            }
-            isValid = (isValid && (pIPVarsMap != nullptr) && (p_ipv_mutex != nullptr));
+        IPVarRecord() : type(0), varOffset(0), varSize(0), blockOffset(0), descriptor(-1) {
+            name.clear();
+            isPersistant = false;
+            nbReferences = 0;
+            version = 0;
+            nbWaiters = 0;
         }
-    public:
-        void* allocate(std::size_t size) {
-            if (!isValid)
-            {
-                throw std::exception("Shared memory not valid");
-                return nullptr;
-            }
-            LockForWrite(p_ipv_mutex);
-            void* ptr = segment->allocate(size); // Changed segment to a pointer
-            return ptr;
+
+        IPVarRecord(const IPVarRecord& other)
+        {
+            *this = other;
         }
 
-        void deallocate(void* ptr) {
-            if (!isValid)
+        IPVarRecord& operator=(const IPVarRecord& other)
+        {
+            if (this != &other)
             {
-                throw std::exception("Shared memory not valid");
-                return;
+                name = other.name;
+                type = other.type;
+                varOffset = other.varOffset;
+                varSize = other.varSize;
+                blockOffset = other.blockOffset;
+                isPersistant = other.isPersistant;
+                nbReferences = other.nbReferences.load();
+                version = other.version.load();
+                nbWaiters = other.nbWaiters.load();
+                descriptor = other.descriptor;
             }
-            LockForWrite(p_ipv_mutex);
-            segment->deallocate(ptr); // Changed segment to a pointer
+            return *this;
         }
 
-
-    private:
-        bip::interprocess_upgradable_mutex* p_var_creation_mutex;
-        bip::interprocess_upgradable_mutex* p_ipv_mutex; // Added interprocess_upgradable_mutex for thread safety
+    };
 
 
-        _shared_memory_* segment; // Changed segment to a pointer
-        SharedMemoryMap<IPVarsMapKey, IPVarsMapValue>* pIPVarsMap;
-        typedef SharedMemoryMap<IPVarsMapKey, IPVarsMapValue>::iterator  IPVarsMapIterator;
-        bool isOwner;
-        bool isValid;
+    // Header of a storage block shared by the variables of a group.
+    // The block is released when its last variable is removed.
+    struct IPVarBlockHeader {
+        std::atomic<int> nbVariables;
 
+        explicit IPVarBlockHeader(int n) : nbVariables(n) {}
     };
 
 
-    void* allocate_shared_memory(std::size_t size)
+    // FNV-1a hash of a variable name. It is the primary key of the directory.
+    constexpr std::uint64_t HashName(const char* name)
     {
-        return SharedMemoryManager::GetInstance().allocate(size);
+        std::uint64_t h = 14695981039346656037ULL;
+        while (*name)
+        {
+            h ^= static_cast<unsigned char>(*name++);
+            h *= 1099511628211ULL;
+        }
+        return h;
     }
 
-    void deallocate_shared_memory(void* ptr)
+    constexpr std::size_t NameLength(const char* name)
+    {
+        std::size_t n = 0;
+        while (name[n])
+            ++n;
+        return n;
+    }
+
+    // A variable name with its length and hash, the keys of the directory.
+    // The decl_ipv macros build it at compile time with IPV_NAME. A const char* is converted, and hashed, at run time.
+    class hashed_name {
+    public:
+        constexpr hashed_name(const char* v_name) : name(v_name), length(NameLength(v_name)), hash(HashName(v_name)) {}
+        constexpr hashed_name(const char* v_name, std::size_t v_length, std::uint64_t v_hash) : name(v_name), length(v_length), hash(v_hash) {}
+
+        const char* c_str() const { return name; }
+        std::size_t size() const { return length; }
+        std::uint64_t Hash() const { return hash; }
+
+        // Compares the bytes: only called when the hashes are equal
+        bool Matches(const variable_name_type& other) const
+        {
+            return other.size() == length && std::memcmp(other.data(), name, length) == 0;
+        }
+
+    private:
+        const char* name;
+        std::size_t length;
+        std::uint64_t hash;
+    };
+
+
+    // One variable of a group registration. The outputs are filled by SharedMemoryManager::AddVariables.
+    struct IPVarDeclaration {
+        const char* name;
+        std::size_t nameLength;
+        std::uint64_t hash;  // Of the name, computed at compile time by IPV_NAME
+        const char* description;
+        int type;
+        int varSize;
+        int varAlign;
+        bool isPersistant;
+        const type_description* descriptor;
+        bool isExtensible;  // false for the types holding offset_ptr, allocated in the initial segment
+
+        size_t varOffset;
+        IPVarRecord* pRec;
+        bool justCreated;
+
+        hashed_name Name() const { return hashed_name(name, nameLength, hash); }
+    };
+
+
+    // One entry of the directory. Its control word, kept in a separate array of the directory, holds the slot state
+    // in its 2 low bits, and a generation number in the others.
+    // The generation changes each time the slot is written, so that readers can detect a concurrent update.
+    struct IPVarDirectorySlot {
+        std::uint64_t hash;
+        IPVarRecord record;
+
+        IPVarDirectorySlot() : hash(0) {}
+    };
+
+
+    // Open addressed, fixed capacity hash table of the variables, living in the shared memory segment.
+    // Lookups never lock: they validate the slot generation before and after reading a record.
+    // Inserts claim an empty slot with a CAS. A removed slot is only reused by a variable with the same name,
+    // so that two processes inserting the same name always meet on the same slot.
+    // The slots are split in three arrays: the control words, read by every probe and scan, the records, and the descriptions.
+    class IPVarDirectory {
+    public:
+        static const std::size_t npos = static_cast<std::size_t>(-1);
+
+        enum SlotState : std::uint32_t { SlotEmpty = 0, SlotBusy = 1, SlotReady = 2, SlotRemoved = 3 };
+
+        IPVarDirectory(_shared_memory_* segment, std::size_t v_capacity) : capacity(v_capacity), count(0), generation(0), maxProbe(0)
+        {
+            std::atomic<std::uint32_t>* pControls = static_cast<std::atomic<std::uint32_t>*>(segment->allocate(sizeof(std::atomic<std::uint32_t>) * capacity));
+            for (std::size_t i = 0; i < capacity; ++i)
+                new (&pControls[i]) std::atomic<std::uint32_t>(0);
+            controls = pControls;
+
+            IPVarDirectorySlot* pSlots = static_cast<IPVarDirectorySlot*>(segment->allocate(sizeof(IPVarDirectorySlot) * capacity));
+            for (std::size_t i = 0; i < capacity; ++i)
+                new (&pSlots[i]) IPVarDirectorySlot();
+            slots = pSlots;
+
+            variable_description_type* pDescriptions = static_cast<variable_description_type*>(segment->allocate(sizeof(variable_description_type) * capacity));
+            for (std::size_t i = 0; i < capacity; ++i)
+                new (&pDescriptions[i]) variable_description_type();
+            descriptions = pDescriptions;
+        }
+
+        // Returns the index of the slot holding name, or npos.
+        // The hashes are compared first, the names only when the hashes are equal.
+        std::size_t Find(const hashed_name& name) const
+        {
+            const std::uint64_t hash = name.Hash();
+            const std::size_t length = ProbeLength();
+            std::size_t i = hash % capacity;
+            for (std::size_t n = 0; n < length; ++n, i = (i + 1) % capacity)
+            {
+                const IPVarDirectorySlot& slot = slots[i];
+                const std::atomic<std::uint32_t>& control = controls[i];
+                for (;;)
+                {
+                    std::uint32_t c = control.load(std::memory_order_acquire);
+                    if (State(c) == SlotEmpty)
+                        return npos;
+                    if (State(c) != SlotReady || slot.hash != hash)
+                        break;
+                    bool match = name.Matches(slot.record.name);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (control.load(std::memory_order_relaxed) != c)
+                        continue; // The slot changed while reading it
+                    if (match)
+                        return i;
+                    break;
+                }
+            }
+            return npos;
+        }
+
+        // Returns the index of the slot holding name, creating it if needed.
+        // fill(record) is called on a slot that has just been claimed, before it is published.
+        // If fill returns false, the slot is released and npos is returned.
+        // npos is also returned when the directory is full.
+        // Once the name is known to be absent, the removed slot of the same variable is revived, else the first
+        // removed slot of the probe path is reused, so that the removals give their slots back to any name.
+        template<typename F>
+        std::size_t Insert(const hashed_name& name, F&& fill, bool& justCreated)
+        {
+            const std::uint64_t hash = name.Hash();
+            const std::size_t home = hash % capacity;
+            justCreated = false;
+            for (;;)
+            {
+                // The name is absent once an empty slot, or the end of the longest probe path, is reached
+                const std::size_t length = ProbeLength();
+                std::size_t target = npos;
+                std::uint32_t targetControl = 0;
+                bool revived = false;
+                for (std::size_t n = 0; n < capacity; ++n)
+                {
+                    if (n >= length && target != npos)
+                        break;
+                    std::size_t i = (home + n) % capacity;
+                    std::uint32_t c = controls[i].load(std::memory_order_acquire);
+                    while (State(c) == SlotBusy)
+                    {
+                        // Another process is writing this slot, it may be our variable
+                        std::this_thread::yield();
+                        c = controls[i].load(std::memory_order_acquire);
+                    }
+                    if (State(c) == SlotReady)
+                    {
+                        if (slots[i].hash == hash && name.Matches(slots[i].record.name))
+                            return i;
+                        continue;
+                    }
+                    if (State(c) == SlotRemoved)
+                    {
+                        if (!revived && n < length && slots[i].hash == hash && name.Matches(slots[i].record.name))
+                        {
+                            target = i;
+                            targetControl = c;
+                            revived = true;
+                        }
+                        else if (target == npos)
+                        {
+                            target = i;
+                            targetControl = c;
+                        }
+                        continue;
+                    }
+                    if (target == npos)
+                    {
+                        target = i;
+                        targetControl = c;
+                    }
+                    break;
+                }
+                if (target == npos)
+                    return npos;
+
+                // Lookups go as far as the new slot before it is published
+                const std::size_t distance = (target + capacity - home) % capacity;
+                std::size_t longest = maxProbe.load();
+                while (longest < distance && !maxProbe.compare_exchange_weak(longest, distance))
+                    ;
+
+                IPVarDirectorySlot& slot = slots[target];
+                std::atomic<std::uint32_t>& control = controls[target];
+                std::uint32_t claimed = Next(targetControl, SlotBusy);
+                if (!control.compare_exchange_strong(targetControl, claimed, std::memory_order_acquire))
+                    continue;
+
+                // A revived slot keeps the same name bytes. A reused one changes under the visitors still holding it, see Visit.
+                IPVarRecord fresh;
+                fresh.name.assign(name.c_str(), name.size());
+                slot.hash = hash;
+                slot.record = fresh;
+
+                // Another process may have claimed another slot of the probe path for the same name
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!ClaimHolds(name, distance))
+                {
+                    control.store(Next(claimed, SlotRemoved), std::memory_order_release);
+                    continue;
+                }
+
+                if (!fill(slot.record))
+                {
+                    control.store(Next(claimed, SlotRemoved), std::memory_order_release);
+                    generation++;
+                    return npos;
+                }
+                control.store(Next(claimed, SlotReady), std::memory_order_release);
+                count++;
+                generation++;
+                justCreated = true;
+                return target;
+            }
+        }
+
+        // Marks the slot as removed. Returns false if it was not holding a variable.
+        bool Remove(std::size_t index)
+        {
+            std::atomic<std::uint32_t>& control = controls[index];
+            std::uint32_t c = control.load(std::memory_order_acquire);
+            while (State(c) == SlotReady)
+            {
+                if (control.compare_exchange_weak(c, Next(c, SlotRemoved), std::memory_order_acq_rel))
+                {
+                    count--;
+                    generation++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Calls f(index, record) for each published variable.
+        // The record is a consistent copy, taken without locking.
+        template<typename F>
+        void ForEach(F&& f) const
+        {
+            for (std::size_t i = 0; i < capacity; ++i)
+            {
+                const IPVarDirectorySlot& slot = slots[i];
+                const std::atomic<std::uint32_t>& control = controls[i];
+                IPVarRecord record;
+                for (;;)
+                {
+                    std::uint32_t c = control.load(std::memory_order_acquire);
+                    if (State(c) != SlotReady)
+                        break;
+                    record = slot.record;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (control.load(std::memory_order_relaxed) != c)
+                        continue;
+                    f(i, record);
+                    break;
+                }
+            }
+        }
+
+        // Calls f(index, record) for each published variable, on the record stored in the segment.
+        // Nothing is copied: the record may be removed, and its slot reused by another variable, while f runs.
+        template<typename F>
+        void Visit(F&& f) const
+        {
+            for (std::size_t i = 0; i < capacity; ++i)
+            {
+                const IPVarDirectorySlot& slot = slots[i];
+                const std::atomic<std::uint32_t>& control = controls[i];
+                if (State(control.load(std::memory_order_acquire)) == SlotReady)
+                    f(i, slot.record);
+            }
+        }
+
+        // Called when no other process uses the directory (after a reboot):
+        // drops the slots that were being written, and the references and waiters of the published variables.
+        void Recover()
+        {
+            for (std::size_t i = 0; i < capacity; ++i)
+            {
+                IPVarDirectorySlot& slot = slots[i];
+                std::atomic<std::uint32_t>& control = controls[i];
+                std::uint32_t c = control.load();
+                if (State(c) == SlotBusy)
+                    control.store(Next(c, SlotRemoved));
+                else if (State(c) == SlotReady)
+                {
+                    slot.record.nbReferences = 0;
+                    slot.record.nbWaiters = 0;
+                }
+            }
+            generation++;
+        }
+
+        IPVarRecord& Record(std::size_t index) { return slots[index].record; }
+        std::uint64_t Hash(std::size_t index) const { return slots[index].hash; }
+
+        // Description of the variable of the slot index, written with the record before it is published
+        variable_description_type& Description(std::size_t index) { return descriptions[index]; }
+        const variable_description_type& Description(std::size_t index) const { return descriptions[index]; }
+
+        // True while the slot holds a published variable
+        bool IsReady(std::size_t index) const { return State(controls[index].load(std::memory_order_acquire)) == SlotReady; }
+
+        // Index of the slot holding record, a record of this directory
+        std::size_t IndexOf(const IPVarRecord& record) const
+        {
+            return static_cast<std::size_t>(reinterpret_cast<const char*>(&record) - reinterpret_cast<const char*>(&slots[0].record)) / sizeof(IPVarDirectorySlot);
+        }
+        const IPVarRecord& Record(std::size_t index) const { return slots[index].record; }
+
+        std::size_t Capacity() const { return capacity; }
+        std::size_t Count() const { return count.load(); }
+
+        // Incremented on each insertion or removal
+        std::uint64_t Generation() const { return generation.load(); }
+
+    private:
+        static std::uint32_t State(std::uint32_t c) { return c & 3; }
+
+        // Number of slots a lookup probes: one more than the longest distance between a variable and its home slot
+        std::size_t ProbeLength() const
+        {
+            return (std::min)(capacity, maxProbe.load() + 1);
+        }
+
+        // Called once the slot at distance of the home of name is claimed and its hash written. False when the claim
+        // must be given up: name is published in another slot of its probe path, or claimed closer to its home by another
+        // process. A claim further from home is waited for, since its process sees this one and gives it up.
+        bool ClaimHolds(const hashed_name& name, std::size_t distance) const
+        {
+            const std::uint64_t hash = name.Hash();
+            const std::size_t home = hash % capacity;
+            const std::size_t length = (std::max)(ProbeLength(), distance + 1);
+            for (std::size_t n = 0; n < length; ++n)
+            {
+                if (n == distance)
+                    continue;
+                std::size_t i = (home + n) % capacity;
+                std::uint32_t state = State(controls[i].load(std::memory_order_acquire));
+                while (state == SlotBusy && slots[i].hash == hash)
+                {
+                    if (n < distance)
+                        return false;
+                    std::this_thread::yield();
+                    state = State(controls[i].load(std::memory_order_acquire));
+                }
+                if (state == SlotEmpty)
+                    return true;
+                if (state == SlotReady && slots[i].hash == hash && name.Matches(slots[i].record.name))
+                    return false;
+            }
+            return true;
+        }
+
+        static std::uint32_t Next(std::uint32_t c, std::uint32_t state) { return ((c + 4) & ~3u) | state; }
+
+        bip::offset_ptr<std::atomic<std::uint32_t>> controls;     // One per slot: a scan reads 16 slot states per cache line
+        bip::offset_ptr<IPVarDirectorySlot> slots;
+        bip::offset_ptr<variable_description_type> descriptions;  // One per slot
+        std::size_t capacity;
+        std::atomic<std::size_t> count;
+        std::atomic<std::uint64_t> generation;
+        std::atomic<std::size_t> maxProbe;    // Longest distance between a variable and its home slot. It only grows.
+    };
+
+
+    // Placement of a variable in the segment.
+    // standard: aligned on alignof(T), the variable may share its cache line with other variables.
+    // hot: the variable is alone on its cache line(s), so that frequent writes do not slow down the readers of its neighbours.
+    enum class placement { standard, hot };
+
+    // Specialize is_hot_variable to give a hot placement to all the variables of a type
+    template<typename T>
+    struct is_hot_variable : std::false_type {};
+
+    template<typename T>
+    constexpr placement default_placement() { return is_hot_variable<T>::value ? placement::hot : placement::standard; }
+
+    // Specialize uses_offset_ptr for the types holding offset_ptr, like the containers of ipvar_slab.h.
+    // Their variables are allocated in the initial segment, mapped whole by every process: an extension is mapped
+    // at a different address in each process, where an offset_ptr to or from it would be wrong.
+    template<typename T>
+    struct uses_offset_ptr : std::false_type {};
+
+
+    // Identity of the current boot of the machine, 0 when unknown.
+    // A segment kept in a file across a reboot holds the locks and references of processes that no longer exist.
+    inline std::uint64_t BootId()
+    {
+#ifdef __linux__
+        char id[64] = { 0 };
+        if (FILE* f = fopen("/proc/sys/kernel/random/boot_id", "r"))
+        {
+            if (fgets(id, sizeof(id), f) == nullptr)
+                id[0] = 0;
+            fclose(f);
+        }
+        return id[0] != 0 ? HashName(id) : 0;
+#elif defined(_WIN32)
+        // Number of boots of the machine, kept by Windows in the registry: it does not move with the clock
+        DWORD id = 0;
+        DWORD size = sizeof(id);
+        if (RegGetValueA(HKEY_LOCAL_MACHINE, "SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Memory Management\\PrefetchParameters",
+            "BootId", RRF_RT_REG_DWORD, nullptr, &id, &size) != ERROR_SUCCESS)
+            return 0;
+        return id;
+#else
+        return 0;
+#endif
+    }
+
+    // Boot of the machine on which the segment was last used, see BootId.
+    struct IPVarSession {
+        static const std::uint64_t recovering = ~static_cast<std::uint64_t>(0);
+
+        std::atomic<std::uint64_t> bootId;
+
+        IPVarSession() : bootId(BootId()) {}
+    };
+
+    inline std::uint32_t CurrentProcessId()
+    {
+#ifdef _WIN32
+        return static_cast<std::uint32_t>(GetCurrentProcessId());
+#else
+        return static_cast<std::uint32_t>(getpid());
+#endif
+    }
+
+    // False only when the process is known to be gone. A process of another user is alive.
+    inline bool IsProcessAlive(std::uint32_t pid)
+    {
+#ifdef _WIN32
+        HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+        if (process == nullptr)
+            return GetLastError() != ERROR_INVALID_PARAMETER;
+        DWORD exitCode = 0;
+        bool alive = GetExitCodeProcess(process, &exitCode) && exitCode == STILL_ACTIVE;
+        CloseHandle(process);
+        return alive;
+#else
+        return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+#endif
+    }
+
+
+    // Extension segments chained to the initial one, stored in the initial segment.
+    // Extension i is named "<segment name>_ext<i>". nbExtensions only grows: processes compare it with the
+    // extensions they have mapped, and map the new ones on demand.
+    struct IPVarSegmentChain {
+        std::atomic<std::uint32_t> nbExtensions;
+        std::size_t extensionSizes[IPV_SHARED_MEMORY_MAX_EXTENSIONS];
+
+        IPVarSegmentChain() : nbExtensions(0) {
+            for (std::size_t& s : extensionSizes) s = 0;
+        }
+    };
+
+
+    // References held by the processes, so that those of a process which died without releasing them can be reclaimed.
+    // A process takes an entry with its first reference. Its counts, one per directory slot, are allocated in the segment
+    // at that time, and are kept with the entry when it is freed. A process which only reads the variables takes none:
+    // attaching to the segment does not keep a reference.
+    struct IPVarLease {
+        static const std::uint32_t free = 0;
+        static const std::uint32_t sweeping = ~static_cast<std::uint32_t>(0);
+
+        std::atomic<std::uint32_t> pid;
+        size_t countsOffset; // Offset of the counts, 0 until the entry is first used
+
+        IPVarLease() : pid(free), countsOffset(0) {}
+    };
+
+    struct IPVarLeaseTable {
+        IPVarLease leases[IPV_LEASE_PROCESSES];
+    };
+
+
+    // Lightweight view of a variable, given by SharedMemoryManager::ForEachVariable.
+    // name and description point into the shared memory segment.
+    struct IPVarView {
+        boost::string_view name;
+        boost::string_view description;
+        int type;
+        int size;
+        bool isPersistant;
+        void* ptr;
+        const IPVarTypeDescriptor* descriptor; // nullptr if the type is not described
+    };
+
+
+    // Matches a variable name against a pattern where '*' stands for any characters but '.', "**" for any characters,
+    // and '?' for one character other than '.'. "svc.*.http.latency" matches "svc.worker12.http.latency".
+    inline bool MatchName(boost::string_view pattern, boost::string_view name)
+    {
+        while (!pattern.empty())
+        {
+            char c = pattern.front();
+            if (c == '*')
+            {
+                bool anyComponent = pattern.size() > 1 && pattern[1] == '*';
+                pattern.remove_prefix(anyComponent ? 2 : 1);
+                for (std::size_t i = 0;; ++i)
+                {
+                    if (MatchName(pattern, name.substr(i)))
+                        return true;
+                    if (i == name.size() || (!anyComponent && name[i] == '.'))
+                        return false;
+                }
+            }
+            if (name.empty() || (c == '?' ? name.front() == '.' : name.front() != c))
+                return false;
+            pattern.remove_prefix(1);
+            name.remove_prefix(1);
+        }
+        return name.empty();
+    }
+
+
+    // Variables sorted by name, see SharedMemoryManager::ForEachVariableWithPrefix.
+    // The index is updated when the directory generation changes. The names are copied: the slot of a removed
+    // variable can be given to another name, which the hash of the entry tells apart.
+    class VariablesIndex {
+    public:
+        struct Entry {
+            variable_name_type name;
+            std::uint64_t hash;
+            std::uint32_t slot;
+
+            boost::string_view Name() const { return boost::string_view(name.data(), name.size()); }
+        };
+
+        VariablesIndex() : generation(0), isValid(false) {}
+
+        // Directory generation at the time the index was built
+        std::uint64_t Generation() const { return generation; }
+
+        std::size_t Size() const { return entries.size(); }
+
+    private:
+        friend class SharedMemoryManager;
+
+        std::vector<Entry> entries;
+        std::vector<Entry> added;
+        std::vector<std::uint8_t> marks;    // Per directory slot, see SharedMemoryManager::UpdateIndex
+        std::vector<std::uint64_t> hashes;  // Per directory slot, hash of the name of its entry
+        std::uint64_t generation;
+        bool isValid;
+    };
+
+
+    // Copy of the values of all the variables, see SharedMemoryManager::Snapshot.
+    class VariablesSnapshot {
+    public:
+        struct Entry {
+            const IPVarRecord* pRec;
+            variable_name_type name;  // Copied: the slot can be given to another variable after the snapshot
+            int type;
+            int size;
+            std::size_t dataOffset;
+        };
+
+        VariablesSnapshot() : generation(0), isValid(false) {}
+
+        // Directory generation at the time of the snapshot
+        std::uint64_t Generation() const { return generation; }
+
+        std::size_t Size() const { return entries.size(); }
+
+        const Entry& operator[](std::size_t i) const { return entries[i]; }
+
+        boost::string_view Name(const Entry& e) const { return boost::string_view(e.name.data(), e.name.size()); }
+
+        const void* Value(const Entry& e) const { return &data[e.dataOffset]; }
+
+        std::vector<Entry>::const_iterator begin() const { return entries.begin(); }
+        std::vector<Entry>::const_iterator end() const { return entries.end(); }
+
+    private:
+        friend class SharedMemoryManager;
+
+        std::vector<Entry> entries;
+        std::vector<char> data;
+        std::uint64_t generation;
+        bool isValid;
+    };
+
+
+    // Counters of the library, kept by each process in relaxed atomics.
+    // SharedMemoryManager::PublishInstrumentation adds them to the __ipv.* persistent variables of the segment,
+    // so that the monitors show the total of all the processes.
+    class IPVarInstrumentation {
+    public:
+        enum counter {
+            lookups, lookup_misses, variables_created, lock_acquisitions, lock_contentions, lock_wait_ns,
+            allocations, allocation_failures, nb_counters
+        };
+
+        // The counters, then the free bytes of the segments, sampled on each publication
+        static const char* VariableName(int i)
+        {
+            static const char* names[nb_counters + 1] = {
+                "__ipv.lookups", "__ipv.lookup_misses", "__ipv.variables_created", "__ipv.lock_acquisitions", "__ipv.lock_contentions",
+                "__ipv.lock_wait_ns", "__ipv.allocations", "__ipv.allocation_failures", "__ipv.free_bytes" };
+            return names[i];
+        }
+
+        // The processes keep no reference on these variables, so they must not be removed while attached
+        static bool IsSystemVariable(const hashed_name& name)
+        {
+            return name.size() > 6 && std::memcmp(name.c_str(), "__ipv.", 6) == 0;
+        }
+
+#ifndef IPV_DISABLE_INSTRUMENTATION
+        static const int nbVariables = nb_counters + 1;
+
+        IPVarInstrumentation()
+        {
+            for (std::atomic<std::uint64_t>& c : counters)
+                c.store(0, std::memory_order_relaxed);
+        }
+
+        // Returns the new value of the counter
+        std::uint64_t Add(counter c, std::uint64_t n = 1)
+        {
+            return counters[c].fetch_add(n, std::memory_order_relaxed) + n;
+        }
+
+        std::uint64_t Take(int c)
+        {
+            return counters[c].exchange(0, std::memory_order_relaxed);
+        }
+
+        // Locks, timing the wait only when the mutex is already taken
+        template<typename Lock>
+        void Acquire(Lock& lock)
+        {
+            Add(lock_acquisitions);
+            if (lock.try_lock())
+                return;
+            auto start = std::chrono::steady_clock::now();
+            lock.lock();
+            Add(lock_contentions);
+            Add(lock_wait_ns, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        }
+
+    private:
+        std::atomic<std::uint64_t> counters[nb_counters];
+#else
+        static const int nbVariables = 0;
+
+        std::uint64_t Add(counter, std::uint64_t = 1) { return 1; }
+        std::uint64_t Take(int) { return 0; }
+
+        template<typename Lock>
+        void Acquire(Lock& lock) { lock.lock(); }
+#endif
+    };
+
+
+    // How the pages of a segment, and of its extensions, are mapped by a process (Linux only, ignored elsewhere).
+    // Each process applies its own options when it maps a segment: they should be the same in all the processes of a domain.
+    struct segment_options {
+        bool hugePages;   // madvise(MADV_HUGEPAGE): transparent huge pages, when the tmpfs of the segment allows them (huge=advise)
+        bool prefault;    // Maps all the pages when the segment is created or attached, rather than on their first access
+        bool lock;        // mlock: the pages are never paged out. Needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK
+
+        static segment_options Default()
+        {
+            segment_options options;
+#ifdef IPV_SEGMENT_HUGE_PAGES
+            options.hugePages = true;
+#else
+            options.hugePages = false;
+#endif
+#ifdef IPV_SEGMENT_PREFAULT
+            options.prefault = true;
+#else
+            options.prefault = false;
+#endif
+#ifdef IPV_SEGMENT_LOCK
+            options.lock = true;
+#else
+            options.lock = false;
+#endif
+            return options;
+        }
+    };
+
+
+    // Aligned on a cache line, with the instrumentation counters first: the packing would leave them on 4 bytes boundaries,
+    // and an atomic operation across two cache lines is a bus lock.
+    class alignas(IPV_CACHE_LINE_SIZE) SharedMemoryManager {
+    public:
+        typedef variable_name_type IPVarsMapKey;
+        typedef IPVarRecord IPVarsMapValue;
+
+        static SharedMemoryManager& GetInstance()
+        {
+#ifdef IPV_USE_MAPPED_FILE
+            static const std::string path = std::string(IPV_MAPPED_FILE_DIRECTORY) + IPV_SHARED_MEMORY_NAME;
+            const char* shared_memory_name = path.c_str();
+#else
+            const char* shared_memory_name = IPV_SHARED_MEMORY_NAME;
+#endif
+            const std::size_t shared_memory_size = IPV_SHARED_MEMORY_SIZE;
+
+            static SharedMemoryManager instance(shared_memory_name, shared_memory_size, segment_options::Default());
+            return instance;
+        }
+
+        // Manager of the segment name, opened or created with size bytes on the first call: a domain.
+        // Each domain has its own directory, locks and allocator, so that variables with different lifetimes or write rates
+        // can live in different segments. The default domain, IPV_SHARED_MEMORY_NAME, is the one of GetInstance.
+        // The domains stay open until the process exits. With IPV_USE_MAPPED_FILE, the file is in IPV_MAPPED_FILE_DIRECTORY.
+        // size and options are the ones of the first call in the process.
+        static SharedMemoryManager& GetDomain(const char* name, std::size_t size = IPV_SHARED_MEMORY_SIZE, segment_options options = segment_options::Default())
+        {
+            if (std::strcmp(name, IPV_SHARED_MEMORY_NAME) == 0)
+                return GetInstance();
+#ifdef IPV_USE_MAPPED_FILE
+            std::string segmentName = std::string(IPV_MAPPED_FILE_DIRECTORY) + name;
+#else
+            std::string segmentName = name;
+#endif
+            static std::mutex* domainsMutex = new std::mutex();
+            static std::map<std::string, SharedMemoryManager*>* domains = new std::map<std::string, SharedMemoryManager*>();
+
+            std::lock_guard<std::mutex> lock(*domainsMutex);
+            SharedMemoryManager*& pDomain = (*domains)[segmentName];
+            if (pDomain == nullptr)
+            {
+                // Over-allocated to be aligned on its cache line, which a plain new does not guarantee before C++17
+                std::size_t space = sizeof(SharedMemoryManager) + alignof(SharedMemoryManager);
+                void* storage = ::operator new(space);
+                void* p = storage;
+                std::align(alignof(SharedMemoryManager), sizeof(SharedMemoryManager), p, space);
+                try {
+                    pDomain = new (p) SharedMemoryManager(segmentName.c_str(), size, options);
+                }
+                catch (...) {
+                    ::operator delete(storage);
+                    throw;
+                }
+            }
+            return *pDomain;
+        }
+
+        const std::string& Name() const
+        {
+            return segmentName;
+        }
+
+        const segment_options& Options() const
+        {
+            return options;
+        }
+
+        // Adds a variable to the directory, or returns the existing one.
+        // When the variable already exists, a reference is taken on it.
+        // varAlign is the required alignment (0 for the default one). A hot variable gets its own cache line(s).
+        // A variable which is not extensible is allocated in the initial segment (see uses_offset_ptr).
+        size_t  AddVariable(const hashed_name& name, int type, int varSize, const char* v_description, bool& justCreated, bool isPersistant, IPVarRecord*& pRec,
+            int varAlign = 0, placement varPlacement = placement::standard, const type_description* descriptor = nullptr, bool isExtensible = true)
+        {
+            justCreated = false;
+            pRec = nullptr;
+            if (!isValid)
+                return 0;
+
+            pRec = InsertRecord(name, [&](IPVarRecord& record) {
+                size_t varOffset = 0;
+                try {
+                    if (varPlacement == placement::hot)
+                        varOffset = AllocateStorage(AlignUp(varSize, IPV_CACHE_LINE_SIZE), (std::max)(varAlign, IPV_CACHE_LINE_SIZE), isExtensible);
+                    else
+                        varOffset = AllocateStorage(varSize, varAlign, isExtensible);
+                }
+                catch (bip::interprocess_exception&) {
+                    instrumentation.Add(IPVarInstrumentation::allocation_failures);
+                    return false;
+                }
+                FillRecord(record, type, varSize, v_description, isPersistant, varOffset);
+                record.descriptor = descriptor != nullptr ? InternDescriptor(*descriptor) : -1;
+                return true;
+                }, justCreated);
+            return pRec->varOffset;
+        }
+
+        // Adds or attaches a set of variables with a single lock acquisition.
+        // The storage of the created variables is allocated as one block, in the initial segment if one of them is not extensible.
+        void AddVariables(IPVarDeclaration* declarations, std::size_t count)
+        {
+            if (!isValid)
+                return;
+
+            boost::interprocess::scoped_lock<bip::interprocess_upgradable_mutex>  alock(*p_var_creation_mutex, bip::defer_lock);
+            instrumentation.Acquire(alock);
+
+            // Attach to the existing variables, and compute the block layout of the others
+            std::vector<std::size_t> positions(count, 0);
+            std::size_t blockSize = sizeof(IPVarBlockHeader);
+            std::size_t blockAlign = 0;
+            bool isExtensible = true;
+            int nbMissing = 0;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                IPVarDeclaration& d = declarations[i];
+                d.justCreated = false;
+                d.pRec = nullptr;
+                if (exists(d.Name(), d.varOffset, d.pRec) && AcquireReference(d.pRec))
+                    continue;
+                d.pRec = nullptr;
+                std::size_t align = (std::max)(d.varAlign, 1);
+                blockSize = AlignUp(blockSize, align);
+                blockAlign = (std::max)(blockAlign, align);
+                positions[i] = blockSize;
+                blockSize += d.varSize;
+                isExtensible = isExtensible && d.isExtensible;
+                nbMissing++;
+            }
+            if (nbMissing == 0)
+                return;
+
+            size_t blockOffset;
+            try {
+                blockOffset = AllocateStorage(blockSize, blockAlign, isExtensible);
+            }
+            catch (...) {
+                ReleaseDeclarations(declarations, count);
+                throw;
+            }
+            IPVarBlockHeader* pHeader = new (OffsetToAddress(blockOffset)) IPVarBlockHeader(nbMissing);
+
+            int nbPlaced = 0; // Variables of the block inserted, or created in the meantime by AddVariable
+            try {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    IPVarDeclaration& d = declarations[i];
+                    if (d.pRec != nullptr)
+                        continue;
+                    d.pRec = InsertRecord(d.Name(), [&](IPVarRecord& record) {
+                        FillRecord(record, d.type, d.varSize, d.description, d.isPersistant, blockOffset + positions[i]);
+                        record.blockOffset = blockOffset;
+                        record.descriptor = d.descriptor != nullptr ? InternDescriptor(*d.descriptor) : -1;
+                        return true;
+                        }, d.justCreated);
+                    d.varOffset = d.pRec->varOffset;
+                    nbPlaced++;
+
+                    // Created in the meantime by AddVariable: its place in the block is not used
+                    if (!d.justCreated)
+                        pHeader->nbVariables--;
+                }
+            }
+            catch (...) {
+                // The places of the variables not inserted are not used, the block goes with the last variable inserted
+                if ((pHeader->nbVariables -= nbMissing - nbPlaced) == 0)
+                    DeallocateStorage(blockOffset);
+                ReleaseDeclarations(declarations, count);
+                throw;
+            }
+            if (pHeader->nbVariables == 0)
+                DeallocateStorage(blockOffset);
+        }
+
+        size_t  AddVariable(const hashed_name& name, int type, int varSize, const char* v_description, bool& justCreated, bool isPersistant)
+        {
+            IPVarRecord* pRec;
+            return AddVariable(name, type, varSize, v_description, justCreated, isPersistant, pRec);
+        }
+
+        // Takes a reference on an existing variable.
+        // Fails if the variable is not persistent, and its last reference has been released: it is being removed.
+        bool AcquireReference(IPVarRecord* pRec)
+        {
+            int n = pRec->nbReferences.load();
+            do {
+                if (n <= 0 && !pRec->isPersistant)
+                    return false;
+            } while (!pRec->nbReferences.compare_exchange_weak(n, n + 1));
+            Lease(pRec, 1);
+            return true;
+        }
+
+        // Releases a reference taken by AddVariable or AcquireReference.
+        // Returns true for the last one: the caller then destroys a non persistent variable, and removes it.
+        bool ReleaseReference(IPVarRecord* pRec)
+        {
+            Lease(pRec, -1);
+            return --pRec->nbReferences == 0;
+        }
+
+        // Releases the references held by the processes which are gone, and removes the non persistent variables
+        // they were the last to use. Their destructors are not called. Returns the number of references released.
+        // Called when a process attaches, and when the lease table is full. A process can also call it periodically.
+        std::size_t ReclaimDeadProcesses()
+        {
+            if (!isValid)
+                return 0;
+            std::lock_guard<std::mutex> lock(leaseMutex);
+            return SweepLeases();
+        }
+
+        void* GetSegmentAddress()
+        {
+            if (!isValid)
+                return nullptr;
+            return segment->get_address();
+        }
+
+        // Offsets of the variables hold the index of their segment in their high bits: 0 for the initial segment,
+        // i for the extension segment i-1. Offsets in the initial segment are plain offsets from its address.
+        void* OffsetToAddress(size_t offset)
+        {
+            std::size_t index = offset >> SEGMENT_INDEX_SHIFT;
+            if (index == 0)
+                return pBase + offset;
+            return static_cast<char*>(MapExtension(index - 1)->get_address()) + (offset & LOCAL_OFFSET_MASK);
+        }
+
+        // Inverse of OffsetToAddress, for an address in the initial segment or in an extension mapped by this process
+        size_t AddressToOffset(const void* ptr)
+        {
+            if (segment->belongs_to_segment(ptr))
+                return static_cast<const char*>(ptr) - pBase;
+            for (std::size_t i = 0; i < IPV_SHARED_MEMORY_MAX_EXTENSIONS; ++i)
+            {
+                _shared_memory_* pExtension = extensions[i].load(std::memory_order_acquire);
+                if (pExtension != nullptr && pExtension->belongs_to_segment(ptr))
+                    return ((i + 1) << SEGMENT_INDEX_SHIFT) | static_cast<size_t>(static_cast<const char*>(ptr) - static_cast<const char*>(pExtension->get_address()));
+            }
+            throw std::runtime_error("Pointer not allocated in shared memory");
+        }
+
+        // Adds the counters of this process to the __ipv.* variables, and samples the free bytes of the segments.
+        // Called once every 65536 lookups, and before listing the variables. A process can call it periodically as well.
+        void PublishInstrumentation()
+        {
+            if (!isValid || IPVarInstrumentation::nbVariables == 0 || systemVariables[0] == nullptr)
+                return;
+            for (int i = 0; i < IPVarInstrumentation::nb_counters; ++i)
+            {
+                if (std::uint64_t n = instrumentation.Take(i))
+                {
+                    systemVariables[i]->fetch_add(static_cast<long long>(n), std::memory_order_relaxed);
+                    if (i == IPVarInstrumentation::lookup_misses)
+                        systemVariables[IPVarInstrumentation::lookups]->fetch_add(static_cast<long long>(n), std::memory_order_relaxed);
+                }
+            }
+            systemVariables[IPVarInstrumentation::nb_counters]->store(static_cast<long long>(FreeBytes()), std::memory_order_relaxed);
+        }
+
+        // Free bytes of the initial segment and of the extensions
+        std::size_t FreeBytes()
+        {
+            if (!isValid)
+                return 0;
+            std::size_t bytes = segment->get_free_memory();
+            for (std::uint32_t i = 0; i < NbExtensions(); ++i)
+                bytes += MapExtension(i)->get_free_memory();
+            return bytes;
+        }
+
+        // Number of extension segments created so far, by any process
+        std::uint32_t NbExtensions()
+        {
+            return isValid ? pChain->nbExtensions.load(std::memory_order_acquire) : 0;
+        }
+        bool exists(const hashed_name& name, size_t& result, IPVarRecord*& pRec)
+        {
+            result = 0;
+            if (!isValid)
+                return false;
+
+            // One increment per lookup: the hits, or the misses (added to the lookups when published).
+            // Lookups are frequent: the counters are published once every 65536 hits or misses.
+            std::size_t index = pDirectory->Find(name);
+            bool found = index != IPVarDirectory::npos;
+            if ((instrumentation.Add(found ? IPVarInstrumentation::lookups : IPVarInstrumentation::lookup_misses) & 0xFFFF) == 0)
+                PublishInstrumentation();
+            if (!found)
+                return false;
+            pRec = &pDirectory->Record(index);
+            result = pRec->varOffset;
+            return true;
+        }
+
+        bool exists(const hashed_name& name, size_t& result)
+        {
+            IPVarRecord* pRec;
+            return exists(name, result, pRec);
+        }
+
+
+
+
+        _shared_memory_* GetSegment()
+        {
+            return segment;
+        }
+
+        IPVarDirectory* GetDirectory()
+        {
+            return pDirectory;
+        }
+
+        void RemoveVariable(const hashed_name& name)
+        {
+            if (!isValid)
+            {
+                return;
+            }
+            std::size_t index = pDirectory->Find(name);
+            if (index == IPVarDirectory::npos) return;
+
+            IPVarRecord& record = pDirectory->Record(index);
+            if (record.nbReferences > 0 || IPVarInstrumentation::IsSystemVariable(name)) return;
+
+            size_t varOffset = record.varOffset;
+            size_t blockOffset = record.blockOffset;
+            if (!pDirectory->Remove(index))
+                return;
+
+            if (blockOffset == 0)
+            {
+                DeallocateStorage(varOffset);
+                return;
+            }
+            IPVarBlockHeader* pHeader = static_cast<IPVarBlockHeader*>(OffsetToAddress(blockOffset));
+            if (--pHeader->nbVariables == 0)
+                DeallocateStorage(blockOffset);
+        }
+
+
+        void ListAllVariables(std::vector<boost::tuple<std::string, std::string, int, void*>>& variablesInfo) {
+
+            variablesInfo.clear();
+
+            ForEachVariable([&](const IPVarView& view) {
+                variablesInfo.push_back(boost::make_tuple(std::string(view.name.data(), view.name.size()), std::string(view.description.data(), view.description.size()), view.type, view.ptr));
+                });
+        }
+
+        // Calls f(const IPVarView&) for each variable, without copying nor allocating.
+        // The view is only valid during the call.
+        template<typename F>
+        void ForEachVariable(F&& f)
+        {
+            if (!isValid)
+                return;
+
+            PublishInstrumentation();
+            pDirectory->Visit([&](std::size_t index, const IPVarRecord& record) {
+                f(MakeView(index, record));
+                });
+        }
+
+        // Calls f(const IPVarView&) for each variable whose name starts with prefix, in name order.
+        // Finds the first one by a binary search in the index: O(log n + k) while the directory does not change.
+        // The index keeps its buffers from one call to the other, and is updated when the directory generation changes:
+        // O(n) to find the added and removed variables, plus the sort of the added ones.
+        template<typename F>
+        void ForEachVariableWithPrefix(VariablesIndex& index, boost::string_view prefix, F&& f)
+        {
+            if (!isValid)
+                return;
+
+            UpdateIndex(index);
+            auto first = std::lower_bound(index.entries.begin(), index.entries.end(), prefix,
+                [](const VariablesIndex::Entry& e, boost::string_view p) { return e.Name() < p; });
+            for (auto it = first; it != index.entries.end() && it->Name().starts_with(prefix); ++it)
+            {
+                // Skips the slots removed, or given to another variable, since the update
+                if (pDirectory->IsReady(it->slot) && pDirectory->Hash(it->slot) == it->hash)
+                    f(MakeView(it->slot, pDirectory->Record(it->slot)));
+            }
+        }
+
+        // Calls f(const IPVarView&) for each variable whose name matches pattern (see MatchName), in name order.
+        // Only the names starting with the characters before the first wildcard are matched.
+        template<typename F>
+        void ForEachVariableMatching(VariablesIndex& index, boost::string_view pattern, F&& f)
+        {
+            boost::string_view prefix = pattern.substr(0, pattern.find_first_of("*?"));
+            ForEachVariableWithPrefix(index, prefix, [&](const IPVarView& view) {
+                if (MatchName(pattern, view.name))
+                    f(view);
+                });
+        }
+
+        // Copies the value of all the variables into the snapshot, in one pass.
+        // The snapshot keeps its buffers from one call to the other. While the directory generation does not change,
+        // the entries are kept as they are and only the values are copied again: no allocation at all.
+        void Snapshot(VariablesSnapshot& snapshot)
+        {
+            if (!isValid)
+                return;
+
+            PublishInstrumentation();
+            std::uint64_t generation = pDirectory->Generation();
+            if (!snapshot.isValid || snapshot.generation != generation)
+            {
+                snapshot.entries.clear();
+                std::size_t dataSize = 0;
+                pDirectory->Visit([&](std::size_t, const IPVarRecord& record) {
+                    VariablesSnapshot::Entry e;
+                    e.pRec = &record;
+                    e.name = record.name;
+                    e.type = record.type;
+                    e.size = record.varSize;
+                    e.dataOffset = dataSize;
+                    snapshot.entries.push_back(e);
+                    dataSize += (record.varSize + 7) & ~7;
+                    });
+                snapshot.data.resize(dataSize);
+            }
+
+            for (const VariablesSnapshot::Entry& e : snapshot.entries)
+                std::memcpy(&snapshot.data[e.dataOffset], OffsetToAddress(e.pRec->varOffset), e.size);
+
+            snapshot.generation = generation;
+            snapshot.isValid = true;
+        }
+
+        // Brings the index up to date: drops the removed variables, sorts the added ones and merges them in.
+        // O(n + d log d) for d added variables.
+        void UpdateIndex(VariablesIndex& index)
+        {
+            std::uint64_t generation = pDirectory->Generation();
+            if (index.isValid && index.generation == generation)
+                return;
+
+            auto byName = [](const VariablesIndex::Entry& a, const VariablesIndex::Entry& b) { return a.Name() < b.Name(); };
+
+            // The slots of the index are marked 1. The visit marks 2 the published ones still holding the same name,
+            // and collects the others: not in the index, or given to another name (whose old entry is dropped).
+            std::vector<std::uint8_t>& marks = index.marks;
+            marks.resize(pDirectory->Capacity(), 0);
+            index.hashes.resize(pDirectory->Capacity(), 0);
+            index.added.clear();
+            pDirectory->Visit([&](std::size_t slot, const IPVarRecord& record) {
+                std::uint64_t hash = pDirectory->Hash(slot);
+                if (marks[slot] != 0 && index.hashes[slot] == hash)
+                {
+                    marks[slot] = 2;
+                    return;
+                }
+                VariablesIndex::Entry e;
+                e.name = record.name;
+                e.hash = hash;
+                e.slot = static_cast<std::uint32_t>(slot);
+                index.added.push_back(e);
+                marks[slot] = 3;
+                });
+
+            index.entries.erase(std::remove_if(index.entries.begin(), index.entries.end(), [&](const VariablesIndex::Entry& e) {
+                if (marks[e.slot] == 2)
+                    return false;
+                marks[e.slot] = 0;
+                return true;
+                }), index.entries.end());
+
+            std::sort(index.added.begin(), index.added.end(), byName);
+            std::size_t kept = index.entries.size();
+            index.entries.insert(index.entries.end(), index.added.begin(), index.added.end());
+            std::inplace_merge(index.entries.begin(), index.entries.begin() + kept, index.entries.end(), byName);
+            for (const VariablesIndex::Entry& e : index.entries)
+            {
+                marks[e.slot] = 1;
+                index.hashes[e.slot] = e.hash;
+            }
+
+            index.generation = generation;
+            index.isValid = true;
+        }
+
+        // Incremented each time a variable is added or removed
+        std::uint64_t Generation()
+        {
+            return isValid ? pDirectory->Generation() : 0;
+        }
+
+        // Index of the descriptor in the type table of the segment, added if it is not there yet.
+        // Returns -1 when the table or the segment is full: the variables of the type are then opaque.
+        std::int32_t InternDescriptor(const type_description& description)
+        {
+            if (!isValid)
+                return -1;
+
+            std::vector<char> bytes(description.Bytes());
+            description.CopyTo(bytes.data());
+
+            std::uint32_t n = (std::min)(pTypeTable->count.load(std::memory_order_acquire), static_cast<std::uint32_t>(IPV_TYPE_TABLE_CAPACITY));
+            for (std::uint32_t i = 0; i < n; ++i)
+            {
+                const IPVarTypeDescriptor* d = TypeDescriptor(static_cast<std::int32_t>(i));
+                if (d != nullptr && d->nbFields == description.Header().nbFields && std::memcmp(d, bytes.data(), bytes.size()) == 0)
+                    return static_cast<std::int32_t>(i);
+            }
+
+            // Two processes may add the same descriptor at the same time: both copies are valid
+            size_t offset;
+            try {
+                offset = AllocateStorage(bytes.size(), alignof(std::uint64_t));
+            }
+            catch (bip::interprocess_exception&) {
+                return -1;
+            }
+            std::memcpy(OffsetToAddress(offset), bytes.data(), bytes.size());
+            std::uint32_t index = pTypeTable->count.fetch_add(1);
+            if (index >= IPV_TYPE_TABLE_CAPACITY)
+            {
+                DeallocateStorage(offset);
+                return -1;
+            }
+            pTypeTable->offsets[index].store(offset + 1, std::memory_order_release);
+            return static_cast<std::int32_t>(index);
+        }
+
+        // Descriptor number index of the type table, nullptr if there is none
+        const IPVarTypeDescriptor* TypeDescriptor(std::int32_t index)
+        {
+            if (!isValid || index < 0 || index >= IPV_TYPE_TABLE_CAPACITY)
+                return nullptr;
+            std::uint64_t offset = pTypeTable->offsets[index].load(std::memory_order_acquire);
+            return offset != 0 ? static_cast<const IPVarTypeDescriptor*>(OffsetToAddress(static_cast<size_t>(offset - 1))) : nullptr;
+        }
+
+        // Writes the modified pages of the segment and of its extensions to their files.
+        // With wait == false, the writes are only scheduled. Does nothing unless IPV_USE_MAPPED_FILE is defined.
+        void Flush(bool wait = true)
+        {
+#ifdef IPV_USE_MAPPED_FILE
+            if (!isValid)
+                return;
+            FlushSegment(segment, wait);
+            for (std::uint32_t i = 0, n = NbExtensions(); i < n; ++i)
+                FlushSegment(MapExtension(i), wait);
+#else
+            (void)wait;
+#endif
+        }
+
+        // Layout report: the cache lines holding more than one variable.
+        // Each entry gives the offset of the line and the names of the variables it holds.
+        void ListSharedCacheLines(std::vector<std::pair<size_t, std::vector<std::string>>>& lines)
+        {
+            lines.clear();
+            if (!isValid)
+                return;
+
+            std::map<size_t, std::vector<std::string>> byLine;
+            pDirectory->Visit([&](std::size_t, const IPVarRecord& record) {
+                size_t first = record.varOffset / IPV_CACHE_LINE_SIZE;
+                size_t last = (record.varOffset + (std::max)(record.varSize, 1) - 1) / IPV_CACHE_LINE_SIZE;
+                for (size_t line = first; line <= last; ++line)
+                    byLine[line].push_back(record.name.c_str());
+                });
+            for (auto& line : byLine)
+            {
+                if (line.second.size() > 1)
+                    lines.push_back(std::make_pair(line.first * IPV_CACHE_LINE_SIZE, line.second));
+            }
+        }
+
+
+    private:
+        // Releases the references taken by a failed AddVariables. The variables it created, never constructed, are removed.
+        void ReleaseDeclarations(IPVarDeclaration* declarations, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                IPVarDeclaration& d = declarations[i];
+                if (d.pRec == nullptr)
+                    continue;
+                if (ReleaseReference(d.pRec) && d.justCreated)
+                    RemoveVariable(d.Name());
+                d.pRec = nullptr;
+                d.justCreated = false;
+            }
+        }
+
+        // Inserts the record of name, or takes a reference on the existing one.
+        template<typename F>
+        IPVarRecord* InsertRecord(const hashed_name& name, F&& fill, bool& justCreated)
+        {
+            for (;;)
+            {
+                std::size_t index = pDirectory->Insert(name, fill, justCreated);
+                if (index == IPVarDirectory::npos)
+                {
+                    throw std::runtime_error("Unable to add the variable: directory or shared memory full");
+                }
+                IPVarRecord* pRec = &pDirectory->Record(index);
+                if (justCreated)
+                {
+                    instrumentation.Add(IPVarInstrumentation::variables_created);
+                    Lease(pRec, 1);
+                    return pRec;
+                }
+                if (AcquireReference(pRec))
+                    return pRec;
+
+                // The variable is being removed by its last owner, wait for it to go away
+                WaitForRemoval(name, index);
+            }
+        }
+
+        void FillRecord(IPVarRecord& record, int type, int varSize, const char* v_description, bool isPersistant, size_t varOffset)
+        {
+            record.type = type;
+            record.varSize = varSize;
+            pDirectory->Description(pDirectory->IndexOf(record)) = v_description;
+            record.isPersistant = isPersistant;
+            record.nbReferences = 1;
+            record.varOffset = varOffset;
+        }
+
+        IPVarView MakeView(std::size_t index, const IPVarRecord& record)
+        {
+            const variable_description_type& description = pDirectory->Description(index);
+            IPVarView view;
+            view.name = boost::string_view(record.name.data(), record.name.size());
+            view.description = boost::string_view(description.data(), description.size());
+            view.type = record.type;
+            view.size = record.varSize;
+            view.isPersistant = record.isPersistant;
+            view.ptr = OffsetToAddress(record.varOffset);
+            view.descriptor = TypeDescriptor(record.descriptor);
+            return view;
+        }
+
+        // Allocates in the initial segment, then in the newest extension. Creates a new extension when both are full.
+        // Throws bip::bad_alloc when the maximum number of extensions is reached, or when the initial segment is full and the storage is not extensible.
+        size_t AllocateStorage(std::size_t size, std::size_t align = 0, bool isExtensible = true)
+        {
+            if (void* p = TryAllocate(segment, size, align))
+                return static_cast<char*>(p) - pBase;
+            if (!isExtensible)
+                throw bip::bad_alloc();
+            for (;;)
+            {
+                std::uint32_t n = pChain->nbExtensions.load(std::memory_order_acquire);
+                if (n > 0)
+                {
+                    _shared_memory_* pExtension = MapExtension(n - 1);
+                    if (void* p = TryAllocate(pExtension, size, align))
+                        return (static_cast<size_t>(n) << SEGMENT_INDEX_SHIFT) | static_cast<size_t>(static_cast<char*>(p) - static_cast<char*>(pExtension->get_address()));
+                }
+                Grow(n, size);
+            }
+        }
+
+        void DeallocateStorage(size_t offset)
+        {
+            std::size_t index = offset >> SEGMENT_INDEX_SHIFT;
+            _shared_memory_* pSegment = (index == 0) ? segment : MapExtension(index - 1);
+            pSegment->deallocate(OffsetToAddress(offset));
+        }
+
+        // Creates the extension number n, unless another process already did
+        void Grow(std::uint32_t n, std::size_t size)
+        {
+            bip::scoped_lock<bip::interprocess_mutex> lock(*p_grow_mutex, bip::defer_lock);
+            instrumentation.Acquire(lock);
+            if (pChain->nbExtensions.load() != n)
+                return;
+            if (n >= IPV_SHARED_MEMORY_MAX_EXTENSIONS)
+                throw bip::bad_alloc();
+
+            // Each extension doubles the total size
+            std::size_t extensionSize = (std::max)(segment->get_size() << n, 2 * size + 64 * 1024);
+            std::string extensionName = ExtensionName(n);
+            RemoveSegment(extensionName.c_str());
+            _shared_memory_* pExtension = new _shared_memory_(bip::create_only, extensionName.c_str(), extensionSize);
+            PreparePages(pExtension);
+
+            extensions[n].store(pExtension, std::memory_order_release);
+            pChain->extensionSizes[n] = extensionSize;
+            pChain->nbExtensions.store(n + 1, std::memory_order_release);
+        }
+
+#ifdef IPV_USE_MAPPED_FILE
+        static void FlushSegment(_shared_memory_* pSegment, bool wait)
+        {
+#ifdef _WIN32
+            (void)wait;
+            pSegment->flush();
+#else
+            msync(pSegment->get_address(), pSegment->get_size(), wait ? MS_SYNC : MS_ASYNC);
+#endif
+        }
+#endif
+
+        // Applies the segment_options to a segment mapped by this process: huge pages first, so that the prefault maps them
+        void PreparePages(_shared_memory_* pSegment) const
+        {
+#ifdef __linux__
+            char* address = static_cast<char*>(pSegment->get_address());
+            std::size_t size = pSegment->get_size();
+            if (options.hugePages)
+                madvise(address, size, MADV_HUGEPAGE);  // Fails, and changes nothing, when the kernel or the tmpfs has no huge pages
+            if (options.prefault)
+            {
+#ifdef IPV_USE_MAPPED_FILE
+                const int populate = MADV_POPULATE_READ;   // Would otherwise mark the whole file as dirty
+#else
+                const int populate = MADV_POPULATE_WRITE;
+#endif
+                if (madvise(address, size, populate) != 0)
+                {
+                    // Kernels before 5.14: one read per page
+                    const std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+                    for (std::size_t i = 0; i < size; i += pageSize)
+                        (void)*static_cast<volatile char*>(address + i);
+                }
+            }
+            if (options.lock && mlock(address, size) != 0)
+                throw std::runtime_error("Segment " + segmentName + " could not be locked in memory: " + std::strerror(errno));
+#else
+            (void)pSegment;
+#endif
+        }
+
+        _shared_memory_* MapExtension(std::size_t i)
+        {
+            _shared_memory_* pExtension = extensions[i].load(std::memory_order_acquire);
+            if (pExtension != nullptr)
+                return pExtension;
+
+            std::lock_guard<std::mutex> lock(extensionsMutex);
+            pExtension = extensions[i].load();
+            if (pExtension == nullptr)
+            {
+                pExtension = new _shared_memory_(bip::open_only, ExtensionName(i).c_str());
+                PreparePages(pExtension);
+                extensions[i].store(pExtension, std::memory_order_release);
+            }
+            return pExtension;
+        }
+
+        std::string ExtensionName(std::size_t i) const
+        {
+            return segmentName + "_ext" + std::to_string(i);
+        }
+
+        static void RemoveSegment(const char* name)
+        {
+#if defined(IPV_USE_MAPPED_FILE)
+            bip::file_mapping::remove(name);
+#elif !(defined(_WIN32) && defined(USE_WIN32_SHARED_MEMORY))
+            bip::shared_memory_object::remove(name);
+#else
+            (void)name; // Windows shared memory is destroyed with its last handle
+#endif
+        }
+
+        static void* TryAllocate(_shared_memory_* pSegment, std::size_t size, std::size_t align)
+        {
+            if (align <= _shared_memory_::segment_manager::memory_algorithm::Alignment)
+                return pSegment->allocate(size, std::nothrow);
+            return pSegment->allocate_aligned(size, align, std::nothrow);
+        }
+
+        template<typename S, typename A>
+        static S AlignUp(S size, A align)
+        {
+            return static_cast<S>((size + align - 1) / align * align);
+        }
+
+        // Counts of the references held by this process, taken on the first call.
+        // nullptr when the lease table is full: the references of the process are not tracked.
+        std::atomic<std::int32_t>* LeaseCounts()
+        {
+            std::atomic<std::int32_t>* pCounts = leaseCounts.load(std::memory_order_acquire);
+            if (pCounts != nullptr || leaseClaimed.load(std::memory_order_acquire))
+                return pCounts;
+            std::lock_guard<std::mutex> lock(leaseMutex);
+            if (!leaseClaimed.load())
+            {
+                leaseCounts.store(ClaimLease(), std::memory_order_release);
+                leaseClaimed.store(true, std::memory_order_release);
+            }
+            return leaseCounts.load();
+        }
+
+        // The count is changed after taking the reference, and before releasing it: a process killed in between
+        // leaves one reference behind, never releases one it did not hold.
+        void Lease(const IPVarRecord* pRec, std::int32_t delta)
+        {
+            if (untrackedReferences)
+                return;
+            if (std::atomic<std::int32_t>* pCounts = LeaseCounts())
+                pCounts[pDirectory->IndexOf(*pRec)].fetch_add(delta, std::memory_order_relaxed);
+        }
+
+        // Takes a free entry of the lease table, called with leaseMutex held
+        std::atomic<std::int32_t>* ClaimLease()
+        {
+            const std::uint32_t pid = CurrentProcessId();
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (std::size_t i = 0; i < IPV_LEASE_PROCESSES; ++i)
+                {
+                    IPVarLease& lease = pLeases->leases[i];
+                    std::uint32_t expected = IPVarLease::free;
+                    if (!lease.pid.compare_exchange_strong(expected, pid))
+                        continue;
+                    if (lease.countsOffset == 0)
+                    {
+                        std::size_t bytes = sizeof(std::atomic<std::int32_t>) * pDirectory->Capacity();
+                        try {
+                            size_t offset = AllocateStorage(bytes, alignof(std::atomic<std::int32_t>));
+                            std::memset(OffsetToAddress(offset), 0, bytes);
+                            lease.countsOffset = offset;
+                        }
+                        catch (bip::interprocess_exception&) {
+                            lease.pid.store(IPVarLease::free);
+                            return nullptr;
+                        }
+                    }
+                    leaseIndex = i;
+                    return static_cast<std::atomic<std::int32_t>*>(OffsetToAddress(lease.countsOffset));
+                }
+                // The table is full: free the entries of the processes which are gone, and try again
+                SweepLeases();
+            }
+            return nullptr;
+        }
+
+        // Releases the references of the entries left by dead processes, called with leaseMutex held.
+        // An entry with the pid of this process, other than its own, was left by a process with the same pid.
+        std::size_t SweepLeases()
+        {
+            const std::uint32_t self = CurrentProcessId();
+            std::size_t released = 0;
+            for (std::size_t i = 0; i < IPV_LEASE_PROCESSES; ++i)
+            {
+                IPVarLease& lease = pLeases->leases[i];
+                std::uint32_t pid = lease.pid.load();
+                if (pid == IPVarLease::free || pid == IPVarLease::sweeping)
+                    continue;
+                bool gone = (pid == self) ? (i != leaseIndex) : !IsProcessAlive(pid);
+                if (!gone || !lease.pid.compare_exchange_strong(pid, IPVarLease::sweeping))
+                    continue;
+
+                if (lease.countsOffset != 0)
+                {
+                    std::atomic<std::int32_t>* pCounts = static_cast<std::atomic<std::int32_t>*>(OffsetToAddress(lease.countsOffset));
+                    for (std::size_t index = 0; index < pDirectory->Capacity(); ++index)
+                    {
+                        // Negative for a forked child which released the references of its parent
+                        std::int32_t n = pCounts[index].exchange(0);
+                        if (n == 0)
+                            continue;
+                        IPVarRecord& record = pDirectory->Record(index);
+                        if (n > 0)
+                            released += static_cast<std::size_t>(n);
+                        if ((record.nbReferences -= n) == 0 && !record.isPersistant)
+                            RemoveVariable(record.name.c_str());
+                    }
+                }
+                lease.pid.store(IPVarLease::free);
+            }
+            return released;
+        }
+
+        // The managers of the process, for the fork handlers. They are never destroyed.
+        static std::vector<SharedMemoryManager*>& Managers()
+        {
+            static std::vector<SharedMemoryManager*>* managers = new std::vector<SharedMemoryManager*>();
+            return *managers;
+        }
+
+        static std::mutex& ManagersMutex()
+        {
+            static std::mutex* mutex = new std::mutex();
+            return *mutex;
+        }
+
+        void RegisterManager()
+        {
+            std::lock_guard<std::mutex> lock(ManagersMutex());
+            Managers().push_back(this);
+#ifndef _WIN32
+            static bool forkHandlers = false;
+            if (!forkHandlers)
+                pthread_atfork(&LockLeasesBeforeFork, &UnlockLeasesAfterFork, &ForgetLeasesAfterFork);
+            forkHandlers = true;
+#endif
+        }
+
+        static void LockLeasesBeforeFork()
+        {
+            ManagersMutex().lock();
+            for (SharedMemoryManager* pManager : Managers())
+                pManager->leaseMutex.lock();
+        }
+
+        static void UnlockLeasesAfterFork()
+        {
+            for (SharedMemoryManager* pManager : Managers())
+                pManager->leaseMutex.unlock();
+            ManagersMutex().unlock();
+        }
+
+        // A forked child has its own entries: the entries of the parent stay with the parent
+        static void ForgetLeasesAfterFork()
+        {
+            for (SharedMemoryManager* pManager : Managers())
+            {
+                pManager->leaseMutex.unlock();
+                pManager->leaseCounts.store(nullptr);
+                pManager->leaseClaimed.store(false);
+                pManager->leaseIndex = IPV_LEASE_PROCESSES;
+            }
+            ManagersMutex().unlock();
+        }
+
+        void WaitForRemoval(const hashed_name& name, std::size_t index)
+        {
+            IPVarRecord& record = pDirectory->Record(index);
+            while (record.nbReferences.load() <= 0 && pDirectory->Find(name) == index)
+                std::this_thread::yield();
+        }
+
+        SharedMemoryManager(const char* name, std::size_t size, segment_options segmentOptions)
+            : p_var_creation_mutex(nullptr), p_ipv_mutex(nullptr), p_grow_mutex(nullptr), segment(nullptr),
+            pDirectory(nullptr), pChain(nullptr), pSession(nullptr), pTypeTable(nullptr), pLeases(nullptr), pBase(nullptr),
+            segmentName(name), leaseCounts(nullptr), leaseIndex(IPV_LEASE_PROCESSES), leaseClaimed(false), untrackedReferences(false), options(segmentOptions),
+            isOwner(false), isValid(false)
+        {
+            isOwner = false;
+            isValid = false;
+            for (std::atomic<_shared_memory_*>& e : extensions)
+                e = nullptr;
+            for (std::atomic<long long>*& v : systemVariables)
+                v = nullptr;
+
+            try {
+                segment = new _shared_memory_(bip::create_only, name, size);
+                isOwner = true;
+                isValid = true;
+            }
+            catch (bip::interprocess_exception&) {
+                isOwner = false;
+            }
+            if (!isOwner) {
+                try {
+                    segment = new _shared_memory_(bip::open_only, name);
+                    isValid = true;
+                }
+                catch (bip::interprocess_exception&) {
+
+                    isValid = false;
+                }
+            }
+            if (!isValid)
+            {
+                throw std::runtime_error("SharedMemoryManager insance construction failed.");
+                return;
+            }
+            if (isValid)
+            {
+                if (isOwner)
+                {
+
+                    pDirectory = segment->construct<IPVarDirectory>("Directory")(segment, IPV_DIRECTORY_CAPACITY);
+                    p_ipv_mutex = segment->construct<bip::interprocess_upgradable_mutex>("Mutex")();
+                    p_var_creation_mutex = segment->construct<bip::interprocess_upgradable_mutex>("VCMutex")();
+                    p_grow_mutex = segment->construct<bip::interprocess_mutex>("GrowMutex")();
+                    pChain = segment->construct<IPVarSegmentChain>("SegmentChain")();
+                    pSession = segment->construct<IPVarSession>("Session")();
+                    pTypeTable = segment->construct<IPVarTypeTable>("TypeTable")();
+                    pLeases = segment->construct<IPVarLeaseTable>("LeaseTable")();
+
+                    // Extensions left by a previous instance of the segment
+                    for (std::size_t i = 0; i < IPV_SHARED_MEMORY_MAX_EXTENSIONS; ++i)
+                        RemoveSegment(ExtensionName(i).c_str());
+                }
+                else
+                {
+
+                    pDirectory = segment->find<IPVarDirectory>("Directory").first;
+                    p_ipv_mutex = segment->find<bip::interprocess_upgradable_mutex>("Mutex").first;
+                    p_var_creation_mutex = segment->find<bip::interprocess_upgradable_mutex>("VCMutex").first;
+                    p_grow_mutex = segment->find<bip::interprocess_mutex>("GrowMutex").first;
+                    pChain = segment->find<IPVarSegmentChain>("SegmentChain").first;
+                    pSession = segment->find_or_construct<IPVarSession>("Session")();
+                    pTypeTable = segment->find_or_construct<IPVarTypeTable>("TypeTable")();
+                    pLeases = segment->find_or_construct<IPVarLeaseTable>("LeaseTable")();
+                }
+                pBase = static_cast<char*>(segment->get_address());
+            }
+            isValid = (isValid && (pDirectory != nullptr) && (p_ipv_mutex != nullptr) && (pChain != nullptr) && (pSession != nullptr) && (pTypeTable != nullptr) && (pLeases != nullptr));
+            if (isValid)
+            {
+                try {
+                    PreparePages(segment);
+                }
+                catch (...) {
+                    delete segment;
+                    throw;
+                }
+            }
+            if (isValid && !isOwner)
+            {
+#ifdef IPV_USE_MAPPED_FILE
+                RecoverAfterReboot(); // Shared memory does not survive a reboot
+#endif
+                ReclaimDeadProcesses();
+            }
+            if (isValid)
+            {
+                RegisterManager();
+                AddSystemVariables();
+            }
+        }
+
+        // The __ipv.* variables: std::atomic<long long>, persistent, created by the first process.
+        // They are never removed, so the process keeps no reference on them, and takes no entry of the lease table for them.
+        void AddSystemVariables()
+        {
+            untrackedReferences = true;
+            try {
+                for (int i = 0; i < IPVarInstrumentation::nbVariables; ++i)
+                {
+                    bool justCreated;
+                    IPVarRecord* pRec;
+                    const int atomicLongLongType = 22; // TypeToInt< std::atomic<long long> >()
+                    size_t offset = AddVariable(IPVarInstrumentation::VariableName(i), atomicLongLongType, sizeof(std::atomic<long long>), "Library instrumentation",
+                        justCreated, true, pRec, alignof(std::atomic<long long>), placement::standard, &DescriptionOf<std::atomic<long long>>());
+                    systemVariables[i] = static_cast<std::atomic<long long>*>(OffsetToAddress(offset));
+                    if (justCreated)
+                        new (systemVariables[i]) std::atomic<long long>(0);
+                    if (pRec != nullptr)
+                        --pRec->nbReferences;
+                }
+            }
+            catch (...) {
+                untrackedReferences = false;
+                throw;
+            }
+            untrackedReferences = false;
+        }
+
+        // A segment kept in a file (IPV_USE_MAPPED_FILE) is attached after a reboot as it was left: the first process to attach
+        // resets the locks, the references and the waiters, and removes the non persistent variables.
+        // Their destructors are not called: the processes that used them are gone.
+        void RecoverAfterReboot()
+        {
+            const std::uint64_t boot = BootId();
+            for (;;)
+            {
+                std::uint64_t previous = pSession->bootId.load();
+                if (previous == boot)
+                    return;
+                if (previous == IPVarSession::recovering)
+                {
+                    std::this_thread::yield(); // Another process is recovering the segment
+                    continue;
+                }
+                if (!pSession->bootId.compare_exchange_weak(previous, IPVarSession::recovering))
+                    continue;
+
+                new (p_ipv_mutex) bip::interprocess_upgradable_mutex();
+                new (p_var_creation_mutex) bip::interprocess_upgradable_mutex();
+                new (p_grow_mutex) bip::interprocess_mutex();
+                pDirectory->Recover();
+                for (IPVarLease& lease : pLeases->leases)
+                {
+                    if (lease.countsOffset != 0)
+                        std::memset(OffsetToAddress(lease.countsOffset), 0, sizeof(std::atomic<std::int32_t>) * pDirectory->Capacity());
+                    lease.pid = IPVarLease::free;
+                }
+
+                std::vector<std::string> transient;
+                pDirectory->Visit([&](std::size_t, const IPVarRecord& record) {
+                    if (!record.isPersistant)
+                        transient.push_back(record.name.c_str());
+                    });
+                for (const std::string& name : transient)
+                    RemoveVariable(name.c_str());
+
+                pSession->bootId.store(boot);
+                return;
+            }
+        }
+    public:
+        // Allocates in the initial segment, which every process maps whole: the block can hold offset_ptr
+        // and be referenced by them, as the containers of the segment manager do.
+        // Throws bip::bad_alloc when the initial segment is full: the extensions are never used.
+        void* allocate(std::size_t size) {
+            return Allocate(size, false);
+        }
+
+        // Allocates in the initial segment, then in the extensions, chained when needed.
+        // An extension is mapped at a different address in each process: the block must not hold offset_ptr,
+        // and must be referenced through AddressToOffset / OffsetToAddress, never with an offset_ptr.
+        void* allocate_extensible(std::size_t size) {
+            return Allocate(size, true);
+        }
+
+        void deallocate(void* ptr) {
+            if (!isValid)
+            {
+                throw std::runtime_error("Shared memory not valid");
+                return;
+            }
+            bip::scoped_lock<bip::interprocess_upgradable_mutex> lock(*p_ipv_mutex, bip::defer_lock);
+            instrumentation.Acquire(lock);
+            SegmentOf(ptr)->deallocate(ptr);
+        }
+
+
+    private:
+        void* Allocate(std::size_t size, bool isExtensible)
+        {
+            if (!isValid)
+            {
+                throw std::runtime_error("Shared memory not valid");
+                return nullptr;
+            }
+            bip::scoped_lock<bip::interprocess_upgradable_mutex> lock(*p_ipv_mutex, bip::defer_lock);
+            instrumentation.Acquire(lock);
+            instrumentation.Add(IPVarInstrumentation::allocations);
+            try {
+                return OffsetToAddress(AllocateStorage(size, 0, isExtensible));
+            }
+            catch (bip::interprocess_exception&) {
+                instrumentation.Add(IPVarInstrumentation::allocation_failures);
+                throw;
+            }
+        }
+
+        // Segment holding ptr, among the initial segment and the extensions mapped by this process
+        _shared_memory_* SegmentOf(void* ptr)
+        {
+            if (segment->belongs_to_segment(ptr))
+                return segment;
+            for (std::atomic<_shared_memory_*>& e : extensions)
+            {
+                _shared_memory_* pExtension = e.load(std::memory_order_acquire);
+                if (pExtension != nullptr && pExtension->belongs_to_segment(ptr))
+                    return pExtension;
+            }
+            throw std::runtime_error("Pointer not allocated in shared memory");
+        }
+
+    private:
+        IPVarInstrumentation instrumentation;
+
+        bip::interprocess_upgradable_mutex* p_var_creation_mutex;
+        bip::interprocess_upgradable_mutex* p_ipv_mutex; // Added interprocess_upgradable_mutex for thread safety
+
+
+        bip::interprocess_mutex* p_grow_mutex;
+
+        _shared_memory_* segment; // Changed segment to a pointer
+        IPVarDirectory* pDirectory;
+        IPVarSegmentChain* pChain;
+        IPVarSession* pSession;
+        IPVarTypeTable* pTypeTable;
+        IPVarLeaseTable* pLeases;
+        char* pBase;
+
+        std::atomic<long long>* systemVariables[IPVarInstrumentation::nb_counters + 1];
+
+        static const int SEGMENT_INDEX_SHIFT = (sizeof(size_t) >= 8) ? 48 : 27;
+        static const size_t LOCAL_OFFSET_MASK = (static_cast<size_t>(1) << SEGMENT_INDEX_SHIFT) - 1;
+
+        std::string segmentName;
+        std::atomic<_shared_memory_*> extensions[IPV_SHARED_MEMORY_MAX_EXTENSIONS];
+        std::mutex extensionsMutex;
+
+        // Entry of this process in the lease table
+        std::atomic<std::atomic<std::int32_t>*> leaseCounts;
+        std::size_t leaseIndex;
+        std::mutex leaseMutex;
+        std::atomic<bool> leaseClaimed;
+        bool untrackedReferences;  // Set while AddSystemVariables attaches, before the manager is used by other threads
+
+        segment_options options;
+        bool isOwner;
+        bool isValid;
+
+    };
+
+
+    inline void* allocate_shared_memory(std::size_t size)
+    {
+        return SharedMemoryManager::GetInstance().allocate(size);
+    }
+
+    inline void* allocate_extensible_shared_memory(std::size_t size)
+    {
+        return SharedMemoryManager::GetInstance().allocate_extensible(size);
+    }
+
+    inline void deallocate_shared_memory(void* ptr)
     {
         SharedMemoryManager::GetInstance().deallocate(ptr);
     }
 
-    _shared_memory_ * get_shared_memory_segment()
+    inline _shared_memory_ * get_shared_memory_segment()
     {
         return SharedMemoryManager::GetInstance().GetSegment();
     }
 
+
+    // Flushes the segment to its file from a thread of its own, each period (see SharedMemoryManager::Flush).
+    // The last flush, when it is destroyed, waits for the writes to complete.
+    class periodic_flush {
+    public:
+        explicit periodic_flush(std::chrono::milliseconds v_period, bool v_wait = false) : period(v_period), wait(v_wait), stopping(false)
+        {
+            flusher = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopped.wait_for(lock, period, [this]() { return stopping; }))
+                {
+                    lock.unlock();
+                    SharedMemoryManager::GetInstance().Flush(wait);
+                    lock.lock();
+                }
+                });
+        }
+
+        ~periodic_flush()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            stopped.notify_all();
+            flusher.join();
+            SharedMemoryManager::GetInstance().Flush(true);
+        }
+
+        periodic_flush(const periodic_flush&) = delete;
+        periodic_flush& operator=(const periodic_flush&) = delete;
+
+    private:
+        std::chrono::milliseconds period;
+        bool wait;
+        bool stopping;
+        std::mutex mutex;
+        std::condition_variable stopped;
+        std::thread flusher;
+    };
+
     template<typename T, typename U = T > class variable {
         //variable(const char* varName, int varType = 0, bool isPersistant = false, const char *varDescription = "") : var(nullptr), vName(varName)
 
     private:
-        void constuct_variable(const char* varName, int varType, bool isPersistant, const char* varDescription)
+        void constuct_variable(SharedMemoryManager& manager, const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, placement varPlacement)
         {
             var = nullptr;
-            vName = varName;
+            pRec = nullptr;
+            domain = &manager;
+            vHash = varName.Hash();
 
             size_t varOffset;
-            IPVarRecord* pRec;
-            bool justCreated = false;
             _isMine = false;
 
-            if (SharedMemoryManager::GetInstance().exists(varName, varOffset, pRec))
+            if (manager.exists(varName, varOffset, pRec))
             {
-                if (pRec->type != varType)
-                {
-                    throw std::exception("Variable type mismatch");
-                }
-                if (pRec->varSize != sizeof(T))
+                check_record(varType);
+                if (!manager.AcquireReference(pRec))
+                    pRec = nullptr;
+            }
+            if (pRec == nullptr)
+            {
+                varOffset = manager.AddVariable(varName, varType, sizeof(T), varDescription, _isMine, isPersistant, pRec, alignof(T), varPlacement, &DescriptionOf<T>(),
+                    !uses_offset_ptr<T>::value);
+                if (!_isMine)
                 {
-                    throw std::exception("Variable size mismatch");
+                    try {
+                        check_record(varType);
+                    }
+                    catch (...) {
+                        manager.ReleaseReference(pRec);
+                        pRec = nullptr;
+                        throw;
+                    }
                 }
-                var = reinterpret_cast<T*>(static_cast<char*>(SharedMemoryManager::GetInstance().GetSegmentAddress()) + varOffset);
-                pRec->nbReferences++;
             }
-            else
-            {
-                varOffset = SharedMemoryManager::GetInstance().AddVariable(varName, varType, sizeof(T), varDescription, _isMine, isPersistant);
-                var = reinterpret_cast<T*>(static_cast<char*>(SharedMemoryManager::GetInstance().GetSegmentAddress()) + varOffset);
+            var = reinterpret_cast<T*>(manager.OffsetToAddress(varOffset));
+        }
 
+        void check_record(int varType)
+        {
+            if (pRec->type != varType)
+            {
+                throw std::runtime_error("Variable type mismatch");
+            }
+            if (pRec->varSize != sizeof(T))
+            {
+                throw std::runtime_error("Variable size mismatch");
             }
         }
 
     public:
 
 
-        variable(const char* varName, int varType, bool isPersistant, const char* varDescription) : var(nullptr), vName(varName)
+        // varName is a const char*, hashed at run time, or an IPV_NAME, hashed at compile time
+        variable(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, placement varPlacement = default_placement<T>())
+            : variable(SharedMemoryManager::GetInstance(), varName, varType, isPersistant, varDescription, varPlacement)
+        {
+        }
+
+        variable(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, U vInitiale, placement varPlacement = default_placement<T>())
+            : variable(SharedMemoryManager::GetInstance(), varName, varType, isPersistant, varDescription, vInitiale, varPlacement)
+        {
+        }
+
+        // The variable in a domain, see SharedMemoryManager::GetDomain
+        variable(SharedMemoryManager& varDomain, const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, placement varPlacement = default_placement<T>())
+            : var(nullptr), pRec(nullptr), domain(&varDomain), vHash(varName.Hash())
         {
-            constuct_variable(varName, varType, isPersistant, varDescription);
+            constuct_variable(varDomain, varName, varType, isPersistant, varDescription, varPlacement);
             if (_isMine)
             {
                 new (var) T;
             }
         }
 
-        variable(const char* varName, int varType, bool isPersistant, const char* varDescription, U vInitiale)
-            : var(nullptr), vName(varName)
+        variable(SharedMemoryManager& varDomain, const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, U vInitiale, placement varPlacement = default_placement<T>())
+            : var(nullptr), pRec(nullptr), domain(&varDomain), vHash(varName.Hash())
         {
-            constuct_variable(varName, varType, isPersistant, varDescription);
+            constuct_variable(varDomain, varName, varType, isPersistant, varDescription, varPlacement);
 
             if (_isMine)
             {
@@ -488,19 +2712,16 @@ namespace ipv {
 
 
         ~variable() {
-            if (var != nullptr) {
-                IPVarRecord* pRec;
-                size_t varOffset;
-                if (SharedMemoryManager::GetInstance().exists(vName.c_str(), varOffset, pRec))
+            if (var != nullptr && pRec != nullptr) {
+                // The name is read from the record, rather than kept in each variable, while the reference holds the slot:
+                // once released, the slot can be removed and given to another name.
+                const variable_name_type name = pRec->name;
+                if (domain->ReleaseReference(pRec) && !pRec->isPersistant)
                 {
-                    pRec->nbReferences--;
-                    if (pRec->nbReferences == 0 && !pRec->isPersistant)
-                    {
-                        var->~T();
+                    var->~T();
 
-                        // Remove from the map
-                        SharedMemoryManager::GetInstance().RemoveVariable(vName.c_str());
-                    }
+                    // Remove from the directory
+                    domain->RemoveVariable(hashed_name(name.c_str(), name.size(), vHash));
                 }
             }
         }
@@ -522,23 +2743,279 @@ namespace ipv {
         }
 
         bool IsPersistant() const {
-            IPVarRecord* pRec;
-            size_t varOffset;
-            if (SharedMemoryManager::GetInstance().exists(vName.c_str(), varOffset, pRec))
-            {
-                return pRec->isPersistant;
-            }
-            return false;
+            return pRec != nullptr && pRec->isPersistant;
+        }
+
+        // Change notification. The version is incremented by notify(), from any process.
+        std::uint32_t version() const {
+            return pRec->version.load(std::memory_order_acquire);
+        }
+
+        void notify() {
+            // Sequentially consistent with nbWaiters: either the waiter sees the new version, or we see the waiter
+            pRec->version.fetch_add(1);
+            if (pRec->nbWaiters.load() != 0)
+                WakeWord(&pRec->version);
+        }
+
+        template<typename V>
+        void store_and_notify(V&& value) {
+            *var = std::forward<V>(value);
+            notify();
+        }
+
+        // Blocks until the version differs from last_version, or the timeout expires.
+        // Returns true if the version changed.
+        template<typename Rep, typename Period>
+        bool wait_for_change(std::uint32_t last_version, const std::chrono::duration<Rep, Period>& timeout) {
+            pRec->nbWaiters++;
+            bool changed = WaitOnWord(&pRec->version, last_version, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout));
+            pRec->nbWaiters--;
+            return changed;
+        }
+
+        SharedMemoryManager& Domain() const {
+            return *domain;
         }
 
     private:
         T* var;
-        std::string vName;
+        IPVarRecord* pRec;
+        SharedMemoryManager* domain;
+        std::uint64_t vHash;
         bool _isMine;
 
     };
 
 
+    template<typename T> class group_variable;
+
+    // Collects variable declarations, and registers them all at once on commit():
+    // one lock acquisition and one allocation for the whole group, instead of one round trip per variable.
+    // The handles returned by declare() can be used after the commit. The first access commits the group if needed.
+    // The group must outlive its handles. Its destruction releases the variables, like the destruction of an ipv::variable.
+    class variable_group {
+    public:
+        variable_group() : domain(&SharedMemoryManager::GetInstance()), committed(false), failed(false) {}
+
+        // The variables of the group in a domain, see SharedMemoryManager::GetDomain
+        explicit variable_group(SharedMemoryManager& groupDomain) : domain(&groupDomain), committed(false), failed(false) {}
+
+        variable_group(const variable_group&) = delete;
+        variable_group& operator=(const variable_group&) = delete;
+
+        ~variable_group()
+        {
+            release();
+        }
+
+        // varName is a const char*, hashed at run time, or an IPV_NAME, hashed at compile time
+        template<typename T>
+        group_variable<T> declare(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription)
+        {
+            return add<T>(varName, varType, isPersistant, varDescription, [](void* p) { new (p) T; });
+        }
+
+        template<typename T, typename U>
+        group_variable<T> declare(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, U vInitiale)
+        {
+            return add<T>(varName, varType, isPersistant, varDescription, [vInitiale](void* p) {
+                T* var = new (p) T(vInitiale);
+                (*var) = vInitiale;
+                });
+        }
+
+        // Registers all the declared variables.
+        // On failure (type or size mismatch, full segment) the references taken are released and the group cannot be used:
+        // the next calls throw as well.
+        void commit()
+        {
+            std::lock_guard<std::mutex> lock(commitMutex);
+            if (committed)
+                return;
+            if (failed)
+                throw std::runtime_error("Variable group commit failed");
+
+            std::vector<IPVarDeclaration> declarations(entries.size());
+            for (std::size_t i = 0; i < entries.size(); ++i)
+            {
+                IPVarDeclaration& d = declarations[i];
+                d.name = entries[i].name.c_str();
+                d.nameLength = entries[i].name.size();
+                d.hash = entries[i].hash;
+                d.description = entries[i].description.c_str();
+                d.type = entries[i].type;
+                d.varSize = entries[i].varSize;
+                d.varAlign = entries[i].varAlign;
+                d.isPersistant = entries[i].isPersistant;
+                d.descriptor = entries[i].descriptor;
+                d.isExtensible = entries[i].isExtensible;
+            }
+
+            SharedMemoryManager& manager = *domain;
+            try {
+                manager.AddVariables(declarations.data(), declarations.size());
+            }
+            catch (...) {
+                failed = true;
+                throw;
+            }
+
+            for (std::size_t i = 0; i < entries.size(); ++i)
+            {
+                entry& e = entries[i];
+                e.pRec = declarations[i].pRec;
+                e.ptr = manager.OffsetToAddress(declarations[i].varOffset);
+                e.isMine = declarations[i].justCreated;
+                e.isConstructed = !e.isMine && e.pRec->type == e.type && e.pRec->varSize == e.varSize;
+            }
+
+            // Type checks are done once all the references are held, and before any construction
+            try {
+                for (entry& e : entries)
+                {
+                    if (e.pRec->type != e.type)
+                    {
+                        throw std::runtime_error("Variable type mismatch");
+                    }
+                    if (e.pRec->varSize != e.varSize)
+                    {
+                        throw std::runtime_error("Variable size mismatch");
+                    }
+                }
+                for (entry& e : entries)
+                {
+                    if (e.isMine)
+                    {
+                        e.construct(e.ptr);
+                        e.isConstructed = true;
+                    }
+                }
+            }
+            catch (...) {
+                release();
+                failed = true;
+                throw;
+            }
+            committed.store(true, std::memory_order_release);
+        }
+
+        bool IsCommitted() const {
+            return committed.load(std::memory_order_acquire);
+        }
+
+    private:
+        template<typename T> friend class group_variable;
+
+        struct entry {
+            std::string name;
+            std::uint64_t hash;
+            std::string description;
+            int type;
+            int varSize;
+            int varAlign;
+            bool isPersistant;
+            const type_description* descriptor;
+            bool isExtensible;
+            std::function<void(void*)> construct;
+            std::function<void(void*)> destroy;
+
+            IPVarRecord* pRec;
+            void* ptr;
+            bool isMine;
+            bool isConstructed; // Holds a T: constructed by the group, or by another process with the same type
+        };
+
+        // Releases the references of the group, like the destruction of an ipv::variable.
+        // Only the variables holding a T are destroyed. The variables created by the group and never constructed are removed.
+        void release()
+        {
+            for (entry& e : entries)
+            {
+                if (e.pRec == nullptr)
+                    continue;
+                if (domain->ReleaseReference(e.pRec) && (!e.pRec->isPersistant || (e.isMine && !e.isConstructed)))
+                {
+                    if (e.isConstructed)
+                        e.destroy(e.ptr);
+                    domain->RemoveVariable(hashed_name(e.name.c_str(), e.name.size(), e.hash));
+                }
+                e.pRec = nullptr;
+                e.ptr = nullptr;
+                e.isConstructed = false;
+            }
+        }
+
+        template<typename T, typename F>
+        group_variable<T> add(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, F&& construct)
+        {
+            if (IsCommitted())
+            {
+                throw std::runtime_error("Variable group already committed");
+            }
+            entry e;
+            e.name.assign(varName.c_str(), varName.size());
+            e.hash = varName.Hash();
+            e.description = varDescription;
+            e.type = varType;
+            e.varSize = sizeof(T);
+            e.varAlign = alignof(T);
+            e.isPersistant = isPersistant;
+            e.descriptor = &DescriptionOf<T>();
+            e.isExtensible = !uses_offset_ptr<T>::value;
+            e.construct = construct;
+            e.destroy = [](void* p) { static_cast<T*>(p)->~T(); };
+            e.pRec = nullptr;
+            e.ptr = nullptr;
+            e.isMine = false;
+            e.isConstructed = false;
+            entries.push_back(e);
+            return group_variable<T>(this, entries.size() - 1);
+        }
+
+        entry& resolve(std::size_t index)
+        {
+            if (!IsCommitted())
+                commit();
+            return entries[index];
+        }
+
+        std::vector<entry> entries;
+        SharedMemoryManager* domain;
+        std::mutex commitMutex;
+        std::atomic<bool> committed;
+        bool failed;  // Set by a failed commit, under commitMutex
+    };
+
+
+    // Handle on a variable registered through a variable_group
+    template<typename T> class group_variable {
+    public:
+        group_variable(variable_group* v_group, std::size_t v_index) : group(v_group), index(v_index) {}
+
+        std::string AsString() const {
+            return ipv::try_to_string(*static_cast<T*>(group->resolve(index).ptr));
+        }
+
+        operator T* () {
+            return static_cast<T*>(group->resolve(index).ptr);
+        }
+
+        bool IsMine() const {
+            return group->resolve(index).isMine;
+        }
+
+        bool IsPersistant() const {
+            return group->entries[index].isPersistant;
+        }
+
+    private:
+        variable_group* group;
+        std::size_t index;
+    };
+
+
+
 #pragma pack(pop)
 
 } // namespace ipv
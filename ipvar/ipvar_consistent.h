@@ -0,0 +1,189 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_CONSISTENT_H_
+#define _IPVAR_CONSISTENT_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#include <cstring>
+#include <type_traits>
+
+#pragma pack(push, 4)
+
+namespace ipv {
+
+    // Storage of a consistent_variable: a sequence counter next to the payload.
+    // The sequence is odd while a write is in progress. Readers retry until they read the same even sequence
+    // before and after copying the payload.
+    template<typename T>
+    struct seqlock_cell {
+        static_assert(std::is_trivially_copyable<T>::value, "seqlock_cell requires a trivially copyable type");
+
+        seqlock_cell() : sequence(0), payload() {}
+        explicit seqlock_cell(const T& v) : sequence(0), payload(v) {}
+
+        seqlock_cell& operator=(const T& v)
+        {
+            store(v);
+            return *this;
+        }
+
+        T load() const
+        {
+            T v;
+            for (;;)
+            {
+                std::uint32_t s = begin_read();
+                std::memcpy(&v, &payload, sizeof(T));
+                if (end_read(s))
+                    return v;
+            }
+        }
+
+        void store(const T& v)
+        {
+            update_with([&](T& p) { std::memcpy(&p, &v, sizeof(T)); });
+        }
+
+        // Calls f(payload) until it runs without a concurrent write, and returns its last result.
+        // f may run on an inconsistent payload in the runs that are discarded: it must only read it.
+        template<typename F>
+        auto read_with(F&& f) const -> decltype(f(std::declval<const T&>()))
+        {
+            for (;;)
+            {
+                std::uint32_t s = begin_read();
+                auto result = f(const_cast<const T&>(payload));
+                if (end_read(s))
+                    return result;
+            }
+        }
+
+        // Calls f(payload) to modify it. Readers never see a partial update.
+        // A single writer never waits, concurrent writers are serialized on the sequence.
+        template<typename F>
+        void update_with(F&& f)
+        {
+            std::uint32_t s = sequence.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                if (s & 1)
+                {
+                    std::this_thread::yield();
+                    s = sequence.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (sequence.compare_exchange_weak(s, s + 1, std::memory_order_acquire))
+                    break;
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            f(payload);
+            sequence.store(s + 2, std::memory_order_release);
+        }
+
+        std::uint32_t version() const {
+            return sequence.load(std::memory_order_acquire);
+        }
+
+        std::string AsString() const {
+            T v = load();
+            return ipv::try_to_string(v);
+        }
+
+    private:
+        template<typename, typename> friend struct describe;
+
+        std::uint32_t begin_read() const
+        {
+            std::uint32_t s;
+            while ((s = sequence.load(std::memory_order_acquire)) & 1)
+                std::this_thread::yield();
+            return s;
+        }
+
+        bool end_read(std::uint32_t s) const
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return sequence.load(std::memory_order_relaxed) == s;
+        }
+
+        std::atomic<std::uint32_t> sequence;
+        T payload;
+    };
+
+    // A cell is described as its payload, so that FormatValue and the monitors show the value.
+    // They read it without the sequence: a value being written may be shown torn.
+    template<typename T>
+    struct describe<seqlock_cell<T>, void> {
+        static type_description Get()
+        {
+            seqlock_cell<T> cell;
+            std::size_t offset = static_cast<std::size_t>(reinterpret_cast<const char*>(&cell.payload) - reinterpret_cast<const char*>(&cell));
+            type_description payload = describe<T>::Get();
+            return type_description("consistent<" + std::string(payload.Header().name) + ">", sizeof(cell), alignof(seqlock_cell<T>)).Add("", offset, payload);
+        }
+    };
+
+    // Type code of a consistent variable: 120 plus the code of its payload, 120 for a payload without a code
+    template<typename T>
+    constexpr int ConsistentTypeToInt() { return 120 + TypeToInt<T>(); }
+
+
+    // Interprocess variable whose readers always get a consistent value, even for types that are not atomic.
+    // The value is not accessed through a pointer, but copied with load()/store() or accessed with read_with()/update_with().
+    template<typename T, typename U = T> class consistent_variable {
+    public:
+        consistent_variable(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription)
+            : var(varName, varType, isPersistant, varDescription)
+        {
+        }
+
+        consistent_variable(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, U vInitiale)
+            : var(varName, varType, isPersistant, varDescription, T(vInitiale))
+        {
+        }
+
+        T load() const { return cell().load(); }
+
+        void store(const T& v) { cell().store(v); }
+
+        template<typename F>
+        auto read_with(F&& f) const -> decltype(f(std::declval<const T&>())) { return cell().read_with(std::forward<F>(f)); }
+
+        template<typename F>
+        void update_with(F&& f) { cell().update_with(std::forward<F>(f)); }
+
+        std::string AsString() const { return cell().AsString(); }
+
+        bool IsMine() const { return var.IsMine(); }
+
+        bool IsPersistant() const { return var.IsPersistant(); }
+
+    private:
+        seqlock_cell<T>& cell() const { return *static_cast<seqlock_cell<T>*>(var); }
+
+        mutable variable<seqlock_cell<T>, T> var;
+    };
+
+} // namespace ipv
+
+#pragma pack(pop)
+
+
+// decl_ipv_consistent_.. macros follow the decl_ipv_variable.. ones.
+// The type code (ConsistentTypeToInt) differs from the one of the payload: monitors must not read the payload as a plain value.
+
+#define decl_ipv_consistent_variable(type,name) ipv::consistent_variable<type> name(IPV_NAME(#name), ipv::ConsistentTypeToInt<type>(),false,#name)
+#define decl_pipv_consistent_variable(type,name) ipv::consistent_variable<type> name(IPV_NAME(#name), ipv::ConsistentTypeToInt<type>(),true,#name)
+
+#define decl_ipv_consistent_variable_2(type,name,desc) ipv::consistent_variable<type> name(IPV_NAME(#name), ipv::ConsistentTypeToInt<type>(),false,desc)
+#define decl_pipv_consistent_variable_2(type,name,desc) ipv::consistent_variable<type> name(IPV_NAME(#name), ipv::ConsistentTypeToInt<type>(),true,desc)
+
+#define decl_ipv_consistent_variable_3(type,name,desc,v0) ipv::consistent_variable<type, decltype(v0)> name(IPV_NAME(#name), ipv::ConsistentTypeToInt<type>(),false,desc,v0)
+#define decl_pipv_consistent_variable_3(type,name,desc,v0) ipv::consistent_variable<type, decltype(v0)> name(IPV_NAME(#name), ipv::ConsistentTypeToInt<type>(),true,desc,v0)
+
+#endif // _IPVAR_CONSISTENT_H_
@@ -0,0 +1,110 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_COUNTER_H_
+#define _IPVAR_COUNTER_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+#ifndef IPV_COUNTER_SHARDS
+#define IPV_COUNTER_SHARDS 64  // Number of cache lines of a sharded counter
+#endif
+
+#ifndef IPV_CACHE_LINE_SIZE
+#define IPV_CACHE_LINE_SIZE 64
+#endif
+
+namespace ipv {
+
+    // Index of the CPU running the calling thread, or a per-thread index where it is not available
+    inline unsigned CurrentCpu()
+    {
+#ifdef _WIN32
+        return static_cast<unsigned>(GetCurrentProcessorNumber());
+#elif defined(__linux__)
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+            return static_cast<unsigned>(cpu);
+#endif
+        static std::atomic<unsigned> nbThreads(0);
+        static thread_local unsigned threadIndex = nbThreads++;
+        return threadIndex;
+    }
+
+
+    // Counter split over IPV_COUNTER_SHARDS cache lines, one per CPU.
+    // Increments from different CPUs never touch the same cache line, reading the value sums all the lines.
+    // Use it as the type of an interprocess variable: decl_ipv_variable(ipv::sharded_counter<long long>, requests);
+    template<typename T>
+    struct sharded_counter {
+        static_assert(std::is_integral<T>::value, "sharded_counter requires an integral type");
+
+        sharded_counter() { construct(0); }
+        explicit sharded_counter(T v0) { construct(v0); }
+
+        void add(T v) { shard(CurrentCpu() % IPV_COUNTER_SHARDS).fetch_add(v, std::memory_order_relaxed); }
+
+        sharded_counter& operator+=(T v) { add(v); return *this; }
+        sharded_counter& operator-=(T v) { add(static_cast<T>(0 - v)); return *this; }
+        sharded_counter& operator++() { add(1); return *this; }
+        void operator++(int) { add(1); }
+        sharded_counter& operator--() { add(static_cast<T>(-1)); return *this; }
+        void operator--(int) { add(static_cast<T>(-1)); }
+
+        // Sum of all the shards. Concurrent increments may or may not be counted.
+        T load() const
+        {
+            T sum = 0;
+            for (std::size_t i = 0; i < IPV_COUNTER_SHARDS; ++i)
+                sum += shard(i).load(std::memory_order_relaxed);
+            return sum;
+        }
+
+        operator T() const { return load(); }
+
+        void reset()
+        {
+            for (std::size_t i = 0; i < IPV_COUNTER_SHARDS; ++i)
+                shard(i).store(0, std::memory_order_relaxed);
+        }
+
+        std::string AsString() const { return std::to_string(load()); }
+
+    private:
+        void construct(T v0)
+        {
+            for (std::size_t i = 0; i < IPV_COUNTER_SHARDS; ++i)
+                new (&shard(i)) std::atomic<T>(i == 0 ? v0 : 0);
+        }
+
+        // The storage is one cache line larger than needed, so that the shards can be aligned on cache lines
+        // whatever the alignment of the variable in the segment.
+        std::atomic<T>& shard(std::size_t i) const
+        {
+            std::uintptr_t p = reinterpret_cast<std::uintptr_t>(storage);
+            p = (p + IPV_CACHE_LINE_SIZE - 1) & ~static_cast<std::uintptr_t>(IPV_CACHE_LINE_SIZE - 1);
+            return *reinterpret_cast<std::atomic<T>*>(p + i * IPV_CACHE_LINE_SIZE);
+        }
+
+        mutable char storage[(IPV_COUNTER_SHARDS + 1) * IPV_CACHE_LINE_SIZE];
+    };
+
+    // The first and last shards of a counter must not share their line with other variables
+    template<typename T>
+    struct is_hot_variable<sharded_counter<T>> : std::true_type {};
+
+    template <> constexpr int TypeToInt< sharded_counter<long long> >() { return 100; }
+    template <> constexpr int TypeToInt< sharded_counter<unsigned long long> >() { return 101; }
+
+} // namespace ipv
+
+#endif // _IPVAR_COUNTER_H_
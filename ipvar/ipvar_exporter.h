@@ -0,0 +1,790 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_EXPORTER_H_
+#define _IPVAR_EXPORTER_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef IPV_EXPORTER_REMOVALS
+#define IPV_EXPORTER_REMOVALS 65536  // Removals kept for the incremental scrapes: an older client gets all the variables
+#endif
+
+#ifndef IPV_EXPORTER_SEND_TIMEOUT_MS
+#define IPV_EXPORTER_SEND_TIMEOUT_MS 5000  // A client which reads none of its answer for this long is disconnected
+#endif
+
+// Export of the variables of a domain to a metrics stack, over a Unix domain socket.
+//
+// A variables_exporter keeps a copy of the values, refreshed in one pass over the directory. Each refresh has a sequence number,
+// and each variable remembers the sequence of the refresh which saw it change (by comparing the bytes of its value),
+// appear or disappear. A scrape asks for the changes after a sequence: the client keeps its own cursor, so that each client gets
+// its own deltas and the server keeps nothing per client. The last IPV_EXPORTER_REMOVALS removals are kept: a client whose cursor
+// is older than the first of them gets all the variables.
+//
+// An exporter_server answers one request per line, on a Unix domain socket:
+//   BINARY <epoch> <since>    the changes after since, in the binary format below
+//   TEXT <epoch> <since>      the same, in the Prometheus text format, ended by "# EOF"
+//   GET /metrics HTTP/1.0     all the variables, in the Prometheus text format, as an HTTP response (curl --unix-socket)
+// since 0, or an epoch which is not the one of the exporter (restarted), gives all the variables.
+// The answers are sent without blocking the server: each client has its own output, and is disconnected when it stops reading it.
+//
+// Binary format, in the byte order of the machine (the socket is local):
+//   header  u32 magic "IPVX", u32 flags (1: full), u64 epoch, u64 sequence, u32 values, u32 removed, u64 payload bytes
+//   value   u32 slot, u8 flags (1: named), [u8 name length, name, i32 type,] u32 size, value bytes
+//   removed u32 slot, u8 flags (2: removed)
+// The slot identifies the variable in the following scrapes: the name and the type are only sent the first time the client sees it.
+
+namespace ipv {
+
+    namespace exporter_detail {
+
+        const std::uint32_t magic = 0x58565049; // IPVX
+        const std::size_t headerSize = 40;
+
+        enum : std::uint8_t { named = 1, removed = 2 };
+        enum : std::uint32_t { full = 1 };
+
+        static_assert(variable_name_type::static_capacity <= 0xFF, "The names are sent with a u8 length");
+
+        template<typename T>
+        void Put(std::string& out, T v)
+        {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+        template<typename T>
+        T Get(const char*& p)
+        {
+            T v;
+            std::memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+            return v;
+        }
+
+        inline void WriteAll(int fd, const char* data, std::size_t size)
+        {
+            while (size != 0)
+            {
+                ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::runtime_error(std::string("Exporter socket write failed: ") + std::strerror(errno));
+                data += n;
+                size -= static_cast<std::size_t>(n);
+            }
+        }
+
+        inline void ReadAll(int fd, char* data, std::size_t size)
+        {
+            while (size != 0)
+            {
+                ssize_t n = recv(fd, data, size, 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::runtime_error("Exporter connection closed");
+                data += n;
+                size -= static_cast<std::size_t>(n);
+            }
+        }
+
+        inline sockaddr_un Address(const std::string& path)
+        {
+            sockaddr_un address;
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+                throw std::runtime_error("Exporter socket path too long: " + path);
+            std::memcpy(address.sun_path, path.c_str(), path.size());
+            return address;
+        }
+
+        // Prometheus metric name: [a-zA-Z_:][a-zA-Z0-9_:]*, the other characters become '_'
+        inline void AppendMetricName(std::string& out, boost::string_view name)
+        {
+            if (name.empty() || (name[0] >= '0' && name[0] <= '9'))
+                out += '_';
+            for (char c : name)
+                out += ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == ':') ? c : '_';
+        }
+
+        // One number of a value, as Prometheus reads it
+        inline void AppendNumber(std::string& out, value_kind kind, std::size_t elementSize, const unsigned char* p)
+        {
+            char text[32];
+            if (kind == value_kind::floating)
+            {
+                double d;
+                if (elementSize == sizeof(float))
+                {
+                    float f;
+                    std::memcpy(&f, p, sizeof(f));
+                    d = f;
+                }
+                else
+                    std::memcpy(&d, p, sizeof(d));
+                if (std::isnan(d))
+                    out += "NaN";
+                else if (std::isinf(d))
+                    out += d > 0 ? "+Inf" : "-Inf";
+                else
+                    out.append(text, std::snprintf(text, sizeof(text), "%.17g", d));
+                return;
+            }
+            std::uint64_t u = 0;
+            std::memcpy(&u, p, (std::min)(elementSize, sizeof(u))); // Little endian
+            if (kind == value_kind::signed_integer && elementSize < sizeof(u) && (u >> (8 * elementSize - 1)) != 0)
+                u |= ~static_cast<std::uint64_t>(0) << (8 * elementSize);
+            if (kind == value_kind::signed_integer)
+                out.append(text, std::snprintf(text, sizeof(text), "%lld", static_cast<long long>(u)));
+            else
+                out.append(text, std::snprintf(text, sizeof(text), "%llu", static_cast<unsigned long long>(u)));
+        }
+
+        inline bool IsNumber(value_kind kind)
+        {
+            return kind == value_kind::signed_integer || kind == value_kind::unsigned_integer || kind == value_kind::floating || kind == value_kind::boolean;
+        }
+    }
+
+
+    // Copy of the values of the variables of a domain, with the refresh sequence of their last change.
+    // Used by one thread at a time (the exporter_server thread).
+    class variables_exporter {
+    public:
+        explicit variables_exporter(SharedMemoryManager& v_manager = SharedMemoryManager::GetInstance())
+            : manager(v_manager), sequence(0), generation(0), epoch(0), pruned(0)
+        {
+            epoch = static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()) ^ (static_cast<std::uint64_t>(CurrentProcessId()) << 32);
+            if (epoch == 0)
+                epoch = 1;
+        }
+
+        // Compares the value of each variable with its copy: O(n), one memcmp per variable.
+        // The directory is visited again only when its generation changed (variables added or removed).
+        // Returns the new sequence.
+        std::uint64_t Refresh()
+        {
+            IPVarDirectory* pDirectory = manager.GetDirectory();
+            ++sequence;
+            if (pDirectory == nullptr)
+                return sequence;
+            if (slots.size() < pDirectory->Capacity())
+                slots.resize(pDirectory->Capacity());
+
+            std::uint64_t g = pDirectory->Generation();
+            if (sequence == 1 || g != generation)
+            {
+                generation = g;
+                std::vector<std::uint32_t> previous;
+                previous.swap(present);
+                pDirectory->Visit([&](std::size_t slot, const IPVarRecord& record) {
+                    present.push_back(static_cast<std::uint32_t>(slot));
+                    Update(static_cast<std::uint32_t>(slot), pDirectory->Hash(slot), record);
+                    });
+                for (std::uint32_t slot : previous)
+                {
+                    slot_state& s = slots[slot];
+                    if (s.seenAt != sequence)
+                    {
+                        s.removedAt = sequence;
+                        removals.push_back(removal{ slot, sequence, s.name });
+                    }
+                }
+                // The variables which came back in their slot are not removed anymore
+                removals.erase(std::remove_if(removals.begin(), removals.end(), [&](const removal& r) {
+                    return slots[r.slot].removedAt == 0 && slots[r.slot].name == r.name; }), removals.end());
+            }
+            else
+            {
+                for (std::uint32_t slot : present)
+                {
+                    if (pDirectory->IsReady(slot))
+                        Update(slot, pDirectory->Hash(slot), pDirectory->Record(slot));
+                }
+            }
+            Prune();
+            return sequence;
+        }
+
+        std::uint64_t Epoch() const { return epoch; }
+        std::uint64_t Sequence() const { return sequence; }
+        std::size_t Count() const { return present.size(); }
+
+        // The variables changed after the refresh since, and the ones removed, in the binary format.
+        // All the variables when since is 0 or fromEpoch is not the epoch of this exporter.
+        void WriteBinary(std::uint64_t fromEpoch, std::uint64_t since, std::string& out) const
+        {
+            using namespace exporter_detail;
+            bool isFull = IsFull(fromEpoch, since);
+            std::size_t start = out.size();
+            out.resize(start + headerSize);
+            std::uint32_t nbValues = 0, nbRemoved = 0;
+            for (std::uint32_t slot : present)
+            {
+                const slot_state& s = slots[slot];
+                if (!isFull && s.changedAt <= since)
+                    continue;
+                bool isNamed = isFull || s.createdAt > since;
+                Put<std::uint32_t>(out, slot);
+                Put<std::uint8_t>(out, isNamed ? static_cast<std::uint8_t>(named) : std::uint8_t(0));
+                if (isNamed)
+                {
+                    Put<std::uint8_t>(out, static_cast<std::uint8_t>(s.name.size()));
+                    out.append(s.name.data(), s.name.size());
+                    Put<std::int32_t>(out, s.type);
+                }
+                Put<std::uint32_t>(out, s.size);
+                out.append(&values[s.valueOffset], s.size);
+                nbValues++;
+            }
+            if (!isFull)
+            {
+                for (const removal& r : removals)
+                {
+                    // A slot given to another variable is renamed by its value
+                    if (r.at <= since || slots[r.slot].removedAt == 0)
+                        continue;
+                    Put<std::uint32_t>(out, r.slot);
+                    Put<std::uint8_t>(out, removed);
+                    nbRemoved++;
+                }
+            }
+
+            std::string header;
+            Put<std::uint32_t>(header, magic);
+            Put<std::uint32_t>(header, isFull ? static_cast<std::uint32_t>(full) : 0u);
+            Put<std::uint64_t>(header, epoch);
+            Put<std::uint64_t>(header, sequence);
+            Put<std::uint32_t>(header, nbValues);
+            Put<std::uint32_t>(header, nbRemoved);
+            Put<std::uint64_t>(header, out.size() - start - headerSize);
+            std::memcpy(&out[start], header.data(), headerSize);
+        }
+
+        // The same, in the Prometheus text format: one sample per number of the value (the fields of a struct are labels),
+        // the texts and the opaque types are skipped. "# HELP" and "# TYPE" come with the first sample of a variable for the client.
+        void WriteText(std::uint64_t fromEpoch, std::uint64_t since, std::string& out) const
+        {
+            using namespace exporter_detail;
+            bool isFull = IsFull(fromEpoch, since);
+            char text[96];
+            out.append(text, std::snprintf(text, sizeof(text), "# ipvar epoch=%llu sequence=%llu full=%d\n",
+                static_cast<unsigned long long>(epoch), static_cast<unsigned long long>(sequence), isFull ? 1 : 0));
+
+            const IPVarDirectory* pDirectory = manager.GetDirectory();
+            std::string metric;
+            for (std::uint32_t slot : present)
+            {
+                const slot_state& s = slots[slot];
+                if (!isFull && s.changedAt <= since)
+                    continue;
+                const IPVarTypeDescriptor* d = manager.TypeDescriptor(s.descriptor);
+                if (d == nullptr || d->nbFields == 0)
+                    continue;
+                metric.clear();
+                AppendMetricName(metric, boost::string_view(s.name.data(), s.name.size()));
+                if (isFull || s.createdAt > since)
+                {
+                    const variable_description_type& description = pDirectory->Description(slot);
+                    out += "# HELP ";
+                    out += metric;
+                    out += ' ';
+                    for (char c : description)
+                        out += (c == '\n') ? ' ' : c;
+                    out += "\n# TYPE ";
+                    out += metric;
+                    out += " gauge\n";
+                }
+                const unsigned char* value = reinterpret_cast<const unsigned char*>(&values[s.valueOffset]);
+                for (std::uint32_t i = 0; i < d->nbFields; ++i)
+                {
+                    const IPVarFieldDescriptor& f = d->Fields()[i];
+                    if (!IsNumber(f.kind))
+                        continue;
+                    for (std::uint16_t e = 0; e < f.count; ++e)
+                    {
+                        out += metric;
+                        std::size_t fieldLength = strnlen(f.name, sizeof(f.name));
+                        if (fieldLength != 0 || f.count > 1)
+                        {
+                            out += '{';
+                            if (fieldLength != 0)
+                            {
+                                out += "field=\"";
+                                out.append(f.name, fieldLength);
+                                out += '"';
+                            }
+                            if (f.count > 1)
+                                out.append(text, std::snprintf(text, sizeof(text), "%sindex=\"%u\"", fieldLength != 0 ? "," : "", static_cast<unsigned>(e)));
+                            out += '}';
+                        }
+                        out += ' ';
+                        AppendNumber(out, f.kind, f.size, value + f.offset + e * f.size);
+                        out += '\n';
+                    }
+                }
+            }
+            if (!isFull)
+            {
+                for (const removal& r : removals)
+                {
+                    if (r.at <= since)
+                        continue;
+                    out += "# REMOVED ";
+                    AppendMetricName(out, boost::string_view(r.name.data(), r.name.size()));
+                    out += '\n';
+                }
+            }
+            out += "# EOF\n";
+        }
+
+    private:
+        struct slot_state {
+            std::uint64_t changedAt;   // Refresh which saw the value change
+            std::uint64_t createdAt;   // Refresh which saw the variable appear
+            std::uint64_t removedAt;   // Refresh which saw the variable disappear, 0 while it exists
+            std::uint64_t seenAt;
+            std::uint64_t hash;        // Of the name: a slot can be given to another variable
+            variable_name_type name;
+            std::size_t varOffset;
+            std::size_t valueOffset;   // Of the copy, in values
+            std::uint32_t size;
+            std::uint32_t capacity;
+            std::int32_t type;
+            std::int32_t descriptor;
+
+            slot_state() : changedAt(0), createdAt(0), removedAt(0), seenAt(0), hash(0), varOffset(0), valueOffset(0), size(0), capacity(0), type(0), descriptor(-1) {}
+        };
+
+        // A variable removed, with its name: its slot may be given to another variable
+        struct removal {
+            std::uint32_t slot;
+            std::uint64_t at;
+            variable_name_type name;
+        };
+
+        // The removals are in the order of their refresh
+        bool IsFull(std::uint64_t fromEpoch, std::uint64_t since) const
+        {
+            return since == 0 || fromEpoch != epoch || since > sequence || since < pruned;
+        }
+
+        // Drops the oldest half of the removals, with all the ones of the same refresh
+        void Prune()
+        {
+            if (removals.size() <= IPV_EXPORTER_REMOVALS)
+                return;
+            pruned = removals[removals.size() / 2].at;
+            removals.erase(removals.begin(), std::upper_bound(removals.begin(), removals.end(), pruned,
+                [](std::uint64_t at, const removal& r) { return at < r.at; }));
+        }
+
+        void Update(std::uint32_t slot, std::uint64_t hash, const IPVarRecord& record)
+        {
+            slot_state& s = slots[slot];
+            const char* value = static_cast<const char*>(manager.OffsetToAddress(record.varOffset));
+            std::uint32_t size = static_cast<std::uint32_t>(record.varSize);
+            s.seenAt = sequence;
+            if (s.createdAt == 0 || s.removedAt != 0 || s.hash != hash || s.varOffset != record.varOffset || s.size != size)
+            {
+                // New variable, or another variable with the same name or in the same slot
+                if (s.createdAt != 0 && s.removedAt == 0 && s.hash != hash)
+                    removals.push_back(removal{ slot, sequence, s.name });
+                if (size > s.capacity)
+                {
+                    s.valueOffset = values.size();
+                    s.capacity = (size + 7) & ~7u;
+                    values.resize(values.size() + s.capacity);
+                }
+                s.createdAt = sequence;
+                s.changedAt = sequence;
+                s.removedAt = 0;
+                s.hash = hash;
+                s.name = record.name;
+                s.varOffset = record.varOffset;
+                s.size = size;
+                s.type = record.type;
+                s.descriptor = record.descriptor;
+                std::memcpy(&values[s.valueOffset], value, size);
+                return;
+            }
+            char* copy = &values[s.valueOffset];
+            if (std::memcmp(copy, value, size) != 0)
+            {
+                std::memcpy(copy, value, size);
+                s.changedAt = sequence;
+            }
+        }
+
+        SharedMemoryManager& manager;
+        std::vector<slot_state> slots;           // One per directory slot
+        std::vector<std::uint32_t> present;      // Slots of the variables seen by the last visit of the directory
+        std::vector<removal> removals;           // Variables removed after the refresh pruned
+        std::vector<char> values;
+        std::uint64_t sequence;
+        std::uint64_t generation;
+        std::uint64_t epoch;
+        std::uint64_t pruned;                    // Refresh of the last removal dropped: the scrapes since an older one are full
+    };
+
+
+    // Serves a variables_exporter on a Unix domain socket. The exporter is refreshed once per batch of requests.
+    // The sockets of the clients do not block: an answer the socket does not take at once is sent by the next calls of Serve.
+    class exporter_server {
+    public:
+        exporter_server(variables_exporter& v_exporter, const std::string& v_path) : exporter(v_exporter), path(v_path), listener(-1)
+        {
+            sockaddr_un address = exporter_detail::Address(path);
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0)
+                throw std::runtime_error(std::string("Exporter socket creation failed: ") + std::strerror(errno));
+            unlink(path.c_str());
+            if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+            {
+                int error = errno;
+                close(listener);
+                throw std::runtime_error("Exporter socket " + path + ": " + std::strerror(error));
+            }
+        }
+
+        ~exporter_server()
+        {
+            for (connection& c : connections)
+                close(c.fd);
+            close(listener);
+            unlink(path.c_str());
+        }
+
+        exporter_server(const exporter_server&) = delete;
+        exporter_server& operator=(const exporter_server&) = delete;
+
+        // Waits up to timeout for requests, answers them, and sends the pending answers
+        void Serve(std::chrono::milliseconds timeout)
+        {
+            std::vector<pollfd> fds(connections.size() + 1);
+            fds[0].fd = listener;
+            fds[0].events = POLLIN;
+            for (std::size_t i = 0; i < connections.size(); ++i)
+            {
+                // The next request of a client is read once its previous answer is sent
+                fds[i + 1].fd = connections[i].fd;
+                fds[i + 1].events = connections[i].output.empty() ? POLLIN : POLLOUT;
+            }
+            if (poll(fds.data(), fds.size(), static_cast<int>(timeout.count())) < 0)
+                return;
+
+            auto now = std::chrono::steady_clock::now();
+            std::vector<std::size_t> ready;
+            for (std::size_t i = 0; i < connections.size(); ++i)
+            {
+                connection& c = connections[i];
+                if (fds[i + 1].revents != 0)
+                {
+                    if (!c.output.empty())
+                        Send(c, now);
+                    else
+                        Receive(c);
+                }
+                if (!c.closed && c.output.empty() && c.input.find('\n') != std::string::npos)
+                    ready.push_back(i);
+                else if (!c.output.empty() && now - c.lastSend > std::chrono::milliseconds(IPV_EXPORTER_SEND_TIMEOUT_MS))
+                    c.closed = true; // A slow client must not hold the memory of its answers
+            }
+
+            if (!ready.empty())
+            {
+                exporter.Refresh();
+                for (std::size_t i : ready)
+                    Answer(connections[i], now);
+            }
+
+            for (std::size_t i = connections.size(); i-- > 0;)
+            {
+                if (connections[i].closed)
+                {
+                    close(connections[i].fd);
+                    connections.erase(connections.begin() + i);
+                }
+            }
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd >= 0)
+                {
+                    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0)
+                        connections.push_back(connection(fd));
+                    else
+                        close(fd);
+                }
+            }
+        }
+
+        // Serves until stop is set
+        void Run(const std::atomic<bool>& stop, std::chrono::milliseconds pollPeriod = std::chrono::milliseconds(100))
+        {
+            while (!stop.load())
+                Serve(pollPeriod);
+        }
+
+        const std::string& Path() const { return path; }
+
+    private:
+        struct connection {
+            int fd;
+            bool closed;
+            bool closeWhenSent;
+            std::string input;
+            std::string output;      // Answer not sent yet, from sent
+            std::size_t sent;
+            std::chrono::steady_clock::time_point lastSend;
+
+            explicit connection(int v_fd) : fd(v_fd), closed(false), closeWhenSent(false), sent(0), lastSend(std::chrono::steady_clock::now()) {}
+        };
+
+        void Receive(connection& c)
+        {
+            char buffer[512];
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n <= 0)
+                c.closed = true;
+            else
+            {
+                c.input.append(buffer, static_cast<std::size_t>(n));
+                if (c.input.size() > 4096)
+                    c.closed = true;
+            }
+        }
+
+        // Sends what the socket takes without blocking
+        void Send(connection& c, std::chrono::steady_clock::time_point now)
+        {
+            while (c.sent < c.output.size())
+            {
+                ssize_t n = send(c.fd, c.output.data() + c.sent, c.output.size() - c.sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return;
+                if (n <= 0)
+                {
+                    c.closed = true;
+                    return;
+                }
+                c.sent += static_cast<std::size_t>(n);
+                c.lastSend = now;
+            }
+            c.output.clear();
+            c.sent = 0;
+            if (c.closeWhenSent)
+                c.closed = true;
+        }
+
+        // Answers the requests received, until an answer is not sent at once
+        void Answer(connection& c, std::chrono::steady_clock::time_point now)
+        {
+            std::size_t end;
+            while (!c.closed && !c.closeWhenSent && c.output.empty() && (end = c.input.find('\n')) != std::string::npos)
+            {
+                std::string request = c.input.substr(0, end);
+                c.input.erase(0, end + 1);
+                unsigned long long fromEpoch = 0, since = 0;
+                std::string& output = c.output;
+                c.lastSend = now;
+                try {
+                    if (request.compare(0, 4, "GET ") == 0)
+                    {
+                        // One HTTP request per connection: the headers which follow are not read
+                        exporter.WriteText(0, 0, body);
+                        char header[160];
+                        output.append(header, std::snprintf(header, sizeof(header),
+                            "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body.size()));
+                        output += body;
+                        body.clear();
+                        c.closeWhenSent = true;
+                    }
+                    else if (std::sscanf(request.c_str(), "BINARY %llu %llu", &fromEpoch, &since) == 2)
+                        exporter.WriteBinary(fromEpoch, since, output);
+                    else if (std::sscanf(request.c_str(), "TEXT %llu %llu", &fromEpoch, &since) == 2)
+                        exporter.WriteText(fromEpoch, since, output);
+                    else
+                    {
+                        output = "# ERROR unknown request\n# EOF\n";
+                        c.closeWhenSent = true;
+                    }
+                }
+                catch (std::runtime_error&) {
+                    c.closed = true;
+                    return;
+                }
+                Send(c, now);
+            }
+        }
+
+        variables_exporter& exporter;
+        std::string path;
+        int listener;
+        std::vector<connection> connections;
+        std::string body;
+    };
+
+
+    // Client of an exporter_server. Keeps the values received, and the cursor of its next incremental scrape.
+    class exporter_client {
+    public:
+        struct value {
+            std::string name;
+            int type;
+            std::vector<char> bytes;
+        };
+
+        explicit exporter_client(const std::string& path) : fd(-1), epoch(0), sequence(0), textEpoch(0), textSequence(0)
+        {
+            sockaddr_un address = exporter_detail::Address(path);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+            {
+                int error = errno;
+                if (fd >= 0)
+                    close(fd);
+                throw std::runtime_error("Unable to connect to the exporter " + path + ": " + std::strerror(error));
+            }
+        }
+
+        ~exporter_client()
+        {
+            close(fd);
+        }
+
+        exporter_client(const exporter_client&) = delete;
+        exporter_client& operator=(const exporter_client&) = delete;
+
+        // Binary scrape of the changes since the previous one (of everything the first time), applied to Values().
+        // Returns the number of variables received: changed, added or removed.
+        std::size_t Fetch()
+        {
+            return Fetch([](const value&, bool) {});
+        }
+
+        // The same, calling f(const value&, bool isRemoved) for each variable received
+        template<typename F>
+        std::size_t Fetch(F&& f)
+        {
+            using namespace exporter_detail;
+            Request("BINARY", epoch, sequence);
+            char header[headerSize];
+            ReadAll(fd, header, headerSize);
+            const char* p = header;
+            if (Get<std::uint32_t>(p) != magic)
+                throw std::runtime_error("Exporter protocol error");
+            std::uint32_t flags = Get<std::uint32_t>(p);
+            epoch = Get<std::uint64_t>(p);
+            sequence = Get<std::uint64_t>(p);
+            std::uint32_t nbValues = Get<std::uint32_t>(p);
+            std::uint32_t nbRemoved = Get<std::uint32_t>(p);
+            payload.resize(static_cast<std::size_t>(Get<std::uint64_t>(p)));
+            ReadAll(fd, payload.data(), payload.size());
+
+            if (flags & full)
+                values.clear();
+            p = payload.data();
+            for (std::uint32_t i = 0; i < nbValues + nbRemoved; ++i)
+            {
+                std::uint32_t slot = Get<std::uint32_t>(p);
+                std::uint8_t entryFlags = Get<std::uint8_t>(p);
+                if (entryFlags & removed)
+                {
+                    auto it = values.find(slot);
+                    if (it != values.end())
+                    {
+                        f(it->second, true);
+                        values.erase(it);
+                    }
+                    continue;
+                }
+                value& v = values[slot];
+                if (entryFlags & named)
+                {
+                    std::uint8_t length = Get<std::uint8_t>(p);
+                    v.name.assign(p, length);
+                    p += length;
+                    v.type = Get<std::int32_t>(p);
+                }
+                std::uint32_t size = Get<std::uint32_t>(p);
+                v.bytes.assign(p, p + size);
+                p += size;
+                f(v, false);
+            }
+            return nbValues + nbRemoved;
+        }
+
+        // Prometheus text of the changes since the previous FetchText (of everything the first time)
+        std::string FetchText()
+        {
+            Request("TEXT", textEpoch, textSequence);
+            std::string text;
+            char buffer[65536];
+            while (text.size() < 6 || text.compare(text.size() - 6, 6, "# EOF\n") != 0)
+            {
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::runtime_error("Exporter connection closed");
+                text.append(buffer, static_cast<std::size_t>(n));
+            }
+            unsigned long long e = 0, s = 0;
+            if (std::sscanf(text.c_str(), "# ipvar epoch=%llu sequence=%llu", &e, &s) == 2)
+            {
+                textEpoch = e;
+                textSequence = s;
+            }
+            return text;
+        }
+
+        // The variables received, by slot
+        const std::unordered_map<std::uint32_t, value>& Values() const { return values; }
+
+        std::uint64_t Sequence() const { return sequence; }
+
+    private:
+        void Request(const char* format, std::uint64_t e, std::uint64_t since)
+        {
+            char request[80];
+            int n = std::snprintf(request, sizeof(request), "%s %llu %llu\n", format, static_cast<unsigned long long>(e), static_cast<unsigned long long>(since));
+            exporter_detail::WriteAll(fd, request, static_cast<std::size_t>(n));
+        }
+
+        int fd;
+        std::uint64_t epoch;
+        std::uint64_t sequence;
+        std::uint64_t textEpoch;
+        std::uint64_t textSequence;
+        std::vector<char> payload;
+        std::unordered_map<std::uint32_t, value> values;
+    };
+
+} // namespace ipv
+
+#endif // _WIN32
+
+#endif // _IPVAR_EXPORTER_H_
@@ -0,0 +1,178 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_HISTOGRAM_H_
+#define _IPVAR_HISTOGRAM_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace ipv {
+
+    namespace histogram_detail {
+        // Index of the highest bit set, v must not be 0
+        inline unsigned MostSignificantBit(std::uint64_t v)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanReverse64(&index, v);
+            return static_cast<unsigned>(index);
+#else
+            return 63u - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+        }
+    }
+
+
+    // Distribution of unsigned 64 bits values (typically latencies in ns or us) with log-linear buckets, like HdrHistogram:
+    // values below 2^SubBucketBits have their own bucket, and each power of two above is split in 2^SubBucketBits buckets.
+    // The relative error on a value is below 2^-SubBucketBits (6% with the default precision).
+    //
+    // Recording a value is a single relaxed increment of its bucket, from any thread of any process.
+    // Reading (Count, Percentile, AsString) loads all the buckets without lock: a value recorded concurrently may or may not be seen.
+    //
+    // Use it as the type of an interprocess variable: decl_ipv_variable(ipv::histogram, requestLatency);
+    template<unsigned SubBucketBits = 4>
+    struct basic_histogram {
+        static_assert(SubBucketBits >= 1 && SubBucketBits <= 16, "Unsupported histogram precision");
+
+        static constexpr std::size_t nbSubBuckets = std::size_t(1) << SubBucketBits;
+        static constexpr std::size_t nbBuckets = (65 - SubBucketBits) * nbSubBuckets;
+        // Percentiles copies the counts on the stack up to this number of buckets (8 KB), in a buffer of the thread above
+        static constexpr std::size_t maxStackBuckets = 1024;
+
+        basic_histogram()
+        {
+            for (std::size_t i = 0; i < nbBuckets; ++i)
+                new (&buckets[i]) std::atomic<std::uint64_t>(0);
+        }
+
+        void Record(std::uint64_t value) { buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed); }
+        void Record(std::uint64_t value, std::uint64_t count) { buckets[BucketIndex(value)].fetch_add(count, std::memory_order_relaxed); }
+
+        // Adds the values of another histogram, for instance the one of another process
+        void Merge(const basic_histogram& other)
+        {
+            for (std::size_t i = 0; i < nbBuckets; ++i)
+            {
+                std::uint64_t n = other.buckets[i].load(std::memory_order_relaxed);
+                if (n != 0)
+                    buckets[i].fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+
+        void Reset()
+        {
+            for (std::size_t i = 0; i < nbBuckets; ++i)
+                buckets[i].store(0, std::memory_order_relaxed);
+        }
+
+        std::uint64_t Count() const
+        {
+            std::uint64_t n = 0;
+            for (std::size_t i = 0; i < nbBuckets; ++i)
+                n += buckets[i].load(std::memory_order_relaxed);
+            return n;
+        }
+
+        // Value below which percentile % of the recorded values are (percentile in [0, 100]).
+        // Returns the highest value of the bucket, 0 if nothing was recorded.
+        std::uint64_t Percentile(double percentile) const
+        {
+            std::uint64_t value = 0;
+            Percentiles(&percentile, &value, 1);
+            return value;
+        }
+
+        // Several percentiles in a single pass over the buckets: percentiles must be sorted in increasing order
+        void Percentiles(const double* percentiles, std::uint64_t* values, std::size_t count) const
+        {
+            if (nbBuckets <= maxStackBuckets)
+            {
+                std::uint64_t counts[nbBuckets <= maxStackBuckets ? nbBuckets : 1];
+                PercentilesOf(counts, percentiles, values, count);
+            }
+            else
+            {
+                static thread_local std::vector<std::uint64_t> counts;
+                counts.resize(nbBuckets);
+                PercentilesOf(counts.data(), percentiles, values, count);
+            }
+        }
+
+        // n=<count> p50=<value> p99=<value> p999=<value>
+        std::string AsString() const
+        {
+            static const double percentiles[] = { 50.0, 99.0, 99.9 };
+            std::uint64_t values[3];
+            Percentiles(percentiles, values, 3);
+            char text[128];
+            std::snprintf(text, sizeof(text), "n=%llu p50=%llu p99=%llu p999=%llu", static_cast<unsigned long long>(Count()),
+                static_cast<unsigned long long>(values[0]), static_cast<unsigned long long>(values[1]), static_cast<unsigned long long>(values[2]));
+            return text;
+        }
+
+        static std::size_t BucketIndex(std::uint64_t value)
+        {
+            if (value < nbSubBuckets)
+                return static_cast<std::size_t>(value);
+            unsigned shift = histogram_detail::MostSignificantBit(value) - SubBucketBits;
+            return (shift + 1) * nbSubBuckets + static_cast<std::size_t>((value >> shift) - nbSubBuckets);
+        }
+
+        static std::uint64_t LowestValue(std::size_t index)
+        {
+            std::size_t group = index / nbSubBuckets;
+            std::uint64_t sub = index % nbSubBuckets;
+            return group == 0 ? sub : (nbSubBuckets + sub) << (group - 1);
+        }
+
+        static std::uint64_t HighestValue(std::size_t index)
+        {
+            return index + 1 < nbBuckets ? LowestValue(index + 1) - 1 : (std::numeric_limits<std::uint64_t>::max)();
+        }
+
+    private:
+        // The buckets are read once in counts, so that all the results come from the same state
+        void PercentilesOf(std::uint64_t* counts, const double* percentiles, std::uint64_t* values, std::size_t count) const
+        {
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i < nbBuckets; ++i)
+                total += counts[i] = buckets[i].load(std::memory_order_relaxed);
+
+            std::size_t bucket = 0;
+            std::uint64_t seen = 0;
+            for (std::size_t p = 0; p < count; ++p)
+            {
+                values[p] = 0;
+                if (total == 0)
+                    continue;
+                double rank = percentiles[p] / 100.0 * static_cast<double>(total);
+                std::uint64_t target = (std::max)(static_cast<std::uint64_t>(1), (std::min)(total, static_cast<std::uint64_t>(std::ceil(rank))));
+                while (bucket < nbBuckets && seen + counts[bucket] < target)
+                    seen += counts[bucket++];
+                values[p] = HighestValue(bucket);
+            }
+        }
+
+        std::atomic<std::uint64_t> buckets[nbBuckets];
+    };
+
+    typedef basic_histogram<> histogram;
+
+    template <> constexpr int TypeToInt< histogram >() { return 110; }
+
+} // namespace ipv
+
+#endif // _IPVAR_HISTOGRAM_H_
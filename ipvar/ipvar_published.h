@@ -0,0 +1,436 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_PUBLISHED_H_
+#define _IPVAR_PUBLISHED_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#include <set>
+#include <type_traits>
+#include <utility>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifndef IPV_PUBLISHED_READERS
+#define IPV_PUBLISHED_READERS 128  // Threads of all the processes reading a published variable
+#endif
+
+#ifndef IPV_PUBLISHED_RETIRED
+#define IPV_PUBLISHED_RETIRED 8  // Replaced versions waiting for their last readers, per published variable
+#endif
+
+#ifndef IPV_CACHE_LINE_SIZE
+#define IPV_CACHE_LINE_SIZE 64
+#endif
+
+// Large read-mostly objects (routing tables, configurations) shared without copy:
+//
+//   decl_ipv_published(RoutingTable, routes);
+//   routes.update([](RoutingTable& t) { t.entries[12] = ...; });   // Writer: builds a new version from a copy of the current one
+//
+//   auto table = routes.read();                                      // Reader: no lock, no copy
+//   Lookup(*table, address);                                         // The version stays valid until table is destroyed
+//
+// Each version is allocated in the segment. A writer publishes a new version by swapping an offset, and increments
+// the epoch of the variable. Each reading thread owns a slot, where it writes the epoch when it starts reading and 0 when
+// it is done. A replaced version is destroyed once no slot holds an epoch older than its replacement.
+// Reading never waits: it is a load and a store of the epoch, and a load of the offset.
+// At most IPV_PUBLISHED_RETIRED replaced versions are kept: beyond, the writer waits for the readers.
+// The slots of the processes that are gone are reclaimed. T must be usable in shared memory (no pointers to the heap).
+
+namespace ipv {
+
+    namespace published_detail {
+
+        struct alignas(IPV_CACHE_LINE_SIZE) reader_slot {
+            reader_slot() : epoch(0), owner(0) {}
+            std::atomic<std::uint64_t> epoch;  // Epoch when the owner started reading, 0 when it is not reading
+            std::atomic<std::uint64_t> owner;  // Process id << 32 | thread number in the process, 0 when free
+        };
+
+        struct retired_version {
+            std::uint64_t offset;  // Offset + 1 of the version, 0 when empty
+            std::uint64_t epoch;   // First epoch which does not use it
+        };
+
+        inline std::uint32_t ProcessOf(std::uint64_t owner) { return static_cast<std::uint32_t>(owner >> 32); }
+
+        // The published variables alive in the process, so that a thread which ends only releases the slots
+        // of the variables that still exist.
+        struct registry {
+            static registry& GetInstance()
+            {
+                static registry instance;
+                return instance;
+            }
+
+#ifndef _WIN32
+            // The child of a fork must not share the slots of its parent
+            registry()
+            {
+                pthread_atfork([]() { GetInstance().mutex.lock(); }, []() { GetInstance().mutex.unlock(); }, &AfterFork);
+            }
+
+            static void AfterFork();
+#endif
+
+            std::mutex mutex;
+            std::set<std::uint64_t> alive;
+            std::uint64_t nextId = 1;
+            std::uint32_t nextThread = 1;
+        };
+
+        // Slots owned by the calling thread
+        struct thread_slots {
+            struct entry {
+                std::uint64_t id;
+                reader_slot* pSlot;
+                int depth;
+            };
+
+            thread_slots()
+            {
+                registry& r = registry::GetInstance();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                owner = (static_cast<std::uint64_t>(CurrentProcessId()) << 32) | r.nextThread++;
+            }
+
+            ~thread_slots()
+            {
+                registry& r = registry::GetInstance();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                for (entry& e : entries)
+                {
+                    if (r.alive.count(e.id) != 0)
+                    {
+                        e.pSlot->epoch.store(0, std::memory_order_release);
+                        e.pSlot->owner.store(0, std::memory_order_release);
+                    }
+                }
+            }
+
+            entry* Find(std::uint64_t id)
+            {
+                for (entry& e : entries)
+                    if (e.id == id)
+                        return &e;
+                return nullptr;
+            }
+
+            std::uint64_t owner;
+            std::vector<entry> entries;
+        };
+
+        inline thread_slots& CurrentThread()
+        {
+            static thread_local thread_slots slots;
+            return slots;
+        }
+
+#ifndef _WIN32
+        inline void registry::AfterFork()
+        {
+            registry& r = GetInstance();
+            r.mutex.unlock();
+            thread_slots& t = CurrentThread();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            t.owner = (static_cast<std::uint64_t>(CurrentProcessId()) << 32) | r.nextThread++;
+            t.entries.clear();
+        }
+#endif
+
+
+        // Storage of a published variable. Destroyed with the variable, it destroys the versions left.
+        template<typename T>
+        struct state {
+            state() : current(0), epoch(1), writer(0), nbRetired(0)
+            {
+                for (retired_version& r : retired)
+                    r = retired_version{ 0, 0 };
+            }
+
+            ~state()
+            {
+                for (std::uint32_t i = 0; i < nbRetired; ++i)
+                    Destroy(retired[i].offset);
+                Destroy(current.load());
+            }
+
+            static T* Version(std::uint64_t offset)
+            {
+                return offset != 0 ? static_cast<T*>(SharedMemoryManager::GetInstance().OffsetToAddress(static_cast<size_t>(offset - 1))) : nullptr;
+            }
+
+            static void Destroy(std::uint64_t offset)
+            {
+                if (T* p = Version(offset))
+                {
+                    p->~T();
+                    deallocate_shared_memory(p);
+                }
+            }
+
+            std::atomic<std::uint64_t> current;  // Offset + 1 of the current version, 0 before the first publication
+            std::atomic<std::uint64_t> epoch;
+            std::atomic<std::uint32_t> writer;   // Process id of the writer publishing a version, 0 if none
+            std::uint32_t nbRetired;
+            retired_version retired[IPV_PUBLISHED_RETIRED];
+            reader_slot readers[IPV_PUBLISHED_READERS];
+        };
+    }
+
+
+    template<typename T>
+    class published {
+        typedef published_detail::state<T> state_type;
+
+    public:
+        // Keeps a version alive while it is read. Readers of the same variable can be nested in a thread.
+        class reader {
+        public:
+            reader(reader&& other) noexcept : owner(other.owner), value(other.value) { other.owner = nullptr; }
+            reader(const reader&) = delete;
+            reader& operator=(const reader&) = delete;
+            ~reader() { if (owner != nullptr) owner->EndRead(); }
+
+            // nullptr before the first publication
+            const T* get() const { return value; }
+            const T* operator->() const { return value; }
+            const T& operator*() const { return *value; }
+            explicit operator bool() const { return value != nullptr; }
+
+        private:
+            friend class published;
+            reader(const published* v_owner, const T* v_value) : owner(v_owner), value(v_value) {}
+            const published* owner;
+            const T* value;
+        };
+
+        published(const hashed_name& varName, int varType, bool isPersistant, const char* varDescription)
+            : var(varName, varType, isPersistant, varDescription)
+        {
+            published_detail::registry& r = published_detail::registry::GetInstance();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            id = r.nextId++;
+            r.alive.insert(id);
+        }
+
+        ~published()
+        {
+            // The slots of the threads of this process
+            published_detail::registry& r = published_detail::registry::GetInstance();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.alive.erase(id);
+            for (published_detail::reader_slot& slot : state().readers)
+            {
+                if (published_detail::ProcessOf(slot.owner.load()) == CurrentProcessId())
+                {
+                    slot.epoch.store(0);
+                    slot.owner.store(0);
+                }
+            }
+        }
+
+        reader read() const
+        {
+            BeginRead();
+            return reader(this, state_type::Version(state().current.load(std::memory_order_seq_cst)));
+        }
+
+        // Calls f(const T*) on the current version, nullptr before the first publication, and returns its result
+        template<typename F>
+        auto read_with(F&& f) const -> decltype(f(std::declval<const T*>()))
+        {
+            reader r = read();
+            return f(r.get());
+        }
+
+        // Publishes a copy of v
+        void publish(const T& v)
+        {
+            T* p = Allocate();
+            new (p) T(v);
+            Publish(p);
+        }
+
+        // Publishes a version built from args
+        template<typename... Args>
+        void emplace(Args&&... args)
+        {
+            T* p = Allocate();
+            new (p) T(std::forward<Args>(args)...);
+            Publish(p);
+        }
+
+        // Publishes a copy of the current version (or a default constructed one) modified by f(T&).
+        // The writers are serialized: concurrent updates are not lost.
+        template<typename F>
+        void update(F&& f)
+        {
+            WriterLock lock(*this);
+            T* p = Allocate();
+            if (const T* pCurrent = state_type::Version(state().current.load()))
+                new (p) T(*pCurrent);
+            else
+                new (p) T();
+            f(*p);
+            Swap(p);
+        }
+
+        // Incremented by each publication
+        std::uint64_t epoch() const { return state().epoch.load(std::memory_order_acquire); }
+
+        // Replaced versions not destroyed yet
+        std::uint32_t retired() const { return state().nbRetired; }
+
+        bool IsMine() const { return var.IsMine(); }
+
+        bool IsPersistant() const { return var.IsPersistant(); }
+
+    private:
+        // Serializes the writers of all the processes. The lock of a process which is gone is taken over.
+        struct WriterLock {
+            explicit WriterLock(published& v_owner) : owner(v_owner)
+            {
+                std::uint32_t me = CurrentProcessId();
+                std::atomic<std::uint32_t>& writer = owner.state().writer;
+                std::uint32_t holder = 0;
+                while (!writer.compare_exchange_weak(holder, me, std::memory_order_acquire))
+                {
+                    if (holder != 0 && holder != me && !IsProcessAlive(holder))
+                        continue; // holder is gone: the CAS takes over its lock
+                    holder = 0;
+                    std::this_thread::yield();
+                }
+            }
+            ~WriterLock() { owner.state().writer.store(0, std::memory_order_release); }
+            published& owner;
+        };
+
+        state_type& state() const { return *static_cast<state_type*>(var); }
+
+        static T* Allocate()
+        {
+            static_assert(alignof(T) <= alignof(std::max_align_t), "published<T> does not support over-aligned types");
+            // Plain data can go to an extension. The containers of ipvar_slab.h hold offset_ptr: they stay in the initial segment.
+            return static_cast<T*>(std::is_trivially_copyable<T>::value ? allocate_extensible_shared_memory(sizeof(T)) : allocate_shared_memory(sizeof(T)));
+        }
+
+        void Publish(T* p)
+        {
+            WriterLock lock(*this);
+            Swap(p);
+        }
+
+        // Called with the writer lock
+        void Swap(T* p)
+        {
+            state_type& s = state();
+            std::uint64_t offset = SharedMemoryManager::GetInstance().AddressToOffset(p) + 1;
+            std::uint64_t old = s.current.exchange(offset, std::memory_order_seq_cst);
+            std::uint64_t next = s.epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+            if (old != 0)
+            {
+                while (s.nbRetired == IPV_PUBLISHED_RETIRED)
+                {
+                    Reclaim(true);
+                    if (s.nbRetired == IPV_PUBLISHED_RETIRED)
+                        std::this_thread::yield();
+                }
+                s.retired[s.nbRetired++] = published_detail::retired_version{ old, next };
+            }
+            Reclaim(false);
+        }
+
+        // Destroys the replaced versions no reader can use anymore. When waiting, frees the slots of the processes that are gone.
+        void Reclaim(bool waiting)
+        {
+            state_type& s = state();
+            std::uint64_t oldest = ~static_cast<std::uint64_t>(0);
+            for (published_detail::reader_slot& slot : s.readers)
+            {
+                std::uint64_t e = slot.epoch.load(std::memory_order_seq_cst);
+                if (e == 0)
+                    continue;
+                if (waiting && !IsProcessAlive(published_detail::ProcessOf(slot.owner.load())))
+                {
+                    slot.epoch.store(0);
+                    slot.owner.store(0);
+                    continue;
+                }
+                oldest = (std::min)(oldest, e);
+            }
+
+            std::uint32_t kept = 0;
+            for (std::uint32_t i = 0; i < s.nbRetired; ++i)
+            {
+                if (s.retired[i].epoch <= oldest)
+                    state_type::Destroy(s.retired[i].offset);
+                else
+                    s.retired[kept++] = s.retired[i];
+            }
+            s.nbRetired = kept;
+        }
+
+        void BeginRead() const
+        {
+            published_detail::thread_slots& t = published_detail::CurrentThread();
+            published_detail::thread_slots::entry* e = t.Find(id);
+            if (e == nullptr)
+                e = Claim(t);
+            if (e->depth++ == 0)
+                e->pSlot->epoch.store(state().epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+        }
+
+        void EndRead() const
+        {
+            published_detail::thread_slots::entry* e = published_detail::CurrentThread().Find(id);
+            if (--e->depth == 0)
+                e->pSlot->epoch.store(0, std::memory_order_release);
+        }
+
+        // First read of the thread: takes a free slot, or the slot of a process that is gone
+        published_detail::thread_slots::entry* Claim(published_detail::thread_slots& t) const
+        {
+            for (int attempt = 0; attempt < 2; ++attempt)
+            {
+                for (published_detail::reader_slot& slot : state().readers)
+                {
+                    std::uint64_t owner = slot.owner.load();
+                    if (owner != 0 && (attempt == 0 || IsProcessAlive(published_detail::ProcessOf(owner))))
+                        continue;
+                    if (slot.owner.compare_exchange_strong(owner, t.owner))
+                    {
+                        slot.epoch.store(0);
+                        published_detail::registry& r = published_detail::registry::GetInstance();
+                        std::lock_guard<std::mutex> lock(r.mutex);
+                        t.entries.push_back(published_detail::thread_slots::entry{ id, &slot, 0 });
+                        return &t.entries.back();
+                    }
+                }
+            }
+            throw std::runtime_error("Too many threads reading a published variable, see IPV_PUBLISHED_READERS");
+        }
+
+        mutable variable<state_type> var;
+        std::uint64_t id;
+    };
+
+} // namespace ipv
+
+
+// decl_ipv_published.. macros follow the decl_ipv_variable.. ones.
+
+#define decl_ipv_published(type,name) ipv::published<type> name(IPV_NAME(#name), ipv::TypeToInt<ipv::published_detail::state<type>>(),false,#name)
+#define decl_pipv_published(type,name) ipv::published<type> name(IPV_NAME(#name), ipv::TypeToInt<ipv::published_detail::state<type>>(),true,#name)
+
+#define decl_ipv_published_2(type,name,desc) ipv::published<type> name(IPV_NAME(#name), ipv::TypeToInt<ipv::published_detail::state<type>>(),false,desc)
+#define decl_pipv_published_2(type,name,desc) ipv::published<type> name(IPV_NAME(#name), ipv::TypeToInt<ipv::published_detail::state<type>>(),true,desc)
+
+#endif // _IPVAR_PUBLISHED_H_
@@ -0,0 +1,318 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_QUEUE_H_
+#define _IPVAR_QUEUE_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#include <type_traits>
+
+// Bounded lock-free queues to be used as interprocess variables:
+//
+//   typedef ipv::spsc_queue<AuditEvent, 4096> AuditQueue;   // The macros do not accept a type with a comma
+//   decl_ipv_variable(AuditQueue, auditEvents);
+//   (*auditEvents).try_push(event);
+//
+// The indices written by the producers and by the consumers are on separate cache lines.
+// Pushing and popping never make a system call, except to wake up a consumer or producer blocked in a *_wait method.
+
+namespace ipv {
+
+    namespace queue_detail {
+        template<std::size_t N>
+        struct check_capacity {
+            static_assert(N >= 2 && (N & (N - 1)) == 0, "The capacity of a queue must be a power of two");
+            static_assert(N <= (1u << 30), "The capacity of a queue must fit in 30 bits");
+        };
+
+        // Blocks on word while it equals expected, counting the waiter so that the other side knows it must wake it up
+        inline bool Wait(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::atomic<std::uint32_t>& nbWaiters, std::chrono::nanoseconds timeout)
+        {
+            nbWaiters++;
+            bool changed = WaitOnWord(&word, expected, timeout);
+            nbWaiters--;
+            return changed;
+        }
+
+        inline void Wake(std::atomic<std::uint32_t>& word, std::atomic<std::uint32_t>& nbWaiters)
+        {
+            if (nbWaiters.load() != 0)
+                WakeWord(&word);
+        }
+    }
+
+
+    // Single producer, single consumer queue of N elements (N must be a power of two).
+    template<typename T, std::size_t N>
+    struct spsc_queue : private queue_detail::check_capacity<N> {
+        static_assert(std::is_trivially_copyable<T>::value, "Queue elements are copied in shared memory: they must be trivially copyable");
+
+        spsc_queue() : head(0), cachedTail(0), consumerWaiters(0), tail(0), cachedHead(0), producerWaiters(0) {}
+
+        bool try_push(const T& v) { return push_n(&v, 1) == 1; }
+
+        // Pushes up to n elements, returns the number pushed
+        std::size_t push_n(const T* items, std::size_t n)
+        {
+            std::uint32_t t = tail.load(std::memory_order_relaxed);
+            std::uint32_t room = static_cast<std::uint32_t>(N) - (t - cachedHead);
+            if (room < n)
+            {
+                cachedHead = head.load(std::memory_order_acquire);
+                room = static_cast<std::uint32_t>(N) - (t - cachedHead);
+            }
+            std::size_t count = (std::min)(n, static_cast<std::size_t>(room));
+            for (std::size_t i = 0; i < count; ++i)
+                buffer[(t + i) & (N - 1)] = items[i];
+            if (count != 0)
+            {
+                tail.store(t + static_cast<std::uint32_t>(count), std::memory_order_seq_cst);
+                queue_detail::Wake(tail, consumerWaiters);
+            }
+            return count;
+        }
+
+        bool try_pop(T& v) { return pop_n(&v, 1) == 1; }
+
+        // Pops up to max elements, returns the number popped
+        std::size_t pop_n(T* items, std::size_t max)
+        {
+            std::uint32_t h = head.load(std::memory_order_relaxed);
+            std::uint32_t available = cachedTail - h;
+            if (available < max)
+            {
+                cachedTail = tail.load(std::memory_order_acquire);
+                available = cachedTail - h;
+            }
+            std::size_t count = (std::min)(max, static_cast<std::size_t>(available));
+            for (std::size_t i = 0; i < count; ++i)
+                items[i] = buffer[(h + i) & (N - 1)];
+            if (count != 0)
+            {
+                head.store(h + static_cast<std::uint32_t>(count), std::memory_order_seq_cst);
+                queue_detail::Wake(head, producerWaiters);
+            }
+            return count;
+        }
+
+        // Blocking versions: wait until the operation is possible or the timeout expires
+        template<typename Rep, typename Period>
+        bool push_wait(const T& v, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            for (;;)
+            {
+                std::uint32_t h = head.load(std::memory_order_seq_cst);
+                if (try_push(v))
+                    return true;
+                if (!queue_detail::Wait(head, h, producerWaiters, deadline - std::chrono::steady_clock::now()) && std::chrono::steady_clock::now() >= deadline)
+                    return try_push(v);
+            }
+        }
+
+        template<typename Rep, typename Period>
+        std::size_t pop_n_wait(T* items, std::size_t max, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            for (;;)
+            {
+                std::uint32_t t = tail.load(std::memory_order_seq_cst);
+                if (std::size_t count = pop_n(items, max))
+                    return count;
+                if (!queue_detail::Wait(tail, t, consumerWaiters, deadline - std::chrono::steady_clock::now()) && std::chrono::steady_clock::now() >= deadline)
+                    return pop_n(items, max);
+            }
+        }
+
+        template<typename Rep, typename Period>
+        bool pop_wait(T& v, const std::chrono::duration<Rep, Period>& timeout) { return pop_n_wait(&v, 1, timeout) == 1; }
+
+        std::size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+        bool empty() const { return size() == 0; }
+        static constexpr std::size_t capacity() { return N; }
+
+        std::string AsString() const { return std::to_string(size()) + "/" + std::to_string(N); }
+
+    private:
+        // Consumer side
+        alignas(IPV_CACHE_LINE_SIZE) std::atomic<std::uint32_t> head;
+        std::uint32_t cachedTail;
+        std::atomic<std::uint32_t> consumerWaiters;
+
+        // Producer side
+        alignas(IPV_CACHE_LINE_SIZE) std::atomic<std::uint32_t> tail;
+        std::uint32_t cachedHead;
+        std::atomic<std::uint32_t> producerWaiters;
+
+        alignas(IPV_CACHE_LINE_SIZE) T buffer[N];
+    };
+
+
+    // Multiple producers, multiple consumers queue of N elements (N must be a power of two).
+    // Each cell carries a sequence number telling whether it is ready to be written or read (D. Vyukov's bounded queue).
+    template<typename T, std::size_t N>
+    struct mpmc_queue : private queue_detail::check_capacity<N> {
+        static_assert(std::is_trivially_copyable<T>::value, "Queue elements are copied in shared memory: they must be trivially copyable");
+
+        mpmc_queue() : enqueuePos(0), consumerWaiters(0), pushSignal(0), dequeuePos(0), producerWaiters(0), popSignal(0)
+        {
+            for (std::size_t i = 0; i < N; ++i)
+                cells[i].sequence.store(static_cast<std::uint32_t>(i), std::memory_order_relaxed);
+        }
+
+        bool try_push(const T& v)
+        {
+            std::uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                cell& c = cells[pos & (N - 1)];
+                std::int32_t diff = static_cast<std::int32_t>(c.sequence.load(std::memory_order_acquire) - pos);
+                if (diff == 0)
+                {
+                    if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        c.value = v;
+                        c.sequence.store(pos + 1, std::memory_order_seq_cst);
+                        Signal(pushSignal, consumerWaiters);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false; // Full
+                else
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        bool try_pop(T& v)
+        {
+            std::uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                cell& c = cells[pos & (N - 1)];
+                std::int32_t diff = static_cast<std::int32_t>(c.sequence.load(std::memory_order_acquire) - (pos + 1));
+                if (diff == 0)
+                {
+                    if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        v = c.value;
+                        c.sequence.store(pos + static_cast<std::uint32_t>(N), std::memory_order_seq_cst);
+                        Signal(popSignal, producerWaiters);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false; // Empty
+                else
+                    pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Batches: each element is claimed on its own, so that concurrent producers or consumers interleave freely
+        std::size_t push_n(const T* items, std::size_t n)
+        {
+            std::size_t count = 0;
+            while (count < n && try_push(items[count]))
+                count++;
+            return count;
+        }
+
+        std::size_t pop_n(T* items, std::size_t max)
+        {
+            std::size_t count = 0;
+            while (count < max && try_pop(items[count]))
+                count++;
+            return count;
+        }
+
+        template<typename Rep, typename Period>
+        bool push_wait(const T& v, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return Blocking(popSignal, producerWaiters, std::chrono::steady_clock::now() + timeout, [&]() { return try_push(v); });
+        }
+
+        template<typename Rep, typename Period>
+        bool pop_wait(T& v, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            return Blocking(pushSignal, consumerWaiters, std::chrono::steady_clock::now() + timeout, [&]() { return try_pop(v); });
+        }
+
+        template<typename Rep, typename Period>
+        std::size_t pop_n_wait(T* items, std::size_t max, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            if (max == 0 || !pop_wait(items[0], timeout))
+                return 0;
+            return 1 + pop_n(items + 1, max - 1);
+        }
+
+        // Approximate when producers or consumers are running
+        std::size_t size() const
+        {
+            std::int32_t n = static_cast<std::int32_t>(enqueuePos.load(std::memory_order_acquire) - dequeuePos.load(std::memory_order_acquire));
+            return n < 0 ? 0 : (std::min)(static_cast<std::size_t>(n), N);
+        }
+        bool empty() const { return size() == 0; }
+        static constexpr std::size_t capacity() { return N; }
+
+        std::string AsString() const { return std::to_string(size()) + "/" + std::to_string(N); }
+
+    private:
+        // The positions move before the cells are written or read, so they cannot be waited on:
+        // the signal words are only bumped when someone waits on them.
+        // The cell sequence is stored seq_cst before reading the number of waiters, and a waiter registers itself before trying again:
+        // either the waiter sees the cell, or the other side sees the waiter.
+        static void Signal(std::atomic<std::uint32_t>& signal, std::atomic<std::uint32_t>& nbWaiters)
+        {
+            if (nbWaiters.load(std::memory_order_seq_cst) != 0)
+            {
+                signal.fetch_add(1);
+                WakeWord(&signal);
+            }
+        }
+
+        template<typename Operation>
+        static bool Blocking(std::atomic<std::uint32_t>& signal, std::atomic<std::uint32_t>& nbWaiters, std::chrono::steady_clock::time_point deadline, Operation operation)
+        {
+            for (;;)
+            {
+                if (operation())
+                    return true;
+                std::uint32_t s = signal.load();
+                nbWaiters++;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool done = operation();
+                if (!done)
+                    WaitOnWord(&signal, s, deadline - std::chrono::steady_clock::now());
+                nbWaiters--;
+                if (done)
+                    return true;
+                if (std::chrono::steady_clock::now() >= deadline)
+                    return operation();
+            }
+        }
+
+        struct cell {
+            std::atomic<std::uint32_t> sequence;
+            T value;
+        };
+
+        // Written by the producers, consumerWaiters and pushSignal only when a consumer blocks
+        alignas(IPV_CACHE_LINE_SIZE) std::atomic<std::uint32_t> enqueuePos;
+        std::atomic<std::uint32_t> consumerWaiters;
+        std::atomic<std::uint32_t> pushSignal;
+
+        // Written by the consumers, producerWaiters and popSignal only when a producer blocks
+        alignas(IPV_CACHE_LINE_SIZE) std::atomic<std::uint32_t> dequeuePos;
+        std::atomic<std::uint32_t> producerWaiters;
+        std::atomic<std::uint32_t> popSignal;
+
+        alignas(IPV_CACHE_LINE_SIZE) cell cells[N];
+    };
+
+} // namespace ipv
+
+#endif // _IPVAR_QUEUE_H_
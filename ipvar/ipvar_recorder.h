@@ -0,0 +1,679 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_RECORDER_H_
+#define _IPVAR_RECORDER_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+#include "ipvar_counter.h"
+#include "ipvar_histogram.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// History of the values of a set of variables.
+//
+// A history_recorder samples the selected variables at a fixed period, from its own thread (Start) or when asked (SampleOnce),
+// and appends one frame per sample to a history ring. The ring lives in the shared memory (history_buffer, declared as a variable),
+// and optionally in a memory mapped file which survives the processes (SpillTo, read back with history_file).
+//
+// A frame holds one varint per variable: the difference with the previous frame for integers,
+// the xor of the bits with the previous frame for floating point values. Every keyframeInterval frames, a key frame holds the values
+// themselves, so that a reader can start decoding there. Readers never block the recorder: they copy the frames, then check that
+// the recorder did not overwrite them in the meantime.
+
+namespace ipv {
+
+    // One sampled variable, as described in the schema of a history ring
+    struct history_series {
+        enum kind_type : std::uint8_t { integer = 0, floating = 1 };
+
+        std::string name;
+        int type;
+        kind_type kind;
+
+        // Value of a decoded sample
+        static double AsDouble(kind_type kind, std::uint64_t raw)
+        {
+            if (kind == integer)
+                return static_cast<double>(static_cast<std::int64_t>(raw));
+            double d;
+            std::memcpy(&d, &raw, sizeof(d));
+            return d;
+        }
+
+        double AsDouble(std::uint64_t raw) const { return AsDouble(kind, raw); }
+    };
+
+
+    namespace history_detail {
+
+        const std::uint32_t magic = 0x49505648; // IPVH
+
+        struct header {
+            std::uint32_t magic;
+            std::uint32_t dataCapacity;   // Power of two
+            std::uint32_t indexCapacity;  // Power of two
+            std::uint32_t schemaCapacity;
+            std::atomic<std::uint32_t> schemaSequence; // Odd while the schema is written
+            std::atomic<std::uint32_t> schemaSize;
+            std::atomic<std::uint64_t> nbFrames;       // Frames published
+            std::atomic<std::uint64_t> reserved;       // Bytes written or being written
+        };
+
+        // frame is number + 1 of the frame once it is complete, 0 while it is written
+        struct index_entry {
+            std::atomic<std::uint64_t> frame;
+            std::atomic<std::int64_t> timestamp;
+            std::atomic<std::uint64_t> offset;
+            std::atomic<std::uint32_t> length;
+            std::atomic<std::uint32_t> schemaStamp;
+            std::atomic<std::uint32_t> isKey;
+        };
+
+        constexpr std::size_t AlignUp(std::size_t v) { return (v + 63) & ~static_cast<std::size_t>(63); }
+
+        inline void PutVarint(std::vector<char>& out, std::uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                out.push_back(static_cast<char>(v | 0x80));
+                v >>= 7;
+            }
+            out.push_back(static_cast<char>(v));
+        }
+
+        inline bool GetVarint(const char*& p, const char* end, std::uint64_t& v)
+        {
+            v = 0;
+            for (unsigned shift = 0; p != end && shift < 64; shift += 7)
+            {
+                std::uint8_t b = static_cast<std::uint8_t>(*p++);
+                v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+                if ((b & 0x80) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+        inline std::uint64_t ZigZag(std::int64_t v) { return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63); }
+        inline std::int64_t UnZigZag(std::uint64_t v) { return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1); }
+
+        inline bool IsPowerOfTwo(std::size_t v) { return v != 0 && (v & (v - 1)) == 0; }
+    }
+
+
+    // View on a history ring: a header, the schema, the frame index and the frame data, in one block of memory.
+    // A single recorder may append to a ring, any number of readers may read it at the same time.
+    class history_ring {
+    public:
+        history_ring() : pHeader(nullptr) {}
+
+        explicit history_ring(void* block) : pHeader(static_cast<history_detail::header*>(block))
+        {
+            if (pHeader->magic != history_detail::magic)
+                throw std::runtime_error("Not a history ring");
+        }
+
+        // Size of the block holding a ring. dataBytes and indexEntries must be powers of two.
+        static std::size_t Bytes(std::size_t dataBytes, std::size_t indexEntries, std::size_t schemaBytes)
+        {
+            return history_detail::AlignUp(sizeof(history_detail::header)) + history_detail::AlignUp(schemaBytes)
+                + indexEntries * sizeof(history_detail::index_entry) + dataBytes;
+        }
+
+        // Creates an empty ring in a block of Bytes(dataBytes, indexEntries, schemaBytes) bytes
+        static history_ring Initialize(void* block, std::size_t dataBytes, std::size_t indexEntries, std::size_t schemaBytes)
+        {
+            if (!history_detail::IsPowerOfTwo(dataBytes) || !history_detail::IsPowerOfTwo(indexEntries))
+                throw std::runtime_error("History ring capacities must be powers of two");
+
+            history_detail::header* h = new (block) history_detail::header;
+            h->dataCapacity = static_cast<std::uint32_t>(dataBytes);
+            h->indexCapacity = static_cast<std::uint32_t>(indexEntries);
+            h->schemaCapacity = static_cast<std::uint32_t>(schemaBytes);
+            h->schemaSequence.store(0);
+            h->schemaSize.store(0);
+            h->nbFrames.store(0);
+            h->reserved.store(0);
+
+            history_ring ring;
+            ring.pHeader = h;
+            for (std::size_t i = 0; i < indexEntries; ++i)
+            {
+                history_detail::index_entry* e = new (&ring.Entry(i)) history_detail::index_entry;
+                e->frame.store(0);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            h->magic = history_detail::magic;
+            return ring;
+        }
+
+        bool IsValid() const { return pHeader != nullptr; }
+
+        std::size_t DataCapacity() const { return pHeader->dataCapacity; }
+        std::size_t IndexCapacity() const { return pHeader->indexCapacity; }
+        std::uint64_t NbFrames() const { return pHeader->nbFrames.load(std::memory_order_acquire); }
+
+        // Writer side
+
+        // Replaces the schema. The frames appended before no longer match it, and are ignored by the readers.
+        // Returns the stamp to give to Append.
+        std::uint32_t WriteSchema(const std::vector<history_series>& series)
+        {
+            std::vector<char> bytes;
+            for (const history_series& s : series)
+            {
+                bytes.push_back(static_cast<char>(s.kind));
+                std::int32_t type = s.type;
+                std::uint16_t length = static_cast<std::uint16_t>(s.name.size());
+                bytes.insert(bytes.end(), reinterpret_cast<const char*>(&type), reinterpret_cast<const char*>(&type) + sizeof(type));
+                bytes.insert(bytes.end(), reinterpret_cast<const char*>(&length), reinterpret_cast<const char*>(&length) + sizeof(length));
+                bytes.insert(bytes.end(), s.name.begin(), s.name.begin() + length);
+            }
+            if (bytes.size() > pHeader->schemaCapacity)
+                throw std::runtime_error("History schema too large");
+
+            std::uint32_t sequence = pHeader->schemaSequence.load(std::memory_order_relaxed);
+            pHeader->schemaSequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(Schema(), bytes.data(), bytes.size());
+            pHeader->schemaSize.store(static_cast<std::uint32_t>(bytes.size()), std::memory_order_relaxed);
+            pHeader->schemaSequence.store(sequence + 2, std::memory_order_release);
+            return sequence + 2;
+        }
+
+        void Append(std::int64_t timestamp, bool isKey, std::uint32_t schemaStamp, const char* payload, std::size_t length)
+        {
+            if (length > pHeader->dataCapacity)
+                throw std::runtime_error("History frame larger than the ring");
+
+            // Announce the bytes about to be overwritten before overwriting them
+            std::uint64_t offset = pHeader->reserved.load(std::memory_order_relaxed);
+            pHeader->reserved.store(offset + length, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            CopyIn(offset, payload, length);
+
+            std::uint64_t n = pHeader->nbFrames.load(std::memory_order_relaxed);
+            history_detail::index_entry& e = Entry(n & (pHeader->indexCapacity - 1));
+            e.frame.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            e.timestamp.store(timestamp, std::memory_order_relaxed);
+            e.offset.store(offset, std::memory_order_relaxed);
+            e.length.store(static_cast<std::uint32_t>(length), std::memory_order_relaxed);
+            e.schemaStamp.store(schemaStamp, std::memory_order_relaxed);
+            e.isKey.store(isKey ? 1 : 0, std::memory_order_relaxed);
+            e.frame.store(n + 1, std::memory_order_release);
+            pHeader->nbFrames.store(n + 1, std::memory_order_release);
+        }
+
+        // Reader side
+
+        // Copies the schema. Returns false if it is being written, or if there is none.
+        bool ReadSchema(std::vector<history_series>& series, std::uint32_t& stamp) const
+        {
+            series.clear();
+            stamp = pHeader->schemaSequence.load(std::memory_order_acquire);
+            if (stamp == 0 || (stamp & 1) != 0)
+                return false;
+            std::uint32_t size = (std::min)(pHeader->schemaSize.load(std::memory_order_relaxed), pHeader->schemaCapacity);
+            std::vector<char> bytes(Schema(), Schema() + size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (pHeader->schemaSequence.load(std::memory_order_relaxed) != stamp)
+                return false;
+
+            const std::size_t fixed = 1 + sizeof(std::int32_t) + sizeof(std::uint16_t);
+            for (std::size_t p = 0; p + fixed <= bytes.size(); )
+            {
+                history_series s;
+                std::int32_t type;
+                std::uint16_t length;
+                s.kind = static_cast<history_series::kind_type>(bytes[p]);
+                std::memcpy(&type, &bytes[p + 1], sizeof(type));
+                std::memcpy(&length, &bytes[p + 1 + sizeof(type)], sizeof(length));
+                p += fixed;
+                if (p + length > bytes.size())
+                    return false;
+                s.type = type;
+                s.name.assign(&bytes[p], length);
+                p += length;
+                series.push_back(std::move(s));
+            }
+            return true;
+        }
+
+        // Calls f(timestamp, const std::uint64_t* values) for each frame with from <= timestamp <= to, oldest first.
+        // values[i] is the raw value of series i of the schema, see history_series::AsDouble.
+        // Frames overwritten while they are read are skipped, up to the next key frame. Returns the number of frames given to f.
+        template<typename F>
+        std::size_t Read(const std::vector<history_series>& schema, std::uint32_t schemaStamp, std::int64_t from, std::int64_t to, F&& f) const
+        {
+            std::vector<std::uint64_t> values(schema.size(), 0);
+            std::vector<char> payload;
+            std::size_t count = 0;
+            bool synchronized = false;
+
+            std::uint64_t n = NbFrames();
+            std::uint64_t first = n > pHeader->indexCapacity ? n - pHeader->indexCapacity : 0;
+            for (std::uint64_t frame = first; frame < n; ++frame)
+            {
+                std::int64_t timestamp;
+                std::uint64_t offset;
+                std::uint32_t length, stamp;
+                bool isKey;
+                if (!ReadEntry(frame, timestamp, offset, length, stamp, isKey) || stamp != schemaStamp)
+                {
+                    synchronized = false;
+                    continue;
+                }
+                if (timestamp > to)
+                    break;
+                if (!isKey && !synchronized)
+                    continue;
+
+                payload.resize(length);
+                CopyOut(offset, payload.data(), length);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (pHeader->reserved.load(std::memory_order_relaxed) - offset > pHeader->dataCapacity)
+                {
+                    synchronized = false; // Overwritten while it was copied
+                    continue;
+                }
+
+                synchronized = Decode(schema, isKey, payload, values);
+                if (synchronized && timestamp >= from)
+                {
+                    f(timestamp, static_cast<const std::uint64_t*>(values.data()));
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        template<typename F>
+        std::size_t Read(std::int64_t from, std::int64_t to, F&& f) const
+        {
+            std::vector<history_series> schema;
+            std::uint32_t stamp;
+            if (!ReadSchema(schema, stamp))
+                return 0;
+            return Read(schema, stamp, from, to, std::forward<F>(f));
+        }
+
+    private:
+        char* Schema() const { return reinterpret_cast<char*>(pHeader) + history_detail::AlignUp(sizeof(history_detail::header)); }
+
+        history_detail::index_entry& Entry(std::size_t i) const
+        {
+            return reinterpret_cast<history_detail::index_entry*>(Schema() + history_detail::AlignUp(pHeader->schemaCapacity))[i];
+        }
+
+        char* Data() const { return reinterpret_cast<char*>(&Entry(pHeader->indexCapacity)); }
+
+        void CopyIn(std::uint64_t offset, const char* p, std::size_t length)
+        {
+            std::size_t position = static_cast<std::size_t>(offset & (pHeader->dataCapacity - 1));
+            std::size_t first = (std::min)(length, pHeader->dataCapacity - position);
+            std::memcpy(Data() + position, p, first);
+            std::memcpy(Data(), p + first, length - first);
+        }
+
+        void CopyOut(std::uint64_t offset, char* p, std::size_t length) const
+        {
+            std::size_t position = static_cast<std::size_t>(offset & (pHeader->dataCapacity - 1));
+            std::size_t first = (std::min)(length, pHeader->dataCapacity - position);
+            std::memcpy(p, Data() + position, first);
+            std::memcpy(p + first, Data(), length - first);
+        }
+
+        bool ReadEntry(std::uint64_t frame, std::int64_t& timestamp, std::uint64_t& offset, std::uint32_t& length, std::uint32_t& stamp, bool& isKey) const
+        {
+            const history_detail::index_entry& e = Entry(frame & (pHeader->indexCapacity - 1));
+            if (e.frame.load(std::memory_order_acquire) != frame + 1)
+                return false;
+            timestamp = e.timestamp.load(std::memory_order_relaxed);
+            offset = e.offset.load(std::memory_order_relaxed);
+            length = e.length.load(std::memory_order_relaxed);
+            stamp = e.schemaStamp.load(std::memory_order_relaxed);
+            isKey = e.isKey.load(std::memory_order_relaxed) != 0;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return e.frame.load(std::memory_order_relaxed) == frame + 1 && length <= pHeader->dataCapacity;
+        }
+
+        static bool Decode(const std::vector<history_series>& schema, bool isKey, const std::vector<char>& payload, std::vector<std::uint64_t>& values)
+        {
+            const char* p = payload.data();
+            const char* end = p + payload.size();
+            for (std::size_t i = 0; i < schema.size(); ++i)
+            {
+                std::uint64_t v;
+                if (!history_detail::GetVarint(p, end, v))
+                    return false;
+                std::uint64_t previous = isKey ? 0 : values[i];
+                if (schema[i].kind == history_series::integer)
+                    values[i] = previous + static_cast<std::uint64_t>(history_detail::UnZigZag(v));
+                else
+                    values[i] = previous ^ v;
+            }
+            return p == end;
+        }
+
+        history_detail::header* pHeader;
+    };
+
+
+    // History ring stored in the shared memory, to be used as the type of an interprocess variable:
+    //   typedef ipv::history_buffer<256 * 1024> ServiceHistory;
+    //   decl_ipv_variable(ServiceHistory, serviceHistory);
+    template<std::size_t DataBytes, std::size_t IndexEntries = 4096, std::size_t SchemaBytes = 64 * 1024>
+    struct history_buffer {
+        static_assert(DataBytes != 0 && (DataBytes & (DataBytes - 1)) == 0, "The data size of a history buffer must be a power of two");
+        static_assert(IndexEntries != 0 && (IndexEntries & (IndexEntries - 1)) == 0, "The index size of a history buffer must be a power of two");
+
+        history_buffer() { history_ring::Initialize(storage, DataBytes, IndexEntries, SchemaBytes); }
+
+        history_ring ring() { return history_ring(storage); }
+
+        std::string AsString() const
+        {
+            return std::to_string(history_ring(const_cast<char*>(storage)).NbFrames()) + " frames";
+        }
+
+    private:
+        alignas(IPV_CACHE_LINE_SIZE) char storage[history_detail::AlignUp(sizeof(history_detail::header)) + history_detail::AlignUp(SchemaBytes)
+            + IndexEntries * sizeof(history_detail::index_entry) + DataBytes];
+    };
+
+
+    // History ring in a memory mapped file, written by history_recorder::SpillTo.
+    // Opened read only, for instance after the processes are gone.
+    class history_file {
+    public:
+        explicit history_file(const char* path)
+            : mapping(path, bip::read_only), region(mapping, bip::read_only), ring(region.get_address()) {}
+
+        const history_ring& Ring() const { return ring; }
+
+    private:
+        bip::file_mapping mapping;
+        bip::mapped_region region;
+        history_ring ring;
+    };
+
+
+    // Samples a set of variables, by name, into a history ring.
+    // Only numeric variables are recorded: the basic types and their atomic versions, sharded counters (their sum)
+    // and histograms (their count). The variables that do not exist yet are recorded as 0, and looked up again at each key frame.
+    class history_recorder {
+    public:
+        history_recorder(history_ring target, const std::vector<std::string>& names, std::chrono::milliseconds period = std::chrono::milliseconds(10), unsigned keyframeInterval = 100)
+            : ring(target), samplingPeriod(period), keyInterval((std::max)(keyframeInterval, 1u)), nbFrames(0), running(false)
+        {
+            series.resize(names.size());
+            for (std::size_t i = 0; i < names.size(); ++i)
+                series[i].name = names[i];
+            Resolve();
+            schemaStamp = ring.WriteSchema(Schema());
+        }
+
+        ~history_recorder()
+        {
+            Stop();
+            SharedMemoryManager& manager = SharedMemoryManager::GetInstance();
+            for (sampled& s : series)
+            {
+                if (s.pRec != nullptr && manager.ReleaseReference(s.pRec) && !s.pRec->isPersistant)
+                    manager.RemoveVariable(s.name.c_str());
+            }
+        }
+
+        history_recorder(const history_recorder&) = delete;
+        history_recorder& operator=(const history_recorder&) = delete;
+
+        // Also appends the frames to a ring in a memory mapped file, created or truncated.
+        // Call it before Start.
+        void SpillTo(const char* path, std::size_t dataBytes, std::size_t indexEntries = 1 << 16)
+        {
+            std::size_t bytes = history_ring::Bytes(dataBytes, indexEntries, SchemaCapacity());
+            {
+                std::filebuf file;
+                if (!file.open(path, std::ios_base::in | std::ios_base::out | std::ios_base::trunc | std::ios_base::binary))
+                    throw std::runtime_error("Cannot create the history file");
+                file.pubseekoff(bytes - 1, std::ios_base::beg);
+                file.sputc(0);
+            }
+            spillMapping.reset(new bip::file_mapping(path, bip::read_write));
+            spillRegion.reset(new bip::mapped_region(*spillMapping, bip::read_write));
+            spill = history_ring::Initialize(spillRegion->get_address(), dataBytes, indexEntries, SchemaCapacity());
+            spillStamp = spill.WriteSchema(Schema());
+            nbFrames = 0; // The next frame is a key frame, for both rings
+        }
+
+        // Samples from a thread of the library, each period
+        void Start()
+        {
+            std::lock_guard<std::mutex> lock(threadMutex);
+            if (running)
+                return;
+            running = true;
+            sampler = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(threadMutex);
+                auto next = std::chrono::steady_clock::now();
+                while (running)
+                {
+                    lock.unlock();
+                    SampleOnce();
+                    lock.lock();
+                    next += samplingPeriod;
+                    stopped.wait_until(lock, next, [this]() { return !running; });
+                }
+                });
+        }
+
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(threadMutex);
+                if (!running)
+                    return;
+                running = false;
+            }
+            stopped.notify_all();
+            sampler.join();
+        }
+
+        // Appends one frame with the current values of the variables
+        void SampleOnce()
+        {
+            bool isKey = nbFrames % keyInterval == 0;
+            if (isKey)
+                Resolve();
+
+            payload.clear();
+            for (sampled& s : series)
+            {
+                std::uint64_t v = s.ptr != nullptr ? Load(s) : 0;
+                std::uint64_t previous = isKey ? 0 : s.last;
+                if (s.kind == history_series::integer)
+                    history_detail::PutVarint(payload, history_detail::ZigZag(static_cast<std::int64_t>(v - previous)));
+                else
+                    history_detail::PutVarint(payload, v ^ previous);
+                s.last = v;
+            }
+
+            std::int64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            ring.Append(timestamp, isKey, schemaStamp, payload.data(), payload.size());
+            if (spill.IsValid())
+                spill.Append(timestamp, isKey, spillStamp, payload.data(), payload.size());
+            nbFrames++;
+        }
+
+    private:
+        struct sampled {
+            sampled() : type(0), size(0), kind(history_series::integer), ptr(nullptr), pRec(nullptr), last(0) {}
+            std::string name;
+            int type;
+            int size;
+            history_series::kind_type kind;
+            const void* ptr;
+            IPVarRecord* pRec;
+            std::uint64_t last;
+        };
+
+        std::vector<history_series> Schema() const
+        {
+            std::vector<history_series> schema(series.size());
+            for (std::size_t i = 0; i < series.size(); ++i)
+            {
+                schema[i].name = series[i].name;
+                schema[i].type = series[i].type;
+                schema[i].kind = series[i].kind;
+            }
+            return schema;
+        }
+
+        std::size_t SchemaCapacity() const
+        {
+            std::size_t bytes = 0;
+            for (const sampled& s : series)
+                bytes += 1 + sizeof(std::int32_t) + sizeof(std::uint16_t) + s.name.size();
+            return (std::max)(bytes, static_cast<std::size_t>(64));
+        }
+
+        // Looks up the variables not found yet. The kind of a series is written in the schema with the first frame,
+        // so a variable appearing later is only recorded if it has the kind of an integer.
+        void Resolve()
+        {
+            SharedMemoryManager& manager = SharedMemoryManager::GetInstance();
+            for (sampled& s : series)
+            {
+                if (s.pRec != nullptr)
+                    continue;
+                size_t offset;
+                IPVarRecord* pRec;
+                history_series::kind_type kind;
+                if (!manager.exists(s.name.c_str(), offset, pRec) || !IsSupported(pRec->type, kind))
+                    continue;
+                if (schemaStamp != 0 && kind != s.kind)
+                    continue;
+                if (!manager.AcquireReference(pRec))
+                    continue;
+                s.pRec = pRec;
+                s.type = pRec->type;
+                s.size = pRec->varSize;
+                s.kind = kind;
+                s.ptr = manager.OffsetToAddress(offset);
+            }
+        }
+
+        static bool IsSupported(int type, history_series::kind_type& kind)
+        {
+            kind = history_series::integer;
+            switch (type)
+            {
+            case TypeToInt<float>(): case TypeToInt<double>():
+            case TypeToInt< std::atomic<float> >(): case TypeToInt< std::atomic<double> >():
+                kind = history_series::floating;
+                return true;
+            case TypeToInt<int>(): case TypeToInt<char>(): case TypeToInt<unsigned char>(): case TypeToInt<short>(): case TypeToInt<unsigned short>():
+            case TypeToInt<long>(): case TypeToInt<unsigned long>(): case TypeToInt<long long>(): case TypeToInt<unsigned long long>(): case TypeToInt<bool>():
+            case TypeToInt< std::atomic<int> >(): case TypeToInt< std::atomic<char> >(): case TypeToInt< std::atomic<unsigned char> >():
+            case TypeToInt< std::atomic<short> >(): case TypeToInt< std::atomic<unsigned short> >(): case TypeToInt< std::atomic<long> >():
+            case TypeToInt< std::atomic<unsigned long> >(): case TypeToInt< std::atomic<long long> >(): case TypeToInt< std::atomic<unsigned long long> >():
+            case TypeToInt< std::atomic<bool> >():
+            case TypeToInt< sharded_counter<long long> >(): case TypeToInt< sharded_counter<unsigned long long> >():
+            case TypeToInt< histogram >():
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        template<typename T>
+        static std::uint64_t As(const void* p)
+        {
+            T v;
+            std::memcpy(&v, p, sizeof(T));
+            return static_cast<std::uint64_t>(static_cast<std::int64_t>(v));
+        }
+
+        template<typename T>
+        static std::uint64_t AsAtomic(const void* p)
+        {
+            return static_cast<std::uint64_t>(static_cast<std::int64_t>(static_cast<const std::atomic<T>*>(p)->load(std::memory_order_relaxed)));
+        }
+
+        static std::uint64_t DoubleBits(double d)
+        {
+            std::uint64_t raw;
+            std::memcpy(&raw, &d, sizeof(raw));
+            return raw;
+        }
+
+        static std::uint64_t Load(const sampled& s)
+        {
+            const void* p = s.ptr;
+            switch (s.type)
+            {
+            case TypeToInt<float>(): { float f; std::memcpy(&f, p, sizeof(f)); return DoubleBits(f); }
+            case TypeToInt<double>(): { double d; std::memcpy(&d, p, sizeof(d)); return DoubleBits(d); }
+            case TypeToInt< std::atomic<float> >(): return DoubleBits(static_cast<const std::atomic<float>*>(p)->load(std::memory_order_relaxed));
+            case TypeToInt< std::atomic<double> >(): return DoubleBits(static_cast<const std::atomic<double>*>(p)->load(std::memory_order_relaxed));
+            case TypeToInt<int>(): return As<int>(p);
+            case TypeToInt<char>(): return As<char>(p);
+            case TypeToInt<unsigned char>(): return As<unsigned char>(p);
+            case TypeToInt<short>(): return As<short>(p);
+            case TypeToInt<unsigned short>(): return As<unsigned short>(p);
+            case TypeToInt<long>(): return As<long>(p);
+            case TypeToInt<unsigned long>(): return As<unsigned long>(p);
+            case TypeToInt<long long>(): return As<long long>(p);
+            case TypeToInt<unsigned long long>(): return As<unsigned long long>(p);
+            case TypeToInt<bool>(): return As<bool>(p);
+            case TypeToInt< std::atomic<int> >(): return AsAtomic<int>(p);
+            case TypeToInt< std::atomic<char> >(): return AsAtomic<char>(p);
+            case TypeToInt< std::atomic<unsigned char> >(): return AsAtomic<unsigned char>(p);
+            case TypeToInt< std::atomic<short> >(): return AsAtomic<short>(p);
+            case TypeToInt< std::atomic<unsigned short> >(): return AsAtomic<unsigned short>(p);
+            case TypeToInt< std::atomic<long> >(): return AsAtomic<long>(p);
+            case TypeToInt< std::atomic<unsigned long> >(): return AsAtomic<unsigned long>(p);
+            case TypeToInt< std::atomic<long long> >(): return AsAtomic<long long>(p);
+            case TypeToInt< std::atomic<unsigned long long> >(): return AsAtomic<unsigned long long>(p);
+            case TypeToInt< std::atomic<bool> >(): return AsAtomic<bool>(p);
+            case TypeToInt< sharded_counter<long long> >(): return static_cast<std::uint64_t>(static_cast<const sharded_counter<long long>*>(p)->load());
+            case TypeToInt< sharded_counter<unsigned long long> >(): return static_cast<const sharded_counter<unsigned long long>*>(p)->load();
+            case TypeToInt< histogram >(): return static_cast<const histogram*>(p)->Count();
+            default: return 0;
+            }
+        }
+
+        history_ring ring;
+        history_ring spill;
+        std::uint32_t schemaStamp = 0;
+        std::uint32_t spillStamp = 0;
+        std::unique_ptr<bip::file_mapping> spillMapping;
+        std::unique_ptr<bip::mapped_region> spillRegion;
+
+        std::vector<sampled> series;
+        std::vector<char> payload;
+        std::chrono::milliseconds samplingPeriod;
+        unsigned keyInterval;
+        std::uint64_t nbFrames;
+
+        std::mutex threadMutex;
+        std::condition_variable stopped;
+        std::thread sampler;
+        bool running;
+    };
+
+} // namespace ipv
+
+#endif // _IPVAR_RECORDER_H_
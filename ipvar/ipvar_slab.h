@@ -0,0 +1,336 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_SLAB_H_
+#define _IPVAR_SLAB_H_
+
+#include "ipvar.h"
+
+#include <boost/container/map.hpp>
+#include <boost/container/string.hpp>
+#include <boost/container/vector.hpp>
+
+#include <mutex>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifndef IPV_SLAB_CHUNK_SIZE
+#define IPV_SLAB_CHUNK_SIZE (64 * 1024)  // Bytes reserved from the segment at once, for one size class
+#endif
+
+#ifndef IPV_SLAB_PROCESSES
+#define IPV_SLAB_PROCESSES 64  // Processes whose current chunks are recorded in the segment, per size class
+#endif
+
+#ifndef IPV_CACHE_LINE_SIZE
+#define IPV_CACHE_LINE_SIZE 64
+#endif
+
+// Size class pools for the containers stored in shared memory.
+//
+// allocate_shared_memory takes the interprocess lock of the library and the lock of the segment manager on each call.
+// The pools reserve chunks of IPV_SLAB_CHUNK_SIZE bytes with it, and carve them without any lock: each process
+// cuts the blocks of its current chunk with an atomic increment, and the freed blocks are pushed on a lock-free list
+// per size class, stored in the segment, from which any process reuses them.
+// The blocks are powers of two from 16 to 2048 bytes. Larger requests go to allocate_shared_memory.
+// The chunks are never given back to the segment. Each one starts with the count of its bytes carved, and the chunk a process is carving
+// is recorded in the segment with its pid: a process which needs a new chunk first takes over the chunk of a process which is gone,
+// as the WriterLock of published<T>. Past IPV_SLAB_PROCESSES processes carving the same size class, the chunks are not recorded.
+// A child created by fork does not carve the chunks of its parent.
+// The containers hold offset_ptr: the chunks, the large blocks and the container variables stay in the initial segment,
+// mapped whole by every process (see uses_offset_ptr). The extensions are not used for them.
+//
+//   ipv::shm_vector<int>* pValues = ...;                 // Any object in shared memory
+//   decl_ipv_variable(ipv::shm_vector<int>, values);    // Or an interprocess variable
+//   (*values).push_back(1);
+
+namespace ipv {
+
+    namespace slab_detail {
+        static const std::size_t NB_CLASSES = 8;
+        static const std::size_t MIN_BLOCK_SIZE = 16;
+        static const std::size_t MAX_BLOCK_SIZE = MIN_BLOCK_SIZE << (NB_CLASSES - 1);
+
+        // Head of a free list: the offset of the first block divided by 16 in the low 48 bits,
+        // and a counter in the high 16 bits, incremented on each change so that a stale head never compares equal.
+        static const int TAG_SHIFT = 48;
+        static const std::uint64_t OFFSET_MASK = (static_cast<std::uint64_t>(1) << TAG_SHIFT) - 1;
+
+        struct alignas(IPV_CACHE_LINE_SIZE) free_list {
+            free_list() : head(0), nbChunks(0) {}
+            std::atomic<std::uint64_t> head;
+            std::atomic<std::uint32_t> nbChunks;  // Reserved by all the processes
+        };
+
+        // The chunk a process is carving
+        struct open_chunk {
+            open_chunk() : pid(0), offset(0) {}
+            std::atomic<std::uint32_t> pid;     // 0 if none
+            std::atomic<std::uint64_t> offset;  // Of the chunk in the segment, 0 until the first one
+        };
+
+        struct shared_pools {
+            free_list lists[NB_CLASSES];
+            open_chunk chunks[NB_CLASSES][IPV_SLAB_PROCESSES];
+        };
+
+        // Header of a chunk: the blocks follow it. A chunk is never reset, so a thread still carving an exhausted chunk gets nothing.
+        struct chunk_header {
+            explicit chunk_header(std::uint64_t v_used) : used(v_used) {}
+            std::atomic<std::uint64_t> used;    // Bytes carved, header included, IPV_SLAB_CHUNK_SIZE or more once exhausted
+        };
+        static const std::size_t CHUNK_HEADER_SIZE = MIN_BLOCK_SIZE;
+
+        inline std::size_t ClassOf(std::size_t size)
+        {
+            std::size_t index = 0;
+            while ((MIN_BLOCK_SIZE << index) < size)
+                ++index;
+            return index;
+        }
+    }
+
+
+    // The pools of the process. The free lists are shared with the other processes.
+    class slab_pools {
+    public:
+        static slab_pools& GetInstance()
+        {
+            static slab_pools instance;
+            return instance;
+        }
+
+        void* allocate(std::size_t size)
+        {
+            if (size > slab_detail::MAX_BLOCK_SIZE)
+                return allocate_shared_memory(size);
+            std::size_t index = slab_detail::ClassOf(size);
+            if (void* p = Pop(index))
+                return p;
+            return Carve(index);
+        }
+
+        // size must be the size given to allocate
+        void deallocate(void* ptr, std::size_t size)
+        {
+            if (ptr == nullptr)
+                return;
+            if (size > slab_detail::MAX_BLOCK_SIZE)
+                deallocate_shared_memory(ptr);
+            else
+                Push(slab_detail::ClassOf(size), ptr);
+        }
+
+        // Number of chunks reserved in the segment for the blocks of this size, by all the processes
+        std::uint32_t NbChunks(std::size_t size) const
+        {
+            return pShared->lists[slab_detail::ClassOf(size)].nbChunks.load();
+        }
+
+    private:
+        struct local_pool {
+            local_pool() : current(nullptr), entry(nullptr) {}
+            std::atomic<slab_detail::chunk_header*> current;
+            std::mutex refillMutex;
+            slab_detail::open_chunk* entry;  // Of this process in the segment, nullptr when the table is full
+        };
+
+        slab_pools() : manager(SharedMemoryManager::GetInstance())
+        {
+            _shared_memory_* segment = manager.GetSegment();
+            if (segment == nullptr)
+                throw std::runtime_error("Shared memory not valid");
+            pShared = segment->find_or_construct<slab_detail::shared_pools>("SlabPools")();
+#ifndef _WIN32
+            pthread_atfork(nullptr, nullptr, &ForgetChunks);
+#endif
+        }
+
+        // The child of a fork must not carve the chunks of its parent, which goes on using them
+        static void ForgetChunks()
+        {
+            for (local_pool& pool : GetInstance().pools)
+            {
+                pool.current.store(nullptr);
+                pool.entry = nullptr;
+            }
+        }
+
+        void* Pop(std::size_t index)
+        {
+            std::atomic<std::uint64_t>& head = pShared->lists[index].head;
+            std::uint64_t h = head.load(std::memory_order_acquire);
+            while ((h & slab_detail::OFFSET_MASK) != 0)
+            {
+                void* p = manager.OffsetToAddress(static_cast<size_t>((h & slab_detail::OFFSET_MASK) * slab_detail::MIN_BLOCK_SIZE));
+                // The block may already have been taken by another thread: its link is then stale, and the CAS fails
+                std::uint64_t next = static_cast<std::atomic<std::uint64_t>*>(p)->load(std::memory_order_relaxed);
+                std::uint64_t tagged = (next & slab_detail::OFFSET_MASK) | ((h >> slab_detail::TAG_SHIFT) + 1) << slab_detail::TAG_SHIFT;
+                if (head.compare_exchange_weak(h, tagged, std::memory_order_acquire, std::memory_order_acquire))
+                    return p;
+            }
+            return nullptr;
+        }
+
+        void Push(std::size_t index, void* ptr)
+        {
+            std::atomic<std::uint64_t>& head = pShared->lists[index].head;
+            std::uint64_t offset = manager.AddressToOffset(ptr) / slab_detail::MIN_BLOCK_SIZE;
+            std::atomic<std::uint64_t>* link = static_cast<std::atomic<std::uint64_t>*>(ptr);
+            std::uint64_t h = head.load(std::memory_order_relaxed);
+            do {
+                link->store(h & slab_detail::OFFSET_MASK, std::memory_order_relaxed);
+            } while (!head.compare_exchange_weak(h, offset | ((h >> slab_detail::TAG_SHIFT) + 1) << slab_detail::TAG_SHIFT,
+                std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void* Carve(std::size_t index)
+        {
+            local_pool& pool = pools[index];
+            const std::size_t blockSize = slab_detail::MIN_BLOCK_SIZE << index;
+            for (;;)
+            {
+                slab_detail::chunk_header* c = pool.current.load(std::memory_order_acquire);
+                if (c != nullptr)
+                {
+                    std::uint64_t used = c->used.fetch_add(blockSize, std::memory_order_relaxed);
+                    if (used + blockSize <= IPV_SLAB_CHUNK_SIZE)
+                        return reinterpret_cast<char*>(c) + used;
+                }
+                Refill(index, c);
+            }
+        }
+
+        bool HasRoom(const slab_detail::chunk_header* c, std::size_t blockSize) const
+        {
+            return c != nullptr && c->used.load() + blockSize <= IPV_SLAB_CHUNK_SIZE;
+        }
+
+        // Replaces the exhausted chunk, unless another thread already did: by the chunk of a process which is gone, or by a new one
+        void Refill(std::size_t index, slab_detail::chunk_header* exhausted)
+        {
+            local_pool& pool = pools[index];
+            const std::size_t blockSize = slab_detail::MIN_BLOCK_SIZE << index;
+            std::lock_guard<std::mutex> lock(pool.refillMutex);
+            if (pool.current.load() != exhausted)
+                return;
+
+            const std::uint32_t self = CurrentProcessId();
+            slab_detail::open_chunk* unused = nullptr;
+            for (slab_detail::open_chunk& entry : pShared->chunks[index])
+            {
+                // An entry with the pid of this process, other than its own, was left by a process with the same pid
+                std::uint32_t pid = entry.pid.load();
+                if (&entry == pool.entry || (pid != 0 && pid != self && IsProcessAlive(pid)))
+                    continue;
+                std::uint64_t offset = entry.offset.load();
+                slab_detail::chunk_header* c = offset != 0 ? static_cast<slab_detail::chunk_header*>(manager.OffsetToAddress(static_cast<size_t>(offset))) : nullptr;
+                bool hasRoom = pid != 0 && HasRoom(c, blockSize);
+                if ((!hasRoom && (unused != nullptr || pool.entry != nullptr)) || !entry.pid.compare_exchange_strong(pid, self))
+                    continue;
+                if (hasRoom)
+                {
+                    if (unused != nullptr)
+                        unused->pid.store(0);
+                    if (pool.entry != nullptr)
+                        pool.entry->pid.store(0);
+                    pool.entry = &entry;
+                    pool.current.store(c, std::memory_order_release);
+                    return;
+                }
+                unused = &entry;
+            }
+            if (pool.entry == nullptr)
+                pool.entry = unused;
+
+            void* begin;
+            try {
+                begin = allocate_shared_memory(IPV_SLAB_CHUNK_SIZE);
+            }
+            catch (...) {
+                if (unused != nullptr)
+                {
+                    unused->pid.store(0);
+                    pool.entry = nullptr;
+                }
+                throw;
+            }
+            slab_detail::chunk_header* c = new (begin) slab_detail::chunk_header(slab_detail::CHUNK_HEADER_SIZE);
+            if (pool.entry != nullptr)
+                pool.entry->offset.store(manager.AddressToOffset(begin));
+            pShared->lists[index].nbChunks++;
+            pool.current.store(c, std::memory_order_release);
+        }
+
+        SharedMemoryManager& manager;
+        slab_detail::shared_pools* pShared;
+        local_pool pools[slab_detail::NB_CLASSES];
+    };
+
+
+    // Allocator of the containers stored in shared memory. It has no state, and the pointers of the containers
+    // are offset pointers: a container can be used from any process mapping the segment.
+    template<typename T>
+    class slab_allocator {
+    public:
+        typedef T value_type;
+        typedef bip::offset_ptr<T> pointer;
+        typedef bip::offset_ptr<const T> const_pointer;
+        typedef bip::offset_ptr<void> void_pointer;
+        typedef bip::offset_ptr<const void> const_void_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef std::size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+
+        template<typename U>
+        struct rebind { typedef slab_allocator<U> other; };
+
+        slab_allocator() noexcept {}
+        template<typename U>
+        slab_allocator(const slab_allocator<U>&) noexcept {}
+
+        pointer allocate(size_type n)
+        {
+            static_assert(alignof(T) <= slab_detail::MIN_BLOCK_SIZE, "slab_allocator does not support over-aligned types");
+            return pointer(static_cast<T*>(slab_pools::GetInstance().allocate(n * sizeof(T))));
+        }
+
+        void deallocate(const pointer& p, size_type n)
+        {
+            slab_pools::GetInstance().deallocate(p.get(), n * sizeof(T));
+        }
+
+        size_type max_size() const noexcept { return static_cast<size_type>(-1) / sizeof(T); }
+    };
+
+    template<typename T, typename U>
+    bool operator==(const slab_allocator<T>&, const slab_allocator<U>&) { return true; }
+    template<typename T, typename U>
+    bool operator!=(const slab_allocator<T>&, const slab_allocator<U>&) { return false; }
+
+
+    template<typename T>
+    using shm_vector = boost::container::vector<T, slab_allocator<T>>;
+
+    using shm_string = boost::container::basic_string<char, std::char_traits<char>, slab_allocator<char>>;
+
+    template<typename Key, typename Value, typename Compare = std::less<Key>>
+    using shm_map = boost::container::map<Key, Value, Compare, slab_allocator<std::pair<const Key, Value>>>;
+
+    template<typename T>
+    struct uses_offset_ptr<shm_vector<T>> : std::true_type {};
+
+    template<>
+    struct uses_offset_ptr<shm_string> : std::true_type {};
+
+    template<typename Key, typename Value, typename Compare>
+    struct uses_offset_ptr<shm_map<Key, Value, Compare>> : std::true_type {};
+
+} // namespace ipv
+
+#endif // _IPVAR_SLAB_H_
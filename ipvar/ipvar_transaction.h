@@ -0,0 +1,429 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#ifndef _IPVAR_TRANSACTION_H_
+#define _IPVAR_TRANSACTION_H_
+
+#include "ipvar.h"
+#include "ipvar_util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifndef IPV_TXN_JOURNAL
+#define IPV_TXN_JOURNAL 256  // Variables written by one commit, at most
+#endif
+
+// Transactions over a set of variables:
+//
+//   ipv::txn_set limits(IPV_NAME("limits"));
+//   decl_ipv_txn_variable_3(limits, int, rateLimit, "Requests per second", 100);
+//   decl_ipv_txn_variable_3(limits, int, burstSize, "Burst size", 10);
+//
+//   ipv::transaction t(limits);          // Writer: the values are staged in the process...
+//   t.set(rateLimit, 200);
+//   t.set(burstSize, 50);
+//   t.commit();                           // ... and published together, by a single increment of the epoch of the set
+//
+//   limits.read([&](const ipv::txn_reader& r) { rate = r.get(rateLimit); burst = r.get(burstSize); });
+//
+// Each variable keeps two values, tagged with the epoch that wrote them. A reader takes the epoch of the set,
+// and reads in each variable the newest value not newer than it. A commit writes the older value of each
+// variable: it can only overwrite what a reader uses once a second commit has started during the read.
+// The reader then runs again. Readers never take a lock, and never wait for a writer: a writer that dies
+// in the middle of a commit does not block them. The writers of a set are serialized.
+// A commit records its process id and the variables it writes (up to IPV_TXN_JOURNAL). When it dies before
+// the end of the commit, the next writer takes the set over, and discards the values written at the dead epoch.
+
+namespace ipv {
+
+    // Epochs of a set: published is the last committed epoch. pending is published + 1 while a commit is in progress,
+    // and equal to published otherwise.
+    struct txn_set_state {
+        // Epoch given to the values written by a writer which died during its commit: they are never read
+        static const std::uint64_t rolled_back = ~static_cast<std::uint64_t>(0);
+
+        txn_set_state() : published(0), pending(0), writer(0), nbJournal(0), journal() {}
+        std::atomic<std::uint64_t> published;
+        std::atomic<std::uint64_t> pending;
+        // Only used by the writers: kept off the line read by the readers
+        alignas(IPV_CACHE_LINE_SIZE) std::atomic<std::uint32_t> writer;  // Process id of the committing writer, 0 if none
+        std::uint32_t nbJournal;                                         // Variables written by the last commit started
+        std::uint64_t journal[IPV_TXN_JOURNAL];                          // Offsets of their epochs in the segment
+    };
+
+} // namespace ipv
+
+IPV_DESCRIBE_STRUCT(ipv::txn_set_state, IPV_FIELD(ipv::txn_set_state, published), IPV_FIELD(ipv::txn_set_state, pending),
+    IPV_FIELD(ipv::txn_set_state, writer), IPV_FIELD(ipv::txn_set_state, nbJournal))
+
+namespace ipv {
+
+    namespace txn_detail {
+
+        // Id of the current process, read once so that a commit does not make a system call. The child of a fork reads its own.
+        class writer_id {
+        public:
+            static std::uint32_t Get() { return GetInstance().id.load(std::memory_order_relaxed); }
+
+        private:
+            writer_id() : id(CurrentProcessId())
+            {
+#ifndef _WIN32
+                pthread_atfork(nullptr, nullptr, []() { GetInstance().id.store(CurrentProcessId(), std::memory_order_relaxed); });
+#endif
+            }
+
+            static writer_id& GetInstance()
+            {
+                static writer_id instance;
+                return instance;
+            }
+
+            std::atomic<std::uint32_t> id;
+        };
+
+        // Write staged by a transaction, and the epochs of the variable written
+        struct staged_write {
+            std::atomic<std::uint64_t>* epochs;
+            std::function<void(std::uint64_t)> apply;
+        };
+    }
+
+
+    // Storage of a txn_variable: two values, and the epochs that wrote them
+    template<typename T>
+    struct txn_cell {
+        static_assert(std::is_trivially_copyable<T>::value, "txn_cell requires a trivially copyable type");
+
+        // Initial value of a cell, and the hash of the name of its set
+        struct initial {
+            T value;
+            std::uint64_t setHash;
+        };
+
+        txn_cell() : setHash(0), slots() { epochs[0] = 0; epochs[1] = 0; }
+
+        // The creator writes the initial value in both slots, at epoch 0
+        explicit txn_cell(const initial& v) : setHash(v.setHash)
+        {
+            epochs[0] = 0;
+            epochs[1] = 0;
+            std::memcpy(&slots[0], &v.value, sizeof(T));
+            std::memcpy(&slots[1], &v.value, sizeof(T));
+        }
+
+        txn_cell& operator=(const initial& v)
+        {
+            setHash = v.setHash;
+            std::memcpy(&slots[0], &v.value, sizeof(T));
+            std::memcpy(&slots[1], &v.value, sizeof(T));
+            epochs[0].store(0, std::memory_order_relaxed);
+            epochs[1].store(0, std::memory_order_relaxed);
+            return *this;
+        }
+
+        // Index of the newest value written at or before epoch. Ties go to slot 0.
+        int ReadSlot(std::uint64_t epoch) const
+        {
+            std::uint64_t e0 = epochs[0].load(std::memory_order_relaxed);
+            std::uint64_t e1 = epochs[1].load(std::memory_order_relaxed);
+            bool use1 = e1 <= epoch && (e0 > epoch || e1 > e0);
+            return use1 ? 1 : 0;
+        }
+
+        // Writes the older value, which becomes the newest one at epoch. Called by the writer owning the set.
+        // A second write in the same commit replaces the first one, and keeps the value of the previous epoch.
+        // A value rolled back is replaced first: the other one is the only value readable.
+        void Write(std::uint64_t epoch, const T& v)
+        {
+            std::uint64_t e0 = epochs[0].load(std::memory_order_relaxed);
+            std::uint64_t e1 = epochs[1].load(std::memory_order_relaxed);
+            int slot = (e0 == epoch) ? 0 : (e1 == epoch) ? 1 : (e0 > epoch) ? 0 : (e1 > epoch) ? 1 : (e0 < e1 ? 0 : 1);
+            std::memcpy(&slots[slot], &v, sizeof(T));
+            epochs[slot].store(epoch, std::memory_order_relaxed);
+        }
+
+        std::uint64_t setHash; // Hash of the name of the set, checked when the variable is used in a transaction
+        std::atomic<std::uint64_t> epochs[2];
+        T slots[2];
+    };
+
+    // A cell is described with its epochs and both values: a monitor must read the newest value not newer than the epoch of the set.
+    template<typename T>
+    struct describe<txn_cell<T>, void> {
+        static type_description Get()
+        {
+            txn_cell<T> cell;
+            const char* base = reinterpret_cast<const char*>(&cell);
+            type_description value = describe<T>::Get();
+            return type_description("txn<" + std::string(value.Header().name) + ">", sizeof(cell), alignof(txn_cell<T>))
+                .Add("setHash", static_cast<std::size_t>(reinterpret_cast<const char*>(&cell.setHash) - base), describe<std::uint64_t>::Get())
+                .Add("epochs", static_cast<std::size_t>(reinterpret_cast<const char*>(&cell.epochs) - base), describe<std::atomic<std::uint64_t>[2]>::Get())
+                .Add("slots", static_cast<std::size_t>(reinterpret_cast<const char*>(&cell.slots) - base), describe<T[2]>::Get());
+        }
+    };
+
+    // Type code of a txn_variable: 150 plus the code of its value, 150 for a value without a code
+    template<typename T>
+    constexpr int TxnTypeToInt() { return 150 + TypeToInt<T>(); }
+
+
+    class txn_set;
+    template<typename T, typename U = T> class txn_variable;
+
+
+    // Consistent view of a set, given to the function of txn_set::read
+    class txn_reader {
+    public:
+        template<typename T, typename U>
+        T get(const txn_variable<T, U>& v) const
+        {
+            const txn_cell<T>& cell = v.cell();
+            T value;
+            std::memcpy(&value, &cell.slots[cell.ReadSlot(epoch)], sizeof(T));
+            return value;
+        }
+
+        std::uint64_t Epoch() const { return epoch; }
+
+    private:
+        friend class txn_set;
+        explicit txn_reader(std::uint64_t v_epoch) : epoch(v_epoch) {}
+        std::uint64_t epoch;
+    };
+
+
+    // A named set of variables committed together. The set itself is an interprocess variable holding the epochs.
+    class txn_set {
+    public:
+        // setName is an IPV_NAME, hashed at compile time, or a const char*, hashed at run time
+        explicit txn_set(const hashed_name& setName, bool isPersistant = false)
+            : var(setName, 0, isPersistant, "Transaction set"), hash(setName.Hash())
+        {
+        }
+
+        // Calls f(const txn_reader&) and returns its result. f runs again when a second commit started during
+        // the read: it may see inconsistent values in the discarded runs, and must only read them.
+        template<typename F>
+        auto read(F&& f) const -> decltype(f(std::declval<const txn_reader&>()))
+        {
+            for (;;)
+            {
+                std::uint64_t epoch = state().published.load(std::memory_order_acquire);
+                auto result = f(txn_reader(epoch));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (state().pending.load(std::memory_order_relaxed) <= epoch + 1)
+                    return result;
+            }
+        }
+
+        // Last committed epoch
+        std::uint64_t epoch() const { return state().published.load(std::memory_order_acquire); }
+
+        // Blocks until a commit after last_epoch, or the timeout expires. Returns true if a commit happened.
+        template<typename Rep, typename Period>
+        bool wait_for_commit(std::uint64_t last_epoch, const std::chrono::duration<Rep, Period>& timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            for (;;)
+            {
+                std::uint32_t version = var.version();
+                if (epoch() != last_epoch)
+                    return true;
+                auto remaining = deadline - std::chrono::steady_clock::now();
+                if (remaining <= std::chrono::steady_clock::duration::zero() || !var.wait_for_change(version, remaining))
+                    return epoch() != last_epoch;
+            }
+        }
+
+        bool IsMine() const { return var.IsMine(); }
+
+        std::uint64_t Hash() const { return hash; }
+
+    private:
+        friend class transaction;
+
+        txn_set_state& state() const { return *static_cast<txn_set_state*>(var); }
+
+        // Takes the set for a commit, returns the epoch of the commit. The variables written are journaled for the next writer.
+        // The set of a writer which is gone is taken over, as the WriterLock of published<T>.
+        std::uint64_t BeginCommit(const std::vector<txn_detail::staged_write>& writes)
+        {
+            txn_set_state& s = state();
+            std::uint32_t me = txn_detail::writer_id::Get();
+            std::uint32_t holder = 0;
+            while (!s.writer.compare_exchange_weak(holder, me, std::memory_order_acquire))
+            {
+                if (holder != 0 && holder != me && !IsProcessAlive(holder))
+                    continue; // holder is gone: the CAS takes over the set
+                holder = 0;
+                std::this_thread::yield(); // Another writer is committing
+            }
+
+            std::uint64_t published = s.published.load(std::memory_order_relaxed);
+            std::uint64_t pending = s.pending.load(std::memory_order_relaxed);
+            if (pending != published)
+                RollBack(pending);
+
+            SharedMemoryManager& manager = var.Domain();
+            std::uint32_t nbJournal = 0;
+            for (const txn_detail::staged_write& write : writes)
+            {
+                std::uint64_t offset = manager.AddressToOffset(write.epochs);
+                if (std::find(s.journal, s.journal + nbJournal, offset) != s.journal + nbJournal)
+                    continue;
+                if (nbJournal == IPV_TXN_JOURNAL)
+                {
+                    s.writer.store(0, std::memory_order_release);
+                    throw std::runtime_error("Too many variables in the transaction, see IPV_TXN_JOURNAL");
+                }
+                s.journal[nbJournal++] = offset;
+            }
+            s.nbJournal = nbJournal;
+            s.pending.store(published + 1, std::memory_order_relaxed);
+            // The new values must not be visible before pending and the journal, as the sequence of a seqlock
+            std::atomic_thread_fence(std::memory_order_release);
+            return published + 1;
+        }
+
+        void EndCommit(std::uint64_t epoch)
+        {
+            state().published.store(epoch, std::memory_order_release);
+            state().writer.store(0, std::memory_order_release);
+            var.notify();
+        }
+
+        // The previous writer died during the commit of epoch: the values it wrote are never published
+        void RollBack(std::uint64_t epoch)
+        {
+            txn_set_state& s = state();
+            SharedMemoryManager& manager = var.Domain();
+            for (std::uint32_t i = 0; i < s.nbJournal; ++i)
+            {
+                std::atomic<std::uint64_t>* epochs = static_cast<std::atomic<std::uint64_t>*>(manager.OffsetToAddress(static_cast<size_t>(s.journal[i])));
+                for (int slot = 0; slot < 2; ++slot)
+                {
+                    if (epochs[slot].load(std::memory_order_relaxed) == epoch)
+                        epochs[slot].store(txn_set_state::rolled_back, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        mutable variable<txn_set_state> var;
+        std::uint64_t hash;
+    };
+
+
+    // Variable of a transaction set. Its value is read through txn_set::read, or alone with load().
+    template<typename T, typename U>
+    class txn_variable {
+    public:
+        txn_variable(txn_set& v_set, const hashed_name& varName, int varType, bool isPersistant, const char* varDescription)
+            : txnSet(v_set), var(varName, varType, isPersistant, varDescription, Initial(v_set, T()))
+        {
+            Bind();
+        }
+
+        txn_variable(txn_set& v_set, const hashed_name& varName, int varType, bool isPersistant, const char* varDescription, U vInitiale)
+            : txnSet(v_set), var(varName, varType, isPersistant, varDescription, Initial(v_set, T(vInitiale)))
+        {
+            Bind();
+        }
+
+        // The value of the last commit
+        T load() const
+        {
+            return txnSet.read([this](const txn_reader& r) { return r.get(*this); });
+        }
+
+        std::string AsString() const {
+            T v = load();
+            return ipv::try_to_string(v);
+        }
+
+        bool IsMine() const { return var.IsMine(); }
+
+    private:
+        friend class txn_reader;
+        friend class transaction;
+
+        // The cell is built with its initial value and the hash of its set by the creator of the variable
+        static typename txn_cell<T>::initial Initial(const txn_set& v_set, const T& value)
+        {
+            return typename txn_cell<T>::initial{ value, v_set.Hash() };
+        }
+
+        void Bind() const
+        {
+            if (!var.IsMine() && cell().setHash != txnSet.Hash())
+                throw std::runtime_error("The variable belongs to another transaction set");
+        }
+
+        txn_cell<T>& cell() const { return *static_cast<txn_cell<T>*>(var); }
+
+        txn_set& txnSet;
+        mutable variable<txn_cell<T>, typename txn_cell<T>::initial> var;
+    };
+
+
+    // Writes staged in the process, and published together by commit(). A transaction which is not committed
+    // has no effect.
+    class transaction {
+    public:
+        explicit transaction(txn_set& v_set) : txnSet(v_set) {}
+
+        // Stages a write. The value is copied: it can be changed after the call.
+        template<typename T, typename U, typename V>
+        void set(txn_variable<T, U>& v, const V& value)
+        {
+            if (v.txnSet.Hash() != txnSet.Hash())
+                throw std::runtime_error("The variable belongs to another transaction set");
+            T staged(value);
+            txn_cell<T>* pCell = &v.cell();
+            writes.push_back(txn_detail::staged_write{ pCell->epochs, [pCell, staged](std::uint64_t epoch) { pCell->Write(epoch, staged); } });
+        }
+
+        // Publishes the staged writes, returns the epoch of the commit. Writes of the same variable are applied in order.
+        // Throws std::runtime_error when more than IPV_TXN_JOURNAL variables are written.
+        std::uint64_t commit()
+        {
+            std::uint64_t epoch = txnSet.BeginCommit(writes);
+            for (txn_detail::staged_write& write : writes)
+                write.apply(epoch);
+            txnSet.EndCommit(epoch);
+            writes.clear();
+            return epoch;
+        }
+
+        void abort() { writes.clear(); }
+
+        std::size_t size() const { return writes.size(); }
+
+    private:
+        txn_set& txnSet;
+        std::vector<txn_detail::staged_write> writes;
+    };
+
+} // namespace ipv
+
+
+// decl_ipv_txn_.. macros follow the decl_ipv_variable.. ones, with the set as first argument.
+// The type code (TxnTypeToInt) differs from the one of the value: monitors must not read the cell as a plain value.
+
+#define decl_ipv_txn_variable(set,type,name) ipv::txn_variable<type> name(set, IPV_NAME(#name), ipv::TxnTypeToInt<type>(),false,#name)
+#define decl_pipv_txn_variable(set,type,name) ipv::txn_variable<type> name(set, IPV_NAME(#name), ipv::TxnTypeToInt<type>(),true,#name)
+
+#define decl_ipv_txn_variable_3(set,type,name,desc,v0) ipv::txn_variable<type, decltype(v0)> name(set, IPV_NAME(#name), ipv::TxnTypeToInt<type>(),false,desc,v0)
+#define decl_pipv_txn_variable_3(set,type,name,desc,v0) ipv::txn_variable<type, decltype(v0)> name(set, IPV_NAME(#name), ipv::TxnTypeToInt<type>(),true,desc,v0)
+
+#endif // _IPVAR_TRANSACTION_H_
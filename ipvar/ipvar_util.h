@@ -55,16 +55,64 @@ namespace ipv {
 // Macro to define an interprocess variable with a given type, name and description
 // decl_ipv_.. stands for non -persistent interprocess variable
 // decl_pipv_.. stands for persistent interprocess variable
+// The name is hashed at compile time: attaching to the variable only compares the hash, and the name once.
 
+// A variable name literal with its length and hash, computed at compile time
+#define IPV_NAME(s) ipv::hashed_name(s, std::integral_constant<std::size_t, ipv::NameLength(s)>::value, std::integral_constant<std::uint64_t, ipv::HashName(s)>::value)
 
-#define decl_ipv_variable(type,name) ipv::variable<type> name(#name, ipv::TypeToInt<type>(),false,#name)
-#define decl_pipv_variable(type,name) ipv::variable<type> name(#name, ipv::TypeToInt<type>(),true,#name)
 
-#define decl_ipv_variable_2(type,name,desc) ipv::variable<type> name(#name, ipv::TypeToInt<type>(),false,desc)
-#define decl_pipv_variable_2(type,name,desc) ipv::variable<type> name(#name, ipv::TypeToInt<type>(),true,desc)
+#define decl_ipv_variable(type,name) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),false,#name)
+#define decl_pipv_variable(type,name) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),true,#name)
 
-#define decl_ipv_variable_3(type,name,desc,v0) ipv::variable<type, decltype(v0)> name(#name, ipv::TypeToInt<type>(),false,desc,v0)
-#define decl_pipv_variable_3(type,name,desc,v0) ipv::variable<type, decltype(v0)> name(#name, ipv::TypeToInt<type>(),true,desc,v0)
+#define decl_ipv_variable_2(type,name,desc) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc)
+#define decl_pipv_variable_2(type,name,desc) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc)
 
+#define decl_ipv_variable_3(type,name,desc,v0) ipv::variable<type, decltype(v0)> name(IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc,v0)
+#define decl_pipv_variable_3(type,name,desc,v0) ipv::variable<type, decltype(v0)> name(IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc,v0)
 
-#endif _IPVAR_UTILITIES_H
+// decl_..._d macros declare the variable in a domain, a SharedMemoryManager& given by SharedMemoryManager::GetDomain
+
+#define decl_ipv_variable_d(domain,type,name) ipv::variable<type> name(domain, IPV_NAME(#name), ipv::TypeToInt<type>(),false,#name)
+#define decl_pipv_variable_d(domain,type,name) ipv::variable<type> name(domain, IPV_NAME(#name), ipv::TypeToInt<type>(),true,#name)
+
+#define decl_ipv_variable_d2(domain,type,name,desc) ipv::variable<type> name(domain, IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc)
+#define decl_pipv_variable_d2(domain,type,name,desc) ipv::variable<type> name(domain, IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc)
+
+#define decl_ipv_variable_d3(domain,type,name,desc,v0) ipv::variable<type, decltype(v0)> name(domain, IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc,v0)
+#define decl_pipv_variable_d3(domain,type,name,desc,v0) ipv::variable<type, decltype(v0)> name(domain, IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc,v0)
+
+// decl_ipv_hot_.. variables are alone on their cache line(s): use them for variables written very often.
+
+#define decl_ipv_hot_variable(type,name) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),false,#name,ipv::placement::hot)
+#define decl_pipv_hot_variable(type,name) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),true,#name,ipv::placement::hot)
+
+#define decl_ipv_hot_variable_2(type,name,desc) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc,ipv::placement::hot)
+#define decl_pipv_hot_variable_2(type,name,desc) ipv::variable<type> name(IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc,ipv::placement::hot)
+
+#define decl_ipv_hot_variable_3(type,name,desc,v0) ipv::variable<type, decltype(v0)> name(IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc,v0,ipv::placement::hot)
+#define decl_pipv_hot_variable_3(type,name,desc,v0) ipv::variable<type, decltype(v0)> name(IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc,v0,ipv::placement::hot)
+
+
+// Macros to declare a variable in an ipv::variable_group. The variables of a group are registered together,
+// when group.commit() is called or when one of them is first accessed.
+
+#define decl_ipv_group_variable(group,type,name) ipv::group_variable<type> name = (group).declare<type>(IPV_NAME(#name), ipv::TypeToInt<type>(),false,#name)
+#define decl_pipv_group_variable(group,type,name) ipv::group_variable<type> name = (group).declare<type>(IPV_NAME(#name), ipv::TypeToInt<type>(),true,#name)
+
+#define decl_ipv_group_variable_2(group,type,name,desc) ipv::group_variable<type> name = (group).declare<type>(IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc)
+#define decl_pipv_group_variable_2(group,type,name,desc) ipv::group_variable<type> name = (group).declare<type>(IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc)
+
+#define decl_ipv_group_variable_3(group,type,name,desc,v0) ipv::group_variable<type> name = (group).declare<type>(IPV_NAME(#name), ipv::TypeToInt<type>(),false,desc,v0)
+#define decl_pipv_group_variable_3(group,type,name,desc,v0) ipv::group_variable<type> name = (group).declare<type>(IPV_NAME(#name), ipv::TypeToInt<type>(),true,desc,v0)
+
+
+// Describes the fields of a simple struct, so that any monitor can print its variables without being compiled with it.
+// Use it at global scope, after the struct definition:
+//   IPV_DESCRIBE_STRUCT(Position, IPV_FIELD(Position, x), IPV_FIELD(Position, y), IPV_FIELD(Position, label))
+// The fields may be numbers, bools, char arrays, arrays of numbers, boost::static_string or described structs.
+
+#define IPV_FIELD(type,field) ipv::describe_field<decltype(type::field)>(#field, offsetof(type, field))
+#define IPV_DESCRIBE_STRUCT(type,...) namespace ipv { template <> struct describe<type> { \
+        static type_description Get() { return type_description(#type, sizeof(type), alignof(type), { __VA_ARGS__ }); } }; }
+
+#endif // _IPVAR_UTILITIES_H
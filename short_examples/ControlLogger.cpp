@@ -24,14 +24,14 @@ int main(int argc, char** argv)
     }
     // set the logger level
     if (std::string(argv[1]) == "stop") {
-        *stopRunning = true;
+        stopRunning.store_and_notify(true);
         std::cout << "Stopping the logger" << std::endl;
     }
     else {
         std::cout << "Setting logger level to " << argv[1] << std::endl;
         try
         {
-            *loggerLevel = std::stoi(argv[1]);
+            loggerLevel.store_and_notify(std::stoi(argv[1]));
         }
         catch (const std::exception&)
         {
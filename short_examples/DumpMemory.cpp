@@ -10,17 +10,31 @@
 
 void ShowIPVars()
 {
-    std::vector<boost::tuple<std::string, std::string, int, void*>> variablesInfo;
+    ipv::SharedMemoryManager::GetInstance().ForEachVariable([](const ipv::IPVarView& var) {
+        std::cout << "Variable name: " << var.name << "  Description: " << var.description << "  Type: " << var.type << std::endl;
+        });
+}
+
 
-    ipv::SharedMemoryManager::GetInstance().ListAllVariables(variablesInfo);
-    for (const auto& varInfo : variablesInfo) {
-        std::cout << "Variable name: " << boost::get<0>(varInfo) << "  Description: " << boost::get<1>(varInfo) << "  Type: " << boost::get<2>(varInfo) << std::endl;
+// Layout report: variables sharing a cache line. Frequent writes to one of them slow down the readers of the others.
+// Declare the hot ones with the decl_ipv_hot_variable macros to give them their own line.
+void ShowSharedCacheLines()
+{
+    std::vector<std::pair<size_t, std::vector<std::string>>> lines;
+
+    ipv::SharedMemoryManager::GetInstance().ListSharedCacheLines(lines);
+    for (const auto& line : lines) {
+        std::cout << "Cache line at offset " << line.first << " shared by:";
+        for (const auto& name : line.second)
+            std::cout << " " << name;
+        std::cout << std::endl;
     }
 }
 
 
 int main() {
     ShowIPVars();
+    ShowSharedCacheLines();
     return 0;
 }
 
@@ -12,7 +12,8 @@
 // Description: This program is a simple example of how to use the Ipvar class.
 // It periodically logs messages based on the logger level.
 // The logger level can be changed at runtime using the ControlLogger program.
-// The program will stop when the stopRunning variable is set to true.
+// The program will stop when the stopRunning variable is set to true: it waits for the change notification
+// of stopRunning instead of sleeping, so that it stops as soon as ControlLogger sets it.
 // Use VariablesMonitor to see the variables in the shared memory.
 
 
@@ -25,13 +26,14 @@ int main(int, char**)
 
     while (!*stopRunning)
     {
+        std::uint32_t stopVersion = stopRunning.version();
         if (*loggerLevel <= 0) std::cout << "TRACE: This is a trace message" << std::endl;
         if (*loggerLevel <= 1) std::cout << "DEBUG: This is a debug message" << std::endl;
         if (*loggerLevel <= 2) std::cout << "INFO: This is an info message" << std::endl;
         if (*loggerLevel <= 3) std::cout << "WARN: This is a warning message" << std::endl;
         if (*loggerLevel <= 4) std::cout << "ERROR: This is an error message" << std::endl;
         std::cout << "-----------------------------------\n";
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        stopRunning.wait_for_change(stopVersion, std::chrono::seconds(1));
     }
     std::cout << "Stop instruction received" << std::endl;
     return 0;
@@ -0,0 +1,86 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_recorder.h"
+
+#include <iostream>
+
+// Description: This program records the history of some interprocess variables, in a process of its own.
+//   RecordHistory record <period ms> <variable>... [--spill <file>] : records until Enter is pressed
+//   RecordHistory show <seconds>                                   : prints the last seconds recorded, from another process
+//   RecordHistory show-file <file>                                 : prints the history spilled to a file
+// Try it with the LoggerExample program running, and the loggerLevel variable.
+
+typedef ipv::history_buffer<512 * 1024> HistoryBuffer;
+
+
+void ShowHistory(const ipv::history_ring& ring, std::int64_t from)
+{
+    std::vector<ipv::history_series> series;
+    std::uint32_t stamp;
+    if (!ring.ReadSchema(series, stamp)) {
+        std::cout << "No history recorded" << std::endl;
+        return;
+    }
+
+    std::int64_t start = 0;
+    ring.Read(series, stamp, from, INT64_MAX, [&](std::int64_t timestamp, const std::uint64_t* values) {
+        if (start == 0)
+            start = timestamp;
+        std::cout << (timestamp - start) / 1000000 << " ms";
+        for (std::size_t i = 0; i < series.size(); ++i)
+            std::cout << "  " << series[i].name << "=" << series[i].AsDouble(values[i]);
+        std::cout << std::endl;
+        });
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string command = argc > 1 ? argv[1] : "";
+
+    if (command == "record" && argc > 3) {
+        decl_ipv_variable_2(HistoryBuffer, ipvHistory, "History of the recorded variables");
+
+        std::vector<std::string> names;
+        std::string spillPath;
+        for (int i = 3; i < argc; ++i) {
+            if (std::string(argv[i]) == "--spill" && i + 1 < argc)
+                spillPath = argv[++i];
+            else
+                names.push_back(argv[i]);
+        }
+
+        ipv::history_recorder recorder((*ipvHistory).ring(), names, std::chrono::milliseconds(std::stoi(argv[2])));
+        if (!spillPath.empty())
+            recorder.SpillTo(spillPath.c_str(), 16 * 1024 * 1024);
+        recorder.Start();
+
+        std::cout << "Recording " << names.size() << " variables, press Enter to stop" << std::endl;
+        std::cin.get();
+        recorder.Stop();
+        return 0;
+    }
+
+    if (command == "show" && argc == 3) {
+        decl_ipv_variable_2(HistoryBuffer, ipvHistory, "History of the recorded variables");
+        std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        ShowHistory((*ipvHistory).ring(), now - std::stoll(argv[2]) * 1000000000LL);
+        return 0;
+    }
+
+    if (command == "show-file" && argc == 3) {
+        ipv::history_file file(argv[2]);
+        ShowHistory(file.Ring(), 0);
+        return 0;
+    }
+
+    std::cout << "Usage: " << argv[0] << " record <period ms> <variable>... [--spill <file>]" << std::endl;
+    std::cout << "Usage: " << argv[0] << " show <seconds>" << std::endl;
+    std::cout << "Usage: " << argv[0] << " show-file <file>" << std::endl;
+    return 1;
+}
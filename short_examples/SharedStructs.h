@@ -20,11 +20,15 @@ struct SharedStructExample2 {
     int c = 7;
 };
 namespace std {
-    std::string to_string(const SharedStructExample2& obj) {
+    inline std::string to_string(const SharedStructExample2& obj) {
         return "a: " + std::to_string(obj.a) + " b: " + std::to_string(obj.b) + " c: " + std::to_string(obj.c);
     }
 };
 
 template <> constexpr int ipv::TypeToInt< SharedStructExample>() { return 26; }
 template <> constexpr int ipv::TypeToInt< SharedStructExample2>() { return 27; }
+
+// The descriptors let any monitor print these structs, without including this file
+IPV_DESCRIBE_STRUCT(SharedStructExample, IPV_FIELD(SharedStructExample, a), IPV_FIELD(SharedStructExample, b), IPV_FIELD(SharedStructExample, c))
+IPV_DESCRIBE_STRUCT(SharedStructExample2, IPV_FIELD(SharedStructExample2, a), IPV_FIELD(SharedStructExample2, b), IPV_FIELD(SharedStructExample2, c))
 #endif
@@ -0,0 +1,79 @@
+// 
+// Distubuted under the MPL-2.0 license, see the LICENSE file
+//   2024 Kamal Boutora. All rights reserved.
+// 
+
+#include "../ipvar/ipvar.h"
+#include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_exporter.h"
+
+#include <iostream>
+#include <thread>
+
+// Description: This program exports the interprocess variables on a Unix domain socket, and reads them back.
+//   VariablesExporter serve <socket>            : serves the variables until killed
+//   VariablesExporter watch <socket> [period ms] : prints the variables which changed, each period (binary format, incremental)
+//   VariablesExporter text <socket>             : prints all the variables once, in the Prometheus text format
+// The text can also be read with: curl --unix-socket <socket> http://localhost/metrics
+// Try it with the LoggerExample program running.
+
+
+void PrintValue(const ipv::exporter_client::value& v)
+{
+    std::cout << v.name << " = ";
+    const char* p = v.bytes.data();
+    switch (v.type)
+    {
+    case ipv::TypeToInt<int>(): case ipv::TypeToInt<std::atomic<int>>(): { int x; std::memcpy(&x, p, sizeof(x)); std::cout << x; break; }
+    case ipv::TypeToInt<long long>(): case ipv::TypeToInt<std::atomic<long long>>(): { long long x; std::memcpy(&x, p, sizeof(x)); std::cout << x; break; }
+    case ipv::TypeToInt<double>(): case ipv::TypeToInt<std::atomic<double>>(): { double x; std::memcpy(&x, p, sizeof(x)); std::cout << x; break; }
+    case ipv::TypeToInt<bool>(): case ipv::TypeToInt<std::atomic<bool>>(): std::cout << (p[0] != 0 ? "true" : "false"); break;
+    default: std::cout << "(" << v.bytes.size() << " bytes)"; break;
+    }
+    std::cout << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        std::cout << "Usage: VariablesExporter serve|watch|text <socket> [period ms]" << std::endl;
+        return 1;
+    }
+    std::string mode = argv[1];
+    try {
+        if (mode == "serve") {
+            ipv::variables_exporter exporter;
+            ipv::exporter_server server(exporter, argv[2]);
+            std::atomic<bool> stop(false);
+            server.Run(stop);
+        }
+        else if (mode == "watch") {
+            ipv::exporter_client client(argv[2]);
+            int period = argc > 3 ? std::atoi(argv[3]) : 1000;
+            while (true) {
+                std::size_t received = client.Fetch([](const ipv::exporter_client::value& v, bool isRemoved) {
+                    if (isRemoved)
+                        std::cout << v.name << " removed" << std::endl;
+                    else
+                        PrintValue(v);
+                    });
+                std::cout << "--- sequence " << client.Sequence() << ": " << received << " changes, " << client.Values().size() << " variables" << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(period));
+            }
+        }
+        else if (mode == "text") {
+            ipv::exporter_client client(argv[2]);
+            std::cout << client.FetchText();
+        }
+        else {
+            std::cout << "Unknown mode " << mode << std::endl;
+            return 1;
+        }
+    }
+    catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
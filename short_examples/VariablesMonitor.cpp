@@ -8,19 +8,17 @@
 #include <chrono>
 #include "../ipvar/ipvar.h"
 #include "../ipvar/ipvar_util.h"
+#include "../ipvar/ipvar_counter.h"
+#include "../ipvar/ipvar_histogram.h"
 
 #include "SharedStructs.h"
 
 
 // This program is a simple example of how to use the Ipvar class.
 // It will monitor the content of all the interprocess variables each 2 seconds, tries to dump the content.
-// Check the SharedStructs.h file for the implementation for custom structures.
-
-
-void GetAllManagedVariables(std::vector<boost::tuple<std::string, std::string, int, void*>>& variablesInfo) {
-    ipv::SharedMemoryManager::GetInstance().ListAllVariables(variablesInfo);
-}
-
+// The variables whose type is described (basic types, structs described with IPV_DESCRIBE_STRUCT) are printed from their descriptor.
+// The others go through GetVariableToString. Check the SharedStructs.h file for custom structures.
+// An optional pattern restricts the monitor to the matching variables, for example: VariablesMonitor "svc.worker12.**"
 
 
 #define SUPPORT_TYPE_T(_TYPENAME) case ipv::TypeToInt< _TYPENAME>(): return std::to_string(*static_cast<_TYPENAME*>(vContent)); break
@@ -53,12 +51,11 @@ std::string GetVariableToString(int codeVariable, void* vContent) {
     case ipv::TypeToInt< std::atomic<unsigned long long> >(): return std::to_string(*static_cast<std::atomic<unsigned long long>*>(vContent)); break;
     case ipv::TypeToInt< std::atomic<bool> >(): return std::to_string(*static_cast<std::atomic<bool>*>(vContent)); break;
     case ipv::TypeToInt< boost::static_string<80> >(): return (const char*)vContent; break;
+    case ipv::TypeToInt< ipv::sharded_counter<long long> >(): return ipv::try_to_string(*static_cast<ipv::sharded_counter<long long>*>(vContent)); break;
+    case ipv::TypeToInt< ipv::sharded_counter<unsigned long long> >(): return ipv::try_to_string(*static_cast<ipv::sharded_counter<unsigned long long>*>(vContent)); break;
+    case ipv::TypeToInt< ipv::histogram >(): return ipv::try_to_string(*static_cast<ipv::histogram*>(vContent)); break;
 
 
-        // Extendede types: check the SharedStructs.h file for the implementation
-    case ipv::TypeToInt< SharedStructExample>(): return ipv::try_to_string<SharedStructExample>(*static_cast<SharedStructExample*>(vContent)); break;
-    case ipv::TypeToInt< SharedStructExample2>(): return std::to_string(*static_cast<SharedStructExample2*>(vContent)); break;
-
 
     default:
         return "Unknown";
@@ -66,20 +63,31 @@ std::string GetVariableToString(int codeVariable, void* vContent) {
 }
 
 
-int main()
+void PrintVariable(const ipv::IPVarView& var)
 {
-    std::vector<boost::tuple<std::string, std::string, int, void*>> variablesInfo;
+    std::cout << "Variable name: " << var.name << "  Description: " << var.description << "  Type: " << var.type << "  Value: ";
+    if (var.descriptor != nullptr && var.descriptor->nbFields != 0) {
+        char text[256];
+        ipv::FormatValue(*var.descriptor, var.ptr, text, sizeof(text));
+        std::cout << text << std::endl;
+    }
+    else {
+        std::cout << GetVariableToString(var.type, var.ptr) << std::endl;
+    }
+}
+
 
+int main(int argc, char** argv)
+{
     decl_ipv_variable(SharedStructExample, customStructVariableUsingAsString);
     decl_ipv_variable(SharedStructExample2, customStructVariableUsingStdToString);
+    ipv::VariablesIndex index;
     try {
         while (true) {
-            GetAllManagedVariables(variablesInfo);
-            for (const auto& varInfo : variablesInfo) {
-
-                // ipv::try_to_string(*static_cast<int*>(boost::get<3>(varInfo)))
-                std::cout << "Variable name: " << boost::get<0>(varInfo) << "  Description: " << boost::get<1>(varInfo) << "  Type: " << boost::get<2>(varInfo) << "  Value: " << GetVariableToString(boost::get<2>(varInfo), boost::get<3>(varInfo)) << std::endl;
-            }
+            if (argc > 1)
+                ipv::SharedMemoryManager::GetInstance().ForEachVariableMatching(index, argv[1], PrintVariable);
+            else
+                ipv::SharedMemoryManager::GetInstance().ForEachVariable(PrintVariable);
             std::cout << "-----------------------------------" << std::endl;
             std::this_thread::sleep_for(std::chrono::milliseconds(2000));
         }